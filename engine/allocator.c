@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+// Device memory is reserved in large blocks per memory type and handed out
+// with a buddy allocator. Each block keeps a binary tree in which every node
+// stores 1 + the order of the largest free run below it (0 when full), so
+// allocation and free are both O(log n) with one byte of bookkeeping per node.
+//
+// Linear resources (buffers) and optimal-tiling images are kept in separate
+// pools whenever bufferImageGranularity is larger than one byte, so the two
+// kinds never share a granularity page.
+
+VkDeviceSize allocatorUnit(uint32_t order) {
+  return (VkDeviceSize)ALLOCATOR_MIN_SIZE << order;
+}
+
+uint32_t allocatorOrder(VkDeviceSize size) {
+  uint32_t order = 0;
+  while (allocatorUnit(order) < size) order++;
+  return order;
+}
+
+void allocatorUpdateParents(MemoryBlock* block, uint32_t node, uint32_t order) {
+  while (node) {
+    node = (node - 1) / 2;
+    order++;
+    uint8_t left = block->longest[node * 2 + 1];
+    uint8_t right = block->longest[node * 2 + 2];
+    // Two completely free buddies merge back into one free parent.
+    if (left == order && right == order) {
+      block->longest[node] = order + 1;
+    } else {
+      block->longest[node] = left > right ? left : right;
+    }
+  }
+}
+
+int allocatorBlockAlloc(MemoryBlock* block, uint32_t order, VkDeviceSize* offset) {
+  if (block->longest[0] < order + 1) return 0;
+
+  uint32_t node = 0;
+  for (uint32_t nodeOrder = block->levels; nodeOrder != order; nodeOrder--) {
+    node = block->longest[node * 2 + 1] >= order + 1 ? node * 2 + 1 : node * 2 + 2;
+  }
+  block->longest[node] = 0;
+  allocatorUpdateParents(block, node, order);
+
+  uint32_t firstAtDepth = (1u << (block->levels - order)) - 1;
+  *offset = (node - firstAtDepth) * allocatorUnit(order);
+  return 1;
+}
+
+void allocatorBlockFree(MemoryBlock* block, VkDeviceSize offset, uint32_t order) {
+  uint32_t firstAtDepth = (1u << (block->levels - order)) - 1;
+  uint32_t node = firstAtDepth + offset / allocatorUnit(order);
+  block->longest[node] = order + 1;
+  allocatorUpdateParents(block, node, order);
+}
+
+MemoryBlock* allocatorCreateBlock(Engine* engine, uint32_t memoryType) {
+  Allocator* allocator = &engine->allocator;
+  VkDeviceSize size = allocator->blockSize[memoryType];
+
+  MemoryBlock* block = calloc(1, sizeof(MemoryBlock));
+  VkMemoryAllocateInfo allocInfo;
+  memset(&allocInfo, 0, sizeof(VkMemoryAllocateInfo));
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = memoryType;
+  if (vkAllocateMemory(engine->device, &allocInfo, NULL, &block->memory) != VK_SUCCESS) {
+    printf("Failed to allocate memory block!\n");
+    exit(1);
+  }
+  allocator->deviceAllocationCount++;
+
+  if (engine->memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    if (vkMapMemory(engine->device, block->memory, 0, VK_WHOLE_SIZE, 0, (void**)&block->mapped) != VK_SUCCESS) {
+      printf("Failed to map memory block!\n");
+      exit(1);
+    }
+  }
+
+  block->size = size;
+  block->levels = allocatorOrder(size);
+  block->longest = malloc((2u << block->levels) - 1);
+  for (uint32_t depth = 0; depth <= block->levels; depth++) {
+    memset(block->longest + (1u << depth) - 1, block->levels - depth + 1, 1u << depth);
+  }
+  return block;
+}
+
+void allocatorDestroyBlock(Engine* engine, MemoryBlock* block) {
+  if (block->mapped) vkUnmapMemory(engine->device, block->memory);
+  vkFreeMemory(engine->device, block->memory, NULL);
+  engine->allocator.deviceAllocationCount--;
+  free(block->longest);
+  free(block);
+}
+
+void engineCreateAllocator(Engine* engine) {
+  Allocator* allocator = &engine->allocator;
+  vkGetPhysicalDeviceMemoryProperties(engine->physicalDevice, &engine->memoryProperties);
+  allocator->granularity = engine->physicalDeviceProperties.limits.bufferImageGranularity;
+  allocator->atomSize = engine->physicalDeviceProperties.limits.nonCoherentAtomSize;
+
+  // Small heaps (e.g. the host-visible BAR window) get proportionally smaller blocks.
+  for (uint32_t n = 0; n < engine->memoryProperties.memoryTypeCount; n++) {
+    VkDeviceSize heapSize = engine->memoryProperties.memoryHeaps[engine->memoryProperties.memoryTypes[n].heapIndex].size;
+    VkDeviceSize blockSize = ALLOCATOR_BLOCK_SIZE;
+    while (blockSize > allocatorUnit(4) && blockSize > heapSize / 8) blockSize /= 2;
+    allocator->blockSize[n] = blockSize;
+  }
+}
+
+void engineDestroyAllocator(Engine* engine) {
+  Allocator* allocator = &engine->allocator;
+  engineAllocatorReport(engine);
+  if (allocator->allocationCount) printf("Allocator: %u allocations still live at shutdown\n", allocator->allocationCount);
+
+  for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; type++) {
+    for (int kind = 0; kind < 2; kind++) {
+      MemoryPool* pool = &allocator->pools[type][kind];
+      for (uint32_t n = 0; n < pool->blockCount; n++) allocatorDestroyBlock(engine, pool->blocks[n]);
+      free(pool->blocks);
+    }
+  }
+}
+
+int engineHasMemoryType(Engine* engine, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+  for (uint32_t n = 0; n < engine->memoryProperties.memoryTypeCount; n++) {
+    if ((typeFilter & (1 << n)) && (engine->memoryProperties.memoryTypes[n].propertyFlags & properties) == properties) return 1;
+  }
+  return 0;
+}
+
+uint32_t engineFindMemoryType(Engine* engine, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+  for (uint32_t n = 0; n < engine->memoryProperties.memoryTypeCount; n++) {
+    if ((typeFilter & (1 << n)) && (engine->memoryProperties.memoryTypes[n].propertyFlags & properties) == properties) {
+      return n;
+    }
+  }
+  printf("Failed to find suitable memory type!\n");
+  exit(1);
+}
+
+// linear is 1 for buffers and linear images, 0 for optimal-tiling images.
+// dedicated forces a separate VkDeviceMemory, for large or frequently
+// recreated resources such as the depth buffer.
+void engineAllocate(Engine* engine, VkMemoryRequirements* requirements, VkMemoryPropertyFlags properties, int linear, int dedicated, Allocation* allocation) {
+  Allocator* allocator = &engine->allocator;
+  memset(allocation, 0, sizeof(Allocation));
+  allocation->memoryType = engineFindMemoryType(engine, requirements->memoryTypeBits, properties);
+  allocation->requested = requirements->size;
+  VkMemoryPropertyFlags typeFlags = engine->memoryProperties.memoryTypes[allocation->memoryType].propertyFlags;
+  uint32_t heap = engine->memoryProperties.memoryTypes[allocation->memoryType].heapIndex;
+
+  // Non-coherent mappings are flushed and invalidated in whole atoms, so keep
+  // every allocation atom aligned and sized.
+  VkDeviceSize size = requirements->size;
+  VkDeviceSize alignment = requirements->alignment;
+  if ((typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(typeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+    if (alignment < allocator->atomSize) alignment = allocator->atomSize;
+    size = (size + allocator->atomSize - 1) / allocator->atomSize * allocator->atomSize;
+  }
+  // Buddy offsets are aligned to their own size.
+  uint32_t order = allocatorOrder(size > alignment ? size : alignment);
+
+  if (dedicated || allocatorUnit(order) > allocator->blockSize[allocation->memoryType] / 2) {
+    VkMemoryAllocateInfo allocInfo;
+    memset(&allocInfo, 0, sizeof(VkMemoryAllocateInfo));
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = allocation->memoryType;
+    if (vkAllocateMemory(engine->device, &allocInfo, NULL, &allocation->memory) != VK_SUCCESS) {
+      printf("Failed to allocate dedicated memory!\n");
+      exit(1);
+    }
+    if (typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+      if (vkMapMemory(engine->device, allocation->memory, 0, VK_WHOLE_SIZE, 0, &allocation->mapped) != VK_SUCCESS) {
+        printf("Failed to map dedicated memory!\n");
+        exit(1);
+      }
+    }
+    allocation->size = size;
+    allocator->deviceAllocationCount++;
+    allocator->heaps[heap].dedicatedBytes += size;
+    allocator->heaps[heap].dedicatedCount++;
+  } else {
+    int kind = allocator->granularity > 1 && !linear;
+    MemoryPool* pool = &allocator->pools[allocation->memoryType][kind];
+    MemoryBlock* block = NULL;
+    for (uint32_t n = 0; n < pool->blockCount && !block; n++) {
+      if (allocatorBlockAlloc(pool->blocks[n], order, &allocation->offset)) block = pool->blocks[n];
+    }
+    if (!block) {
+      block = allocatorCreateBlock(engine, allocation->memoryType);
+      pool->blocks = realloc(pool->blocks, (pool->blockCount + 1) * sizeof(MemoryBlock*));
+      pool->blocks[pool->blockCount++] = block;
+      allocator->heaps[heap].blockBytes += block->size;
+      allocator->heaps[heap].blockCount++;
+      allocatorBlockAlloc(block, order, &allocation->offset);
+    }
+    block->allocationCount++;
+    allocation->memory = block->memory;
+    allocation->size = allocatorUnit(order);
+    allocation->block = block;
+    allocation->order = order;
+    allocation->pool = kind;
+    if (block->mapped) allocation->mapped = block->mapped + allocation->offset;
+    allocator->heaps[heap].suballocatedBytes += allocation->size;
+  }
+  allocator->heaps[heap].requestedBytes += allocation->requested;
+  allocator->allocationCount++;
+}
+
+void engineFree(Engine* engine, Allocation* allocation) {
+  Allocator* allocator = &engine->allocator;
+  if (!allocation->memory) return;
+  uint32_t heap = engine->memoryProperties.memoryTypes[allocation->memoryType].heapIndex;
+
+  if (!allocation->block) {
+    if (allocation->mapped) vkUnmapMemory(engine->device, allocation->memory);
+    vkFreeMemory(engine->device, allocation->memory, NULL);
+    allocator->deviceAllocationCount--;
+    allocator->heaps[heap].dedicatedBytes -= allocation->size;
+    allocator->heaps[heap].dedicatedCount--;
+  } else {
+    MemoryBlock* block = allocation->block;
+    allocatorBlockFree(block, allocation->offset, allocation->order);
+    block->allocationCount--;
+    allocator->heaps[heap].suballocatedBytes -= allocation->size;
+
+    // Release empty blocks, but keep the last one of each pool around to
+    // avoid thrashing vkAllocateMemory.
+    MemoryPool* pool = &allocator->pools[allocation->memoryType][allocation->pool];
+    if (block->allocationCount == 0 && pool->blockCount > 1) {
+      for (uint32_t n = 0; n < pool->blockCount; n++) {
+        if (pool->blocks[n] != block) continue;
+        pool->blocks[n] = pool->blocks[--pool->blockCount];
+        break;
+      }
+      allocator->heaps[heap].blockBytes -= block->size;
+      allocator->heaps[heap].blockCount--;
+      allocatorDestroyBlock(engine, block);
+    }
+  }
+  allocator->heaps[heap].requestedBytes -= allocation->requested;
+  allocator->allocationCount--;
+  memset(allocation, 0, sizeof(Allocation));
+}
+
+// Per heap usage. Fragmentation is 1 - largest free range / total free space
+// across the heap's blocks; waste is the buddy rounding on live allocations.
+void engineAllocatorReport(Engine* engine) {
+  Allocator* allocator = &engine->allocator;
+  printf("Allocator: %u live allocations in %u VkDeviceMemory objects (limit %u)\n", allocator->allocationCount, allocator->deviceAllocationCount, engine->physicalDeviceProperties.limits.maxMemoryAllocationCount);
+  for (uint32_t heap = 0; heap < engine->memoryProperties.memoryHeapCount; heap++) {
+    AllocatorHeapStats* stats = &allocator->heaps[heap];
+    if (!stats->blockCount && !stats->dedicatedCount) continue;
+    VkDeviceSize largestFree = 0;
+    for (uint32_t type = 0; type < engine->memoryProperties.memoryTypeCount; type++) {
+      if (engine->memoryProperties.memoryTypes[type].heapIndex != heap) continue;
+      for (int kind = 0; kind < 2; kind++) {
+        MemoryPool* pool = &allocator->pools[type][kind];
+        for (uint32_t n = 0; n < pool->blockCount; n++) {
+          MemoryBlock* block = pool->blocks[n];
+          VkDeviceSize largest = block->longest[0] ? allocatorUnit(block->longest[0] - 1) : 0;
+          if (largest > largestFree) largestFree = largest;
+        }
+      }
+    }
+    VkDeviceSize freeBytes = stats->blockBytes - stats->suballocatedBytes;
+    VkDeviceSize usedBytes = stats->suballocatedBytes + stats->dedicatedBytes;
+    printf("  heap %u: %u blocks %.1f MB, %.1f MB used by suballocations, %u dedicated %.1f MB, %.1f MB waste, %.1f%% fragmentation\n", heap, stats->blockCount, stats->blockBytes / 1048576.0, stats->suballocatedBytes / 1048576.0, stats->dedicatedCount, stats->dedicatedBytes / 1048576.0, (usedBytes - stats->requestedBytes) / 1048576.0, freeBytes ? 100.0 * (1.0 - (double)largestFree / freeBytes) : 0.0);
+  }
+}
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+#define PIPELINE_BENCH_MAX 64
+
+// A pipeline description is a text file of "key value" lines; blank lines
+// and lines starting with # are ignored, and unset keys keep
+// pipelineDefaultState. For example:
+//
+//   vertex mesh
+//   vert shaders/mesh.vert.spv
+//   frag shaders/triangle.frag.spv
+//   cull none
+//   blend alpha
+//
+// Descriptions always use engine->pipelineLayout.
+typedef struct descriptionValue {
+  const char* name;
+  int value;
+} DescriptionValue;
+
+const DescriptionValue descriptionVertex[] = {{"none", PIPELINE_VERTEXLESS}, {"mesh", PIPELINE_MESH}, {"instanced", PIPELINE_INSTANCED}, {NULL, 0}};
+const DescriptionValue descriptionTopology[] = {{"triangles", VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST}, {"triangle-strip", VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP}, {"lines", VK_PRIMITIVE_TOPOLOGY_LINE_LIST}, {"points", VK_PRIMITIVE_TOPOLOGY_POINT_LIST}, {NULL, 0}};
+const DescriptionValue descriptionPolygon[] = {{"fill", VK_POLYGON_MODE_FILL}, {"line", VK_POLYGON_MODE_LINE}, {"point", VK_POLYGON_MODE_POINT}, {NULL, 0}};
+const DescriptionValue descriptionCull[] = {{"none", VK_CULL_MODE_NONE}, {"front", VK_CULL_MODE_FRONT_BIT}, {"back", VK_CULL_MODE_BACK_BIT}, {"both", VK_CULL_MODE_FRONT_AND_BACK}, {NULL, 0}};
+const DescriptionValue descriptionFront[] = {{"clockwise", VK_FRONT_FACE_CLOCKWISE}, {"counter-clockwise", VK_FRONT_FACE_COUNTER_CLOCKWISE}, {NULL, 0}};
+const DescriptionValue descriptionCompare[] = {{"never", VK_COMPARE_OP_NEVER}, {"less", VK_COMPARE_OP_LESS}, {"equal", VK_COMPARE_OP_EQUAL}, {"less-equal", VK_COMPARE_OP_LESS_OR_EQUAL}, {"greater", VK_COMPARE_OP_GREATER}, {"not-equal", VK_COMPARE_OP_NOT_EQUAL}, {"greater-equal", VK_COMPARE_OP_GREATER_OR_EQUAL}, {"always", VK_COMPARE_OP_ALWAYS}, {NULL, 0}};
+const DescriptionValue descriptionSwitch[] = {{"off", 0}, {"on", 1}, {NULL, 0}};
+const DescriptionValue descriptionBlend[] = {{"off", PIPELINE_BLEND_OFF}, {"alpha", PIPELINE_BLEND_ALPHA}, {"additive", PIPELINE_BLEND_ADDITIVE}, {NULL, 0}};
+
+// Returns 0 if value isn't one of the names.
+int descriptionLookup(const DescriptionValue* values, const char* value, int* result) {
+  for (; values->name; values++) {
+    if (strcmp(values->name, value) == 0) {
+      *result = values->value;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Parse the description at path into source. Returns 0, having printed why,
+// if it can't be read or is invalid.
+int engineLoadPipelineDescription(Engine* engine, const char* path, PipelineSource* source) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    printf("Failed to open pipeline description %s\n", path);
+    return 0;
+  }
+  memset(source, 0, sizeof(PipelineSource));
+  source->kind = PIPELINE_MESH;
+  source->state = pipelineDefaultState();
+  source->layout = engine->pipelineLayout;
+
+  char line[SHADER_PATH_MAX + 64];
+  int lineNumber = 0;
+  int valid = 1;
+  while (valid && fgets(line, sizeof(line), file)) {
+    lineNumber++;
+    char key[32], value[SHADER_PATH_MAX];
+    int fields = sscanf(line, "%31s %255s", key, value);
+    if (fields <= 0 || key[0] == '#') continue;
+    int result = 0;
+    if (fields < 2) {
+      valid = 0;
+    } else if (strcmp(key, "vert") == 0) {
+      snprintf(source->vertPath, SHADER_PATH_MAX, "%s", value);
+    } else if (strcmp(key, "frag") == 0) {
+      snprintf(source->fragPath, SHADER_PATH_MAX, "%s", value);
+    } else if (strcmp(key, "vertex") == 0) {
+      valid = descriptionLookup(descriptionVertex, value, &result);
+      source->kind = result;
+    } else if (strcmp(key, "topology") == 0) {
+      valid = descriptionLookup(descriptionTopology, value, &result);
+      source->state.topology = result;
+    } else if (strcmp(key, "polygon") == 0) {
+      valid = descriptionLookup(descriptionPolygon, value, &result) && (result == VK_POLYGON_MODE_FILL || engine->enabledFeatures.fillModeNonSolid);
+      source->state.polygonMode = result;
+    } else if (strcmp(key, "cull") == 0) {
+      valid = descriptionLookup(descriptionCull, value, &result);
+      source->state.cullMode = result;
+    } else if (strcmp(key, "front") == 0) {
+      valid = descriptionLookup(descriptionFront, value, &result);
+      source->state.frontFace = result;
+    } else if (strcmp(key, "depth-test") == 0) {
+      valid = descriptionLookup(descriptionSwitch, value, &source->state.depthTest);
+    } else if (strcmp(key, "depth-write") == 0) {
+      valid = descriptionLookup(descriptionSwitch, value, &source->state.depthWrite);
+    } else if (strcmp(key, "depth-compare") == 0) {
+      valid = descriptionLookup(descriptionCompare, value, &result);
+      source->state.depthCompare = result;
+    } else if (strcmp(key, "blend") == 0) {
+      valid = descriptionLookup(descriptionBlend, value, &result);
+      source->state.blend = result;
+    } else {
+      valid = 0;
+    }
+  }
+  fclose(file);
+  if (!valid) {
+    printf("Pipeline description %s:%d: invalid line\n", path, lineNumber);
+    return 0;
+  }
+  if (!source->vertPath[0] || !source->fragPath[0]) {
+    printf("Pipeline description %s: vert and frag are required\n", path);
+    return 0;
+  }
+  return 1;
+}
+
+void* compilerThread(void* data) {
+  PipelineCompiler* compiler = data;
+  uint32_t n;
+  while ((n = atomic_fetch_add(&compiler->next, 1)) < compiler->count) {
+    compiler->pipelines[n] = pipelineBuildWithModules(compiler->engine, &compiler->sources[n], compiler->vertModules[n], compiler->fragModules[n]);
+  }
+  return NULL;
+}
+
+// Acquire every source's modules up front; the shader cache hands pipelines
+// with the same code the same module.
+void compilerAcquireModules(Engine* engine, PipelineCompiler* compiler) {
+  for (uint32_t n = 0; n < compiler->count; n++) {
+    PipelineSource* source = &compiler->sources[n];
+    compiler->vertModules[n] = engineAcquireShaderModule(engine, source->vertPath);
+    compiler->fragModules[n] = pipelineHasFragment(source) ? engineAcquireShaderModule(engine, source->fragPath) : VK_NULL_HANDLE;
+    if (!compiler->vertModules[n] || (!compiler->fragModules[n] && pipelineHasFragment(source))) {
+      printf("Failed to load shaders for %s!\n", source->vertPath);
+      exit(1);
+    }
+  }
+}
+
+// Build count pipelines on up to threadCount workers, 0 for one per core,
+// sharing engine->pipelineCache and the shader cache's modules.
+void compilerRun(Engine* engine, PipelineSource* sources, uint32_t count, uint32_t threadCount, VkPipeline* pipelines) {
+  PipelineCompiler compiler;
+  memset(&compiler, 0, sizeof(PipelineCompiler));
+  compiler.engine = engine;
+  compiler.sources = sources;
+  compiler.count = count;
+  compiler.pipelines = pipelines;
+  compiler.vertModules = malloc(sizeof(VkShaderModule) * count);
+  compiler.fragModules = malloc(sizeof(VkShaderModule) * count);
+  atomic_init(&compiler.next, 0);
+  compilerAcquireModules(engine, &compiler);
+
+  if (threadCount == 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = cores < 1 ? 1 : cores;
+  }
+  if (threadCount > PIPELINE_COMPILE_MAX_THREADS) threadCount = PIPELINE_COMPILE_MAX_THREADS;
+  if (threadCount > count) threadCount = count;
+  if (threadCount <= 1) {
+    compilerThread(&compiler);
+  } else {
+    pthread_t threads[PIPELINE_COMPILE_MAX_THREADS];
+    for (uint32_t n = 0; n < threadCount; n++) {
+      if (pthread_create(&threads[n], NULL, compilerThread, &compiler) != 0) {
+        printf("Failed to create pipeline compiler thread!\n");
+        exit(1);
+      }
+    }
+    for (uint32_t n = 0; n < threadCount; n++) pthread_join(threads[n], NULL);
+  }
+
+  for (uint32_t n = 0; n < count; n++) {
+    engineReleaseShaderModule(engine, compiler.vertModules[n]);
+    if (compiler.fragModules[n]) engineReleaseShaderModule(engine, compiler.fragModules[n]);
+  }
+  free(compiler.vertModules);
+  free(compiler.fragModules);
+  for (uint32_t n = 0; n < count; n++) {
+    if (!pipelines[n]) {
+      printf("Failed to create pipeline from %s!\n", sources[n].vertPath);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+// Build count pipelines concurrently into pipelines, ready for
+// engineAddPipeline, and register them for hot reload. threadCount 0 uses one
+// worker per core.
+void engineCompilePipelines(Engine* engine, PipelineSource* sources, uint32_t count, uint32_t threadCount, VkPipeline* pipelines) {
+  if (count == 0) return;
+  double startTime = getTime();
+  compilerRun(engine, sources, count, threadCount, pipelines);
+  for (uint32_t n = 0; n < count; n++) {
+    sources[n].pipeline = pipelines[n];
+    engineRegisterPipelineSource(engine, &sources[n]);
+  }
+  engine->pipelineCreateTime += getTime() - startTime;
+}
+
+// Compile 1, 8 and 64 distinct pipelines on one thread and then on one per
+// core. Each run starts from an empty pipeline cache so the driver compiles
+// every pipeline.
+void engineBenchmarkPipelines(Engine* engine) {
+  PipelineSource sources[PIPELINE_BENCH_MAX];
+  VkPipeline pipelines[PIPELINE_BENCH_MAX];
+  const char* fragPaths[2] = {"shaders/triangle.frag.spv", "shaders/textured.frag.spv"};
+  for (uint32_t n = 0; n < PIPELINE_BENCH_MAX; n++) {
+    PipelineSource* source = &sources[n];
+    memset(source, 0, sizeof(PipelineSource));
+    source->kind = PIPELINE_MESH;
+    snprintf(source->vertPath, SHADER_PATH_MAX, "shaders/mesh.vert.spv");
+    snprintf(source->fragPath, SHADER_PATH_MAX, "%s", fragPaths[n % 2]);
+    source->state = pipelineDefaultState();
+    source->state.depthCompare = VK_COMPARE_OP_NEVER + (n / 2) % 8;
+    source->state.cullMode = (n / 16) % 4;
+    source->state.blend = n / 16 >= 2 ? PIPELINE_BLEND_ALPHA : PIPELINE_BLEND_OFF;
+    source->layout = engine->pipelineLayout;
+  }
+
+  VkPipelineCache sharedCache = engine->pipelineCache;
+  VkPipelineCacheCreateInfo cacheInfo;
+  memset(&cacheInfo, 0, sizeof(VkPipelineCacheCreateInfo));
+  cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  uint32_t counts[3] = {1, 8, PIPELINE_BENCH_MAX};
+  for (int c = 0; c < 3; c++) {
+    double times[2];
+    uint32_t threads[2] = {1, 0};
+    for (int mode = 0; mode < 2; mode++) {
+      if (vkCreatePipelineCache(engine->device, &cacheInfo, NULL, &engine->pipelineCache) != VK_SUCCESS) {
+        printf("Failed to create pipeline cache!\n");
+        exit(1);
+      }
+      double startTime = getTime();
+      compilerRun(engine, sources, counts[c], threads[mode], pipelines);
+      times[mode] = getTime() - startTime;
+      for (uint32_t n = 0; n < counts[c]; n++) vkDestroyPipeline(engine->device, pipelines[n], NULL);
+      vkDestroyPipelineCache(engine->device, engine->pipelineCache, NULL);
+    }
+    printf("Pipelines %2u (%u shader modules cached): serial %.1f ms, parallel %.1f ms (%.2fx)\n", counts[c], engine->shaders.count, times[0] * 1000.0, times[1] * 1000.0, times[0] / times[1]);
+  }
+  engine->pipelineCache = sharedCache;
+}
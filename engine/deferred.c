@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+#define DEFERRED_DEFAULT_LIGHTS 64
+#define DEFERRED_INPUTS (GBUFFER_COUNT + 1)
+
+// Matches the Light struct of lighting.frag, in normalised device
+// coordinates.
+typedef struct light {
+  float position[3];
+  float radius;
+  float color[4];
+} Light;
+
+typedef struct lightingConstants {
+  float size[2];
+  uint32_t lightCount;
+} LightingConstants;
+
+// Random lights just in front of the scene, fixed for the run.
+void deferredCreateLights(Engine* engine) {
+  Deferred* deferred = &engine->deferred;
+  deferred->lightCount = engine->config.lightCount ? engine->config.lightCount : DEFERRED_DEFAULT_LIGHTS;
+  engineCreateBuffer(engine, sizeof(Light) * deferred->lightCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &deferred->lightBuffer, &deferred->lightMemory);
+  Light* lights = deferred->lightMemory.mapped;
+  srand(1);
+  for (uint32_t n = 0; n < deferred->lightCount; n++) {
+    lights[n].position[0] = rand() / (float)RAND_MAX * 2.0f - 1.0f;
+    lights[n].position[1] = rand() / (float)RAND_MAX * 2.0f - 1.0f;
+    lights[n].position[2] = rand() / (float)RAND_MAX * 0.1f;
+    lights[n].radius = rand() / (float)RAND_MAX * 0.4f + 0.2f;
+    for (int c = 0; c < 3; c++) lights[n].color[c] = rand() / (float)RAND_MAX;
+    lights[n].color[3] = 1.0f;
+  }
+}
+
+void engineCreateDeferred(Engine* engine) {
+  Deferred* deferred = &engine->deferred;
+  if (!engine->config.deferred) return;
+  deferredCreateLights(engine);
+
+  VkDescriptorSetLayoutBinding bindings[DEFERRED_INPUTS + 1];
+  memset(bindings, 0, sizeof(bindings));
+  for (uint32_t n = 0; n <= DEFERRED_INPUTS; n++) {
+    bindings[n].binding = n;
+    bindings[n].descriptorType = n < DEFERRED_INPUTS ? VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[n].descriptorCount = 1;
+    bindings[n].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  }
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo;
+  memset(&setLayoutInfo, 0, sizeof(VkDescriptorSetLayoutCreateInfo));
+  setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  setLayoutInfo.bindingCount = DEFERRED_INPUTS + 1;
+  setLayoutInfo.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(engine->device, &setLayoutInfo, NULL, &deferred->setLayout) != VK_SUCCESS) {
+    printf("Failed to create lighting descriptor set layout!\n");
+    exit(1);
+  }
+
+  VkPushConstantRange range;
+  range.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  range.offset = 0;
+  range.size = sizeof(LightingConstants);
+  VkPipelineLayoutCreateInfo layoutInfo;
+  memset(&layoutInfo, 0, sizeof(VkPipelineLayoutCreateInfo));
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &deferred->setLayout;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &range;
+  if (vkCreatePipelineLayout(engine->device, &layoutInfo, NULL, &deferred->layout) != VK_SUCCESS) {
+    printf("Failed to create lighting pipeline layout!\n");
+    exit(1);
+  }
+
+  // A full-screen triangle with no depth attachment to test against.
+  PipelineState state = pipelineDefaultState();
+  state.cullMode = VK_CULL_MODE_NONE;
+  state.depthTest = 0;
+  state.depthWrite = 0;
+  state.subpass = 1;
+  deferred->lightingPipeline = pipelineCreateWithState(engine, PIPELINE_VERTEXLESS, "shaders/fullscreen.vert.spv", "shaders/lighting.frag.spv", &state, deferred->layout);
+}
+
+// Called with each new depth buffer, before the framebuffers are built on
+// the G-buffer. The old G-buffer and descriptor set go on the deletion queue
+// while frames in flight may still use them.
+void engineResizeDeferred(Engine* engine) {
+  Deferred* deferred = &engine->deferred;
+  if (!engine->config.deferred) return;
+  engineDeferDestroy(engine, DELETE_DESCRIPTOR_POOL, (uint64_t)deferred->descriptorPool);
+  for (int n = 0; n < GBUFFER_COUNT; n++) {
+    engineDeferDestroy(engine, DELETE_IMAGE_VIEW, (uint64_t)deferred->views[n]);
+    engineDeferDestroy(engine, DELETE_IMAGE, (uint64_t)deferred->images[n]);
+    engineDeferFree(engine, &deferred->memory[n]);
+  }
+
+  VkFormat formats[GBUFFER_COUNT] = {GBUFFER_ALBEDO_FORMAT, GBUFFER_SLOPE_FORMAT};
+  for (int n = 0; n < GBUFFER_COUNT; n++) {
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    engineCreateImage(engine, engine->extent.width, engine->extent.height, 1, formats[n], VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, 1, &deferred->images[n], &deferred->memory[n]);
+    engineCreateImageView(engine, deferred->images[n], formats[n], VK_IMAGE_ASPECT_COLOR_BIT, &deferred->views[n]);
+  }
+
+  VkDescriptorPoolSize poolSizes[2];
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+  poolSizes[0].descriptorCount = DEFERRED_INPUTS;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[1].descriptorCount = 1;
+  VkDescriptorPoolCreateInfo poolInfo;
+  memset(&poolInfo, 0, sizeof(VkDescriptorPoolCreateInfo));
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 2;
+  poolInfo.pPoolSizes = poolSizes;
+  if (vkCreateDescriptorPool(engine->device, &poolInfo, NULL, &deferred->descriptorPool) != VK_SUCCESS) {
+    printf("Failed to create lighting descriptor pool!\n");
+    exit(1);
+  }
+  VkDescriptorSetAllocateInfo allocInfo;
+  memset(&allocInfo, 0, sizeof(VkDescriptorSetAllocateInfo));
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = deferred->descriptorPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &deferred->setLayout;
+  if (vkAllocateDescriptorSets(engine->device, &allocInfo, &deferred->set) != VK_SUCCESS) {
+    printf("Failed to allocate lighting descriptor set!\n");
+    exit(1);
+  }
+
+  // In the layouts the lighting subpass reads them in.
+  VkDescriptorImageInfo imageInfos[DEFERRED_INPUTS];
+  for (int n = 0; n < GBUFFER_COUNT; n++) imageInfos[n] = (VkDescriptorImageInfo){VK_NULL_HANDLE, deferred->views[n], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+  imageInfos[GBUFFER_COUNT] = (VkDescriptorImageInfo){VK_NULL_HANDLE, engine->depthImageView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL};
+  VkDescriptorBufferInfo bufferInfo = {deferred->lightBuffer, 0, VK_WHOLE_SIZE};
+  VkWriteDescriptorSet writes[DEFERRED_INPUTS + 1];
+  memset(writes, 0, sizeof(writes));
+  for (uint32_t n = 0; n <= DEFERRED_INPUTS; n++) {
+    writes[n].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[n].dstSet = deferred->set;
+    writes[n].dstBinding = n;
+    writes[n].descriptorCount = 1;
+    if (n < DEFERRED_INPUTS) {
+      writes[n].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+      writes[n].pImageInfo = &imageInfos[n];
+    } else {
+      writes[n].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[n].pBufferInfo = &bufferInfo;
+    }
+  }
+  vkUpdateDescriptorSets(engine->device, DEFERRED_INPUTS + 1, writes, 0, NULL);
+}
+
+// Called once the device is idle.
+void engineDestroyDeferred(Engine* engine) {
+  Deferred* deferred = &engine->deferred;
+  if (!engine->config.deferred) return;
+  vkDestroyDescriptorPool(engine->device, deferred->descriptorPool, NULL);
+  for (int n = 0; n < GBUFFER_COUNT; n++) {
+    vkDestroyImageView(engine->device, deferred->views[n], NULL);
+    vkDestroyImage(engine->device, deferred->images[n], NULL);
+    engineFree(engine, &deferred->memory[n]);
+  }
+  vkDestroyPipeline(engine->device, deferred->lightingPipeline, NULL);
+  vkDestroyPipelineLayout(engine->device, deferred->layout, NULL);
+  vkDestroyDescriptorSetLayout(engine->device, deferred->setLayout, NULL);
+  vkDestroyBuffer(engine->device, deferred->lightBuffer, NULL);
+  engineFree(engine, &deferred->lightMemory);
+}
+
+// Recorded inline after the scene subpass, in the main render pass.
+void engineDeferredLighting(Engine* engine, VkCommandBuffer commandBuffer) {
+  Deferred* deferred = &engine->deferred;
+  if (!engine->config.deferred) return;
+  vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+  engineSetViewport(engine, commandBuffer);
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, deferred->lightingPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, deferred->layout, 0, 1, &deferred->set, 0, NULL);
+  LightingConstants constants;
+  constants.size[0] = (float)engine->renderExtent.width;
+  constants.size[1] = (float)engine->renderExtent.height;
+  constants.lightCount = deferred->lightCount;
+  vkCmdPushConstants(commandBuffer, deferred->layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(LightingConstants), &constants);
+  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+}
+
+// One main render pass attachment: the memory bound to it, the part of that
+// a lazily allocated one has actually been given, and its load and store
+// traffic per frame.
+void attachmentReportLine(Engine* engine, const char* name, Allocation* memory, int loaded, int stored, VkDeviceSize* totals) {
+  VkDeviceSize bytes = (VkDeviceSize)engine->extent.width * engine->extent.height * 4;
+  VkDeviceSize bound = memory ? memory->size : 0;
+  VkDeviceSize committed = bound;
+  int lazy = memory && (engine->memoryProperties.memoryTypes[memory->memoryType].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+  if (lazy) vkGetDeviceMemoryCommitment(engine->device, memory->memory, &committed);
+  VkDeviceSize traffic = bytes * (loaded + stored);
+  printf("  %-7s %6.1f MB %-16s %6.1f MB committed, %6.1f MB/frame loaded and stored\n", name, bound / 1048576.0, lazy ? "lazily allocated" : memory ? "device local" : "swapchain", committed / 1048576.0, traffic / 1048576.0);
+  totals[0] += bound;
+  totals[1] += committed;
+  totals[2] += traffic;
+  // Forward rendering would write the G-buffer out and read it back.
+  if (!loaded && !stored && memory) totals[3] += 2 * bytes;
+}
+
+// Per-frame memory and bandwidth estimates for the main render pass's
+// attachments. The traffic is what a tiled GPU moves for LOAD and STORE ops;
+// attachments that are neither stay on chip.
+void engineAttachmentReport(Engine* engine) {
+  VkDeviceSize totals[4] = {0, 0, 0, 0};
+  int prepass = engine->hiz.enabled;
+  printf("Attachments at %ux%u:\n", engine->extent.width, engine->extent.height);
+  attachmentReportLine(engine, "color", engine->config.headless ? &engine->offscreenImageMemory[0] : NULL, 0, 1, totals);
+  // The depth pre-pass stores the depth and the main pass loads it again.
+  attachmentReportLine(engine, "depth", &engine->depthImageMemory, prepass, prepass, totals);
+  if (engine->config.deferred) {
+    attachmentReportLine(engine, "albedo", &engine->deferred.memory[0], 0, 0, totals);
+    attachmentReportLine(engine, "slope", &engine->deferred.memory[1], 0, 0, totals);
+  }
+  printf("Attachments: %.1f MB bound, %.1f MB committed, %.1f MB/frame loaded and stored (%.1f MB/frame if the on-chip ones went through memory)\n", totals[0] / 1048576.0, totals[1] / 1048576.0, totals[2] / 1048576.0, (totals[2] + totals[3]) / 1048576.0);
+}
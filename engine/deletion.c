@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+const char* deletionTypeNames[DELETE_TYPE_COUNT] = {"pipeline", "buffer", "image", "image view", "framebuffer", "descriptor pool", "swapchain", "memory", "mesh", "callback"};
+
+void deletionDestroy(Engine* engine, Deletion* deletion) {
+  switch (deletion->type) {
+    case DELETE_PIPELINE:
+      vkDestroyPipeline(engine->device, (VkPipeline)deletion->handle, NULL);
+      break;
+    case DELETE_BUFFER:
+      vkDestroyBuffer(engine->device, (VkBuffer)deletion->handle, NULL);
+      break;
+    case DELETE_IMAGE:
+      vkDestroyImage(engine->device, (VkImage)deletion->handle, NULL);
+      break;
+    case DELETE_IMAGE_VIEW:
+      vkDestroyImageView(engine->device, (VkImageView)deletion->handle, NULL);
+      break;
+    case DELETE_FRAMEBUFFER:
+      vkDestroyFramebuffer(engine->device, (VkFramebuffer)deletion->handle, NULL);
+      break;
+    case DELETE_DESCRIPTOR_POOL:
+      vkDestroyDescriptorPool(engine->device, (VkDescriptorPool)deletion->handle, NULL);
+      break;
+    case DELETE_SWAPCHAIN:
+      vkDestroySwapchainKHR(engine->device, (VkSwapchainKHR)deletion->handle, NULL);
+      break;
+    case DELETE_MEMORY:
+      engineFree(engine, &deletion->allocation);
+      break;
+    case DELETE_MESH:
+      engineDestroyMesh(engine, deletion->data);
+      break;
+    case DELETE_CALLBACK:
+      deletion->callback(engine, deletion->data);
+      break;
+    default:
+      break;
+  }
+}
+
+void engineCreateDeletionQueue(Engine* engine) {
+  pthread_mutex_init(&engine->deletion.mutex, NULL);
+}
+
+// Called once the device is idle. Whatever is still queued is destroyed now
+// and listed, along with how long objects waited.
+void engineDestroyDeletionQueue(Engine* engine) {
+  DeletionQueue* deletion = &engine->deletion;
+  uint64_t enqueued = 0;
+  for (int type = 0; type < DELETE_TYPE_COUNT; type++) enqueued += deletion->enqueued[type];
+  if (enqueued) {
+    printf("Deletion queue: %lu objects enqueued, peak depth %u", enqueued, deletion->peak);
+    if (deletion->destroyed) printf(", destroyed after %.1f frames %.3f ms avg, %lu frames %.3f ms max", (double)deletion->latencyFrames / deletion->destroyed, deletion->latencyTime * 1000.0 / deletion->destroyed, deletion->latencyFramesMax, deletion->latencyTimeMax * 1000.0);
+    printf("\n");
+  }
+  if (deletion->count) {
+    uint32_t pending[DELETE_TYPE_COUNT];
+    memset(pending, 0, sizeof(pending));
+    for (uint32_t n = 0; n < deletion->count; n++) pending[deletion->entries[n].type]++;
+    printf("Deletion queue: %u objects still queued at shutdown:", deletion->count);
+    for (int type = 0; type < DELETE_TYPE_COUNT; type++) {
+      if (pending[type]) printf(" %u %s", pending[type], deletionTypeNames[type]);
+    }
+    printf("\n");
+  }
+  for (uint32_t n = 0; n < deletion->count; n++) deletionDestroy(engine, &deletion->entries[n]);
+  free(deletion->entries);
+  pthread_mutex_destroy(&deletion->mutex);
+}
+
+// Called at the start of each frame: everything whose graphics timeline
+// value has been reached can go. Work on the other queues that used an
+// object was waited for by a graphics submission before that value.
+void engineDeletionBeginFrame(Engine* engine) {
+  DeletionQueue* deletion = &engine->deletion;
+  uint64_t completed = engineTimelineCompleted(engine, engine->graphicsTimeline);
+  pthread_mutex_lock(&deletion->mutex);
+  double now = getTime();
+  uint32_t done = 0;
+  while (done < deletion->count && deletion->entries[done].value && deletion->entries[done].value <= completed) {
+    Deletion* entry = &deletion->entries[done++];
+    deletionDestroy(engine, entry);
+    uint64_t frames = engine->frameCount - entry->frame;
+    double time = now - entry->time;
+    deletion->destroyed++;
+    deletion->latencyFrames += frames;
+    deletion->latencyTime += time;
+    if (frames > deletion->latencyFramesMax) deletion->latencyFramesMax = frames;
+    if (time > deletion->latencyTimeMax) deletion->latencyTimeMax = time;
+  }
+  memmove(deletion->entries, deletion->entries + done, sizeof(Deletion) * (deletion->count - done));
+  deletion->count -= done;
+  pthread_mutex_unlock(&deletion->mutex);
+}
+
+void deletionPush(Engine* engine, Deletion* entry) {
+  DeletionQueue* deletion = &engine->deletion;
+  pthread_mutex_lock(&deletion->mutex);
+  // The next frame may still use the object. Its value is only known once
+  // it is submitted, as uploads and culling can share the graphics queue.
+  entry->value = 0;
+  entry->frame = engine->frameCount;
+  entry->time = getTime();
+  if (deletion->count == deletion->capacity) {
+    deletion->capacity = deletion->capacity ? deletion->capacity * 2 : 64;
+    deletion->entries = realloc(deletion->entries, sizeof(Deletion) * deletion->capacity);
+  }
+  deletion->entries[deletion->count++] = *entry;
+  if (deletion->count > deletion->peak) deletion->peak = deletion->count;
+  deletion->enqueued[entry->type]++;
+  pthread_mutex_unlock(&deletion->mutex);
+}
+
+// Called with the value of each frame's graphics submission. Entries queued
+// since the previous one wait for it, as it is the first frame that can't
+// have been recorded before they were.
+void engineDeletionSubmitted(Engine* engine, uint64_t value) {
+  DeletionQueue* deletion = &engine->deletion;
+  pthread_mutex_lock(&deletion->mutex);
+  for (uint32_t n = deletion->count; n > 0 && !deletion->entries[n - 1].value; n--) deletion->entries[n - 1].value = value;
+  pthread_mutex_unlock(&deletion->mutex);
+}
+
+// Destroy a Vulkan object once no frame that may have used it is still in
+// flight, e.g. engineDeferDestroy(engine, DELETE_BUFFER, (uint64_t)buffer).
+// Safe to call from any thread.
+void engineDeferDestroy(Engine* engine, DeletionType type, uint64_t handle) {
+  if (!handle) return;
+  Deletion entry;
+  memset(&entry, 0, sizeof(Deletion));
+  entry.type = type;
+  entry.handle = handle;
+  deletionPush(engine, &entry);
+}
+
+// Takes over the allocation, which is cleared.
+void engineDeferFree(Engine* engine, Allocation* allocation) {
+  if (!allocation->memory) return;
+  Deletion entry;
+  memset(&entry, 0, sizeof(Deletion));
+  entry.type = DELETE_MEMORY;
+  entry.allocation = *allocation;
+  memset(allocation, 0, sizeof(Allocation));
+  deletionPush(engine, &entry);
+}
+
+// For meshes streamed out while frames that draw them are in flight.
+void engineDeferDestroyMesh(Engine* engine, Mesh* mesh) {
+  Deletion entry;
+  memset(&entry, 0, sizeof(Deletion));
+  entry.type = DELETE_MESH;
+  entry.data = mesh;
+  deletionPush(engine, &entry);
+}
+
+// For anything else, such as objects owned by a caller's own structure. The
+// callback runs with the queue locked, so it mustn't enqueue.
+void engineDeferCall(Engine* engine, void (*callback)(Engine* engine, void* data), void* data) {
+  Deletion entry;
+  memset(&entry, 0, sizeof(Deletion));
+  entry.type = DELETE_CALLBACK;
+  entry.callback = callback;
+  entry.data = data;
+  deletionPush(engine, &entry);
+}
@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+#define DESCRIPTOR_BENCH_RESOURCES 64
+#define DESCRIPTOR_BENCH_DRAWS 1000
+#define DESCRIPTOR_BENCH_FRAMES 100
+
+// Sized for sets of a few images and buffers each.
+VkDescriptorPool descriptorsCreatePool(Engine* engine) {
+  VkDescriptorPoolSize poolSizes[4];
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[0].descriptorCount = DESCRIPTOR_POOL_SETS * 4;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[1].descriptorCount = DESCRIPTOR_POOL_SETS * 4;
+  poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  poolSizes[2].descriptorCount = DESCRIPTOR_POOL_SETS * 4;
+  poolSizes[3].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+  poolSizes[3].descriptorCount = DESCRIPTOR_POOL_SETS * 4;
+  VkDescriptorPoolCreateInfo poolInfo;
+  memset(&poolInfo, 0, sizeof(VkDescriptorPoolCreateInfo));
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = DESCRIPTOR_POOL_SETS;
+  poolInfo.poolSizeCount = 4;
+  poolInfo.pPoolSizes = poolSizes;
+  VkDescriptorPool pool;
+  if (vkCreateDescriptorPool(engine->device, &poolInfo, NULL, &pool) != VK_SUCCESS) {
+    printf("Failed to create frame descriptor pool!\n");
+    exit(1);
+  }
+  return pool;
+}
+
+void descriptorsCreateBindless(Engine* engine) {
+  Descriptors* descriptors = &engine->descriptors;
+  descriptors->imageCapacity = engine->bindlessImageLimit < BINDLESS_MAX_IMAGES ? engine->bindlessImageLimit : BINDLESS_MAX_IMAGES;
+  descriptors->bufferCapacity = engine->bindlessBufferLimit < BINDLESS_MAX_BUFFERS ? engine->bindlessBufferLimit : BINDLESS_MAX_BUFFERS;
+
+  VkDescriptorSetLayoutBinding bindings[2];
+  memset(bindings, 0, sizeof(bindings));
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[0].descriptorCount = descriptors->imageCapacity;
+  bindings[0].stageFlags = BINDLESS_STAGES;
+  bindings[1].binding = 1;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[1].descriptorCount = descriptors->bufferCapacity;
+  bindings[1].stageFlags = BINDLESS_STAGES;
+
+  // Slots are written as resources arrive and rewritten once the frames that
+  // used them have finished, while the set stays bound.
+  VkDescriptorBindingFlagsEXT bindingFlags[2];
+  bindingFlags[0] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+  bindingFlags[1] = bindingFlags[0];
+  VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo;
+  memset(&bindingFlagsInfo, 0, sizeof(bindingFlagsInfo));
+  bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+  bindingFlagsInfo.bindingCount = 2;
+  bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo;
+  memset(&layoutInfo, 0, sizeof(VkDescriptorSetLayoutCreateInfo));
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.pNext = &bindingFlagsInfo;
+  layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+  layoutInfo.bindingCount = 2;
+  layoutInfo.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(engine->device, &layoutInfo, NULL, &descriptors->bindlessSetLayout) != VK_SUCCESS) {
+    printf("Failed to create bindless descriptor set layout!\n");
+    exit(1);
+  }
+
+  VkDescriptorPoolSize poolSizes[2];
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[0].descriptorCount = descriptors->imageCapacity;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSizes[1].descriptorCount = descriptors->bufferCapacity;
+  VkDescriptorPoolCreateInfo poolInfo;
+  memset(&poolInfo, 0, sizeof(VkDescriptorPoolCreateInfo));
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 2;
+  poolInfo.pPoolSizes = poolSizes;
+  if (vkCreateDescriptorPool(engine->device, &poolInfo, NULL, &descriptors->bindlessPool) != VK_SUCCESS) {
+    printf("Failed to create bindless descriptor pool!\n");
+    exit(1);
+  }
+
+  VkDescriptorSetAllocateInfo allocInfo;
+  memset(&allocInfo, 0, sizeof(VkDescriptorSetAllocateInfo));
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptors->bindlessPool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &descriptors->bindlessSetLayout;
+  if (vkAllocateDescriptorSets(engine->device, &allocInfo, &descriptors->bindlessSet) != VK_SUCCESS) {
+    printf("Failed to allocate bindless descriptor set!\n");
+    exit(1);
+  }
+  descriptors->bindless = 1;
+}
+
+void engineCreateDescriptors(Engine* engine) {
+  Descriptors* descriptors = &engine->descriptors;
+  for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+    descriptors->framePools[frame][0] = descriptorsCreatePool(engine);
+    descriptors->framePoolCount[frame] = 1;
+  }
+  if (engine->descriptorIndexing) descriptorsCreateBindless(engine);
+}
+
+void engineDestroyDescriptors(Engine* engine) {
+  Descriptors* descriptors = &engine->descriptors;
+  for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+    for (uint32_t n = 0; n < descriptors->framePoolCount[frame]; n++) vkDestroyDescriptorPool(engine->device, descriptors->framePools[frame][n], NULL);
+  }
+  if (!descriptors->bindless) return;
+  vkDestroyDescriptorPool(engine->device, descriptors->bindlessPool, NULL);
+  vkDestroyDescriptorSetLayout(engine->device, descriptors->bindlessSetLayout, NULL);
+}
+
+// Called once the current frame's last submission has completed: every set
+// allocated for it last time round is released at once.
+void engineDescriptorsBeginFrame(Engine* engine) {
+  Descriptors* descriptors = &engine->descriptors;
+  int frame = engine->currentFrame;
+  for (uint32_t n = 0; n < descriptors->framePoolCount[frame] && n <= descriptors->framePoolCurrent[frame]; n++) {
+    vkResetDescriptorPool(engine->device, descriptors->framePools[frame][n], 0);
+  }
+  descriptors->framePoolCurrent[frame] = 0;
+}
+
+// A set that is valid until the frame's next submission completes. Moves on
+// to the next pool in the frame's chain, creating it if needed, once one is
+// exhausted.
+VkDescriptorSet engineAllocateFrameDescriptorSet(Engine* engine, VkDescriptorSetLayout setLayout) {
+  Descriptors* descriptors = &engine->descriptors;
+  int frame = engine->currentFrame;
+  VkDescriptorSetAllocateInfo allocInfo;
+  memset(&allocInfo, 0, sizeof(VkDescriptorSetAllocateInfo));
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &setLayout;
+  while (1) {
+    VkDescriptorSet set;
+    allocInfo.descriptorPool = descriptors->framePools[frame][descriptors->framePoolCurrent[frame]];
+    VkResult result = vkAllocateDescriptorSets(engine->device, &allocInfo, &set);
+    if (result == VK_SUCCESS) {
+      descriptors->setsAllocated++;
+      return set;
+    }
+    if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) break;
+    uint32_t next = descriptors->framePoolCurrent[frame] + 1;
+    if (next == MAX_DESCRIPTOR_POOLS) break;
+    if (next == descriptors->framePoolCount[frame]) descriptors->framePools[frame][descriptors->framePoolCount[frame]++] = descriptorsCreatePool(engine);
+    descriptors->framePoolCurrent[frame] = next;
+  }
+  printf("Failed to allocate frame descriptor set!\n");
+  exit(1);
+}
+
+// Reserve count consecutive bindless slots. Slots are never returned; the
+// arrays are sized for every resource the engine will load.
+uint32_t engineBindlessAllocateImages(Engine* engine, uint32_t count) {
+  Descriptors* descriptors = &engine->descriptors;
+  if (descriptors->imageCount + count > descriptors->imageCapacity) {
+    printf("Too many bindless images!\n");
+    exit(1);
+  }
+  descriptors->imageCount += count;
+  return descriptors->imageCount - count;
+}
+
+uint32_t engineBindlessAllocateBuffers(Engine* engine, uint32_t count) {
+  Descriptors* descriptors = &engine->descriptors;
+  if (descriptors->bufferCount + count > descriptors->bufferCapacity) {
+    printf("Too many bindless buffers!\n");
+    exit(1);
+  }
+  descriptors->bufferCount += count;
+  return descriptors->bufferCount - count;
+}
+
+// The slot must not be read by a frame still in flight.
+void engineBindlessWriteImage(Engine* engine, uint32_t slot, VkImageView view, VkSampler sampler) {
+  VkDescriptorImageInfo imageInfo;
+  imageInfo.sampler = sampler;
+  imageInfo.imageView = view;
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  VkWriteDescriptorSet write;
+  memset(&write, 0, sizeof(VkWriteDescriptorSet));
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = engine->descriptors.bindlessSet;
+  write.dstBinding = 0;
+  write.dstArrayElement = slot;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.pImageInfo = &imageInfo;
+  vkUpdateDescriptorSets(engine->device, 1, &write, 0, NULL);
+  engine->descriptors.updates++;
+}
+
+void engineBindlessWriteBuffer(Engine* engine, uint32_t slot, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+  VkDescriptorBufferInfo bufferInfo;
+  bufferInfo.buffer = buffer;
+  bufferInfo.offset = offset;
+  bufferInfo.range = range;
+  VkWriteDescriptorSet write;
+  memset(&write, 0, sizeof(VkWriteDescriptorSet));
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = engine->descriptors.bindlessSet;
+  write.dstBinding = 1;
+  write.dstArrayElement = slot;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  write.pBufferInfo = &bufferInfo;
+  vkUpdateDescriptorSets(engine->device, 1, &write, 0, NULL);
+  engine->descriptors.updates++;
+}
+
+// Bind the global set and select image and buffer slots for following draws.
+void engineBindBindless(Engine* engine, VkCommandBuffer commandBuffer, uint32_t image, uint32_t buffer) {
+  BindlessIndices indices = {image, buffer};
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, engine->pipelineLayout, 0, 1, &engine->descriptors.bindlessSet, 0, NULL);
+  vkCmdPushConstants(commandBuffer, engine->pipelineLayout, BINDLESS_STAGES, 0, sizeof(BindlessIndices), &indices);
+}
+
+void descriptorsBenchmarkBegin(Engine* engine, VkCommandBuffer commandBuffer) {
+  vkResetCommandBuffer(commandBuffer, 0);
+  VkCommandBufferBeginInfo beginInfo;
+  memset(&beginInfo, 0, sizeof(VkCommandBufferBeginInfo));
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+}
+
+// Give DESCRIPTOR_BENCH_DRAWS draws per frame one of a set of image and
+// buffer pairs, either through a set allocated and written per draw from the
+// frame pool or through push constants into the bindless arrays. Commands are
+// recorded but never submitted, so this times CPU descriptor work only.
+void engineBenchmarkDescriptors(Engine* engine) {
+  Descriptors* descriptors = &engine->descriptors;
+  vkDeviceWaitIdle(engine->device);
+
+  VkImage image;
+  Allocation imageMemory;
+  engineCreateImage(engine, 1, 1, 1, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &image, &imageMemory);
+  VkImageViewCreateInfo viewInfo;
+  memset(&viewInfo, 0, sizeof(VkImageViewCreateInfo));
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.layerCount = 1;
+  VkImageView view;
+  if (vkCreateImageView(engine->device, &viewInfo, NULL, &view) != VK_SUCCESS) {
+    printf("Failed to create benchmark image view!\n");
+    exit(1);
+  }
+  VkSamplerCreateInfo samplerInfo;
+  memset(&samplerInfo, 0, sizeof(VkSamplerCreateInfo));
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  VkSampler sampler = engineGetSampler(engine, &samplerInfo);
+  VkBuffer buffer;
+  Allocation bufferMemory;
+  engineCreateBuffer(engine, 256 * DESCRIPTOR_BENCH_RESOURCES, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffer, &bufferMemory);
+
+  VkDescriptorSetLayoutBinding bindings[2];
+  memset(bindings, 0, sizeof(bindings));
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags = BINDLESS_STAGES;
+  bindings[1].binding = 1;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[1].descriptorCount = 1;
+  bindings[1].stageFlags = BINDLESS_STAGES;
+  VkDescriptorSetLayoutCreateInfo layoutInfo;
+  memset(&layoutInfo, 0, sizeof(VkDescriptorSetLayoutCreateInfo));
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 2;
+  layoutInfo.pBindings = bindings;
+  VkDescriptorSetLayout setLayout;
+  VkPipelineLayout pipelineLayout;
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo;
+  memset(&pipelineLayoutInfo, 0, sizeof(VkPipelineLayoutCreateInfo));
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &setLayout;
+  if (vkCreateDescriptorSetLayout(engine->device, &layoutInfo, NULL, &setLayout) != VK_SUCCESS || vkCreatePipelineLayout(engine->device, &pipelineLayoutInfo, NULL, &pipelineLayout) != VK_SUCCESS) {
+    printf("Failed to create benchmark descriptor layouts!\n");
+    exit(1);
+  }
+
+  VkCommandBuffer commandBuffer = engine->commandBuffers[engine->currentFrame];
+  uint64_t updatesBefore = descriptors->updates;
+  double startTime = getTime();
+  for (int frame = 0; frame < DESCRIPTOR_BENCH_FRAMES; frame++) {
+    engineDescriptorsBeginFrame(engine);
+    descriptorsBenchmarkBegin(engine, commandBuffer);
+    for (uint32_t draw = 0; draw < DESCRIPTOR_BENCH_DRAWS; draw++) {
+      uint32_t resource = draw % DESCRIPTOR_BENCH_RESOURCES;
+      VkDescriptorSet set = engineAllocateFrameDescriptorSet(engine, setLayout);
+      VkDescriptorImageInfo imageInfo = {sampler, view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+      VkDescriptorBufferInfo bufferInfo = {buffer, 256 * resource, 256};
+      VkWriteDescriptorSet writes[2];
+      memset(writes, 0, sizeof(writes));
+      writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[0].dstSet = set;
+      writes[0].dstBinding = 0;
+      writes[0].descriptorCount = 1;
+      writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      writes[0].pImageInfo = &imageInfo;
+      writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[1].dstSet = set;
+      writes[1].dstBinding = 1;
+      writes[1].descriptorCount = 1;
+      writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[1].pBufferInfo = &bufferInfo;
+      vkUpdateDescriptorSets(engine->device, 2, writes, 0, NULL);
+      descriptors->updates += 2;
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &set, 0, NULL);
+    }
+    vkEndCommandBuffer(commandBuffer);
+  }
+  double elapsed = getTime() - startTime;
+  printf("Descriptors per-frame pools: %u draws, %.1f updates/frame, %.3f ms/frame\n", DESCRIPTOR_BENCH_DRAWS, (double)(descriptors->updates - updatesBefore) / DESCRIPTOR_BENCH_FRAMES, elapsed * 1000.0 / DESCRIPTOR_BENCH_FRAMES);
+  engineDescriptorsBeginFrame(engine);
+
+  if (descriptors->bindless) {
+    updatesBefore = descriptors->updates;
+    uint32_t images = engineBindlessAllocateImages(engine, DESCRIPTOR_BENCH_RESOURCES);
+    uint32_t buffers = engineBindlessAllocateBuffers(engine, DESCRIPTOR_BENCH_RESOURCES);
+    for (uint32_t n = 0; n < DESCRIPTOR_BENCH_RESOURCES; n++) {
+      engineBindlessWriteImage(engine, images + n, view, sampler);
+      engineBindlessWriteBuffer(engine, buffers + n, buffer, 256 * n, 256);
+    }
+    uint64_t setupUpdates = descriptors->updates - updatesBefore;
+
+    updatesBefore = descriptors->updates;
+    startTime = getTime();
+    for (int frame = 0; frame < DESCRIPTOR_BENCH_FRAMES; frame++) {
+      descriptorsBenchmarkBegin(engine, commandBuffer);
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, engine->pipelineLayout, 0, 1, &descriptors->bindlessSet, 0, NULL);
+      for (uint32_t draw = 0; draw < DESCRIPTOR_BENCH_DRAWS; draw++) {
+        uint32_t resource = draw % DESCRIPTOR_BENCH_RESOURCES;
+        BindlessIndices indices = {images + resource, buffers + resource};
+        vkCmdPushConstants(commandBuffer, engine->pipelineLayout, BINDLESS_STAGES, 0, sizeof(BindlessIndices), &indices);
+      }
+      vkEndCommandBuffer(commandBuffer);
+    }
+    elapsed = getTime() - startTime;
+    printf("Descriptors bindless:        %u draws, %.1f updates/frame, %.3f ms/frame (%lu updates at setup)\n", DESCRIPTOR_BENCH_DRAWS, (double)(descriptors->updates - updatesBefore) / DESCRIPTOR_BENCH_FRAMES, elapsed * 1000.0 / DESCRIPTOR_BENCH_FRAMES, setupUpdates);
+  } else {
+    printf("Descriptors bindless:        unavailable\n");
+  }
+
+  vkResetCommandBuffer(commandBuffer, 0);
+  vkDestroyPipelineLayout(engine->device, pipelineLayout, NULL);
+  vkDestroyDescriptorSetLayout(engine->device, setLayout, NULL);
+  vkDestroyBuffer(engine->device, buffer, NULL);
+  engineFree(engine, &bufferMemory);
+  vkDestroyImageView(engine->device, view, NULL);
+  vkDestroyImage(engine->device, image, NULL);
+  engineFree(engine, &imageMemory);
+}
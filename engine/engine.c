@@ -9,9 +9,10 @@
 void engineCreateWindow(Engine *engine);
 void engineCreateInstance(Engine *engine);
 void engineCreateSurface(Engine *engine);
+int enginePhysicalDeviceQueues(Engine *engine, VkPhysicalDevice device, uint32_t families[3]);
 void enginePhysicalDeviceSelect(Engine *engine);
 void engineCreateDevice(Engine *engine);
-void engineCreateSwapChain(Engine *engine);
+void engineCreateOffscreenImages(Engine *engine);
 void engineCreateSwapChainImageViews(Engine *engine);
 void engineCreateRenderPass(Engine *engine);
 void engineCreateCommandPool(Engine *engine);
@@ -19,62 +20,149 @@ void engineCreateCommandBuffers(Engine *engine);
 void engineCreateDepthResources(Engine *engine);
 void engineCreateFramebuffers(Engine *engine);
 void engineCreateSyncObjects(Engine *engine);
-void engineCreateImage(Engine *engine, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage *image, VkDeviceMemory *imageMemory);
-void engineCreateImageView(Engine *engine, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView *imageView);
 void engineDestroySwapChain(Engine *engine);
-void engineDrawFrame(Engine *engine);
 void enginePipelineLayoutCreate(Engine *engine);
 
 // Public Functions
 
-Engine *engineCreate(void) {
+EngineConfig engineDefaultConfig(void) {
+  EngineConfig config;
+  memset(&config, 0, sizeof(EngineConfig));
+  config.headlessFrames = 1000;
+  config.width = 800;
+  config.height = 600;
+  config.framesInFlight = 2;
+  config.swapChainImages = 4;
+  config.refreshRate = 60.0;
+  return config;
+}
+
+Engine *engineCreate(EngineConfig *config) {
   Engine *engine;
-  engine = malloc(sizeof(Engine));
-  engineCreateWindow(engine);
+  engine = calloc(1, sizeof(Engine));
+  engine->config = *config;
+  engineCreateTrace(engine);
+  engineCreatePacing(engine);
+  engineCreateDeletionQueue(engine);
+  double startTime = getTime();
+  if (!engine->config.headless) engineCreateWindow(engine);
   engineCreateInstance(engine);
-  engineCreateSurface(engine);
+  if (!engine->config.headless) engineCreateSurface(engine);
   enginePhysicalDeviceSelect(engine);
   engineCreateDevice(engine);
   vkGetDeviceQueue(engine->device, engine->queueFamilyIndex, 0, &engine->queue);
+  vkGetDeviceQueue(engine->device, engine->computeFamilyIndex, 0, &engine->computeQueue);
+  vkGetDeviceQueue(engine->device, engine->transferFamilyIndex, 0, &engine->transferQueue);
+  engineCreateTimelines(engine);
+  engineCreateAllocator(engine);
+  engineCreateUploader(engine);
+  engineCreateShaders(engine);
+  engineCreatePipelineCache(engine);
+  engineCreateReload(engine);
+  engineCreateResolution(engine);
   engineCreateRenderPass(engine);
 
   engineCreateCommandPool(engine);
   engineCreateCommandBuffers(engine);
+  engineCreateRecorder(engine);
+  engineCreateRenderQueue(engine);
   engineCreateSyncObjects(engine);
-
-  engineCreateSwapChain(engine);
+  engineCreateReadback(engine);
+  engineCreateProfiler(engine);
+  engineCreateTextures(engine);
+  engineCreateDescriptors(engine);
+  engineCreateHiZ(engine);
+  engineCreateDeferred(engine);
+
+  if (engine->config.headless) {
+    engineCreateOffscreenImages(engine);
+  } else {
+    engineCreateSwapChain(engine);
+  }
   enginePipelineLayoutCreate(engine);
+  engineCreateIndirect(engine);
+  engineCreateInstancer(engine);
 
+  engine->createTime = getTime() - startTime;
   return engine;
 }
 
 void engineRun(Engine *engine) {
-  while (!glfwWindowShouldClose(engine->window)) {
-    glfwPollEvents();
-    engineDrawFrame(engine);
+  printf("Startup: engine %.1f ms, %d pipelines %.1f ms (pipeline cache %s, %zu bytes)\n", engine->createTime * 1000.0, engine->pipelineCount, engine->pipelineCreateTime * 1000.0, engine->pipelineCacheLoadedSize ? "warm" : "cold", engine->pipelineCacheLoadedSize);
+  if (engine->config.headless) {
+    double startTime = getTime();
+    for (int n = 0; n < engine->config.headlessFrames; n++) engineRunFrame(engine);
+    vkDeviceWaitIdle(engine->device);
+    double elapsed = getTime() - startTime;
+    printf("Headless: %d frames at %ux%u in %.3f s (%.1f frames/s)\n", engine->config.headlessFrames, engine->extent.width, engine->extent.height, elapsed, engine->config.headlessFrames / elapsed);
+    engineAttachmentReport(engine);
+    engineResolutionReport(engine);
+    return;
+  }
+  while (!glfwWindowShouldClose(engine->window)) engineRunFrame(engine);
+  vkDeviceWaitIdle(engine->device);
+  engineAttachmentReport(engine);
+  engineResolutionReport(engine);
+}
+
+// One turn of the frame loop: wait out the frame limiter, poll input, let
+// the frame callback submit work and draw. Headless, the poll is simulated.
+void engineRunFrame(Engine *engine) {
+  enginePaceFrame(engine);
+  uint64_t frameStart = traceBegin();
+  if (engine->config.lateLatch) {
+    engineTimelineWait(engine, engine->graphicsTimeline, engine->frameValues[engine->currentFrame]);
+    traceEnd(engine, TRACE_WAIT_FRAME, frameStart);
   }
+  uint64_t phaseStart = traceBegin();
+  if (!engine->config.headless) glfwPollEvents();
+  enginePacingPoll(engine);
+  traceEnd(engine, TRACE_POLL_EVENTS, phaseStart);
+  if (engine->frameCallback) engine->frameCallback(engine, engine->frameCallbackData);
+  engineDrawFrame(engine);
+  traceEnd(engine, TRACE_FRAME, frameStart);
 }
 
 void engineDestroy(Engine *engine) {
+  engineDestroyReload(engine);
+  engineDestroyReadback(engine);
   engineDestroySwapChain(engine);
+  engineDestroyDeletionQueue(engine);
 
   for (int n = 0; n < engine->pipelineCount; n++) {
     vkDestroyPipeline(engine->device, engine->pipelines[n], NULL);
+    if (engine->pipelineMeshes[n]) engineDestroyMesh(engine, engine->pipelineMeshes[n]);
   }
   vkDestroyPipelineLayout(engine->device, engine->pipelineLayout, NULL);
+  engineDestroyIndirect(engine);
+  engineDestroyHiZ(engine);
+  engineDestroyDeferred(engine);
+  engineDestroyResolution(engine);
+  engineDestroyInstancer(engine);
+  engineDestroyTextures(engine);
+  engineDestroyDescriptors(engine);
+  engineDestroyPipelineCache(engine);
+  engineDestroyShaders(engine);
+  engineDestroyProfiler(engine);
 
   for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
     vkDestroySemaphore(engine->device, engine->imageAvailableSemaphores[n], NULL);
     vkDestroySemaphore(engine->device, engine->renderFinishedSemaphores[n], NULL);
-    vkDestroyFence(engine->device, engine->inFlightFences[n], NULL);
   }
 
+  engineDestroyRecorder(engine);
+  engineDestroyRenderQueue(engine);
   vkDestroyCommandPool(engine->device, engine->commandPool, NULL);
   vkDestroyRenderPass(engine->device, engine->renderPass, NULL);
+  engineDestroyUploader(engine);
+  engineDestroyTimelines(engine);
+  engineDestroyAllocator(engine);
   vkDestroyDevice(engine->device, NULL);
-  vkDestroySurfaceKHR(engine->instance, engine->surface, NULL);
+  if (!engine->config.headless) vkDestroySurfaceKHR(engine->instance, engine->surface, NULL);
   vkDestroyInstance(engine->instance, NULL);
-  glfwDestroyWindow(engine->window);
+  if (!engine->config.headless) glfwDestroyWindow(engine->window);
+  engineDestroyPacing(engine);
+  engineDestroyTrace(engine);
   free(engine);
 }
 
@@ -86,14 +174,54 @@ void engineAddPipeline(Engine *engine, VkPipeline pipeline) {
   engine->pipelines[engine->pipelineCount++] = pipeline;
 }
 
+// Draw mesh with pipeline every frame, sampling texture if it isn't NULL.
+// The engine takes ownership of the mesh; textures are always engine-owned.
+void engineAddMeshPipeline(Engine *engine, VkPipeline pipeline, Mesh *mesh, Texture *texture) {
+  engineAddPipeline(engine, pipeline);
+  engine->pipelineMeshes[engine->pipelineCount - 1] = mesh;
+  engine->pipelineTextures[engine->pipelineCount - 1] = texture;
+}
+
+void engineSetFrameCallback(Engine *engine, void (*callback)(Engine *engine, void *data), void *data) {
+  engine->frameCallback = callback;
+  engine->frameCallbackData = data;
+}
+
 // Private functions
 
 void engineCreateInstance(Engine *engine) {
   const char *validationLayers = "VK_LAYER_KHRONOS_validation";
 
-  uint32_t glfwExtensionCount;
-  const char **glfwExtensions;
-  glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+  // Headless rendering needs no surface extensions, and therefore no GLFW.
+  uint32_t glfwExtensionCount = 0;
+  const char **glfwExtensions = NULL;
+  if (!engine->config.headless) glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+  // Needed to query descriptor indexing and timeline semaphore support on
+  // devices older than 1.1.
+  uint32_t availableCount;
+  vkEnumerateInstanceExtensionProperties(NULL, &availableCount, NULL);
+  VkExtensionProperties available[availableCount];
+  vkEnumerateInstanceExtensionProperties(NULL, &availableCount, available);
+  const char *instanceExtensions[glfwExtensionCount + 1];
+  uint32_t instanceExtensionCount = 0;
+  for (uint32_t n = 0; n < glfwExtensionCount; n++) instanceExtensions[instanceExtensionCount++] = glfwExtensions[n];
+  for (uint32_t n = 0; n < availableCount; n++) {
+    if (strcmp(available[n].extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+      instanceExtensions[instanceExtensionCount++] = VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
+      engine->physicalDeviceProperties2 = 1;
+    }
+  }
+
+  // Batch render nodes often lack the SDK, so only enable validation if installed.
+  uint32_t layerCount;
+  vkEnumerateInstanceLayerProperties(&layerCount, NULL);
+  VkLayerProperties layers[layerCount];
+  vkEnumerateInstanceLayerProperties(&layerCount, layers);
+  int validationAvailable = 0;
+  for (int n = 0; n < layerCount; n++) {
+    if (strcmp(layers[n].layerName, validationLayers) == 0) validationAvailable = 1;
+  }
 
   VkApplicationInfo appInfo;
   memset(&appInfo, 0, sizeof(appInfo));
@@ -102,15 +230,16 @@ void engineCreateInstance(Engine *engine) {
   appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
   appInfo.pEngineName = "No Engine";
   appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  // Timeline semaphores are core in 1.2.
+  appInfo.apiVersion = VK_API_VERSION_1_2;
 
   VkInstanceCreateInfo createInfo;
   memset(&createInfo, 0, sizeof(createInfo));
   createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
   createInfo.pApplicationInfo = &appInfo;
-  createInfo.enabledExtensionCount = glfwExtensionCount;
-  createInfo.ppEnabledExtensionNames = glfwExtensions;
-  createInfo.enabledLayerCount = 1;
+  createInfo.enabledExtensionCount = instanceExtensionCount;
+  createInfo.ppEnabledExtensionNames = instanceExtensions;
+  createInfo.enabledLayerCount = validationAvailable;
   createInfo.ppEnabledLayerNames = &validationLayers;
 
   if (vkCreateInstance(&createInfo, NULL, &engine->instance) != VK_SUCCESS) {
@@ -136,6 +265,40 @@ void engineCreateSurface(Engine *engine) {
   }
 }
 
+// Queue families for one device: graphics must also do compute, for culling
+// on the graphics queue, and present unless headless. Compute and transfer
+// use families without graphics when there are any, so that culling and
+// uploads run alongside rendering; otherwise they share the graphics family.
+// Returns 0 if the device can't render.
+int enginePhysicalDeviceQueues(Engine *engine, VkPhysicalDevice device, uint32_t families[3]) {
+  uint32_t queueFamilyCount;
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, NULL);
+  if (queueFamilyCount == 0) return 0;
+  VkQueueFamilyProperties queueFamilies[queueFamilyCount];
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies);
+  int graphics = -1;
+  int compute = -1;
+  int transfer = -1;
+  for (uint32_t n = 0; n < queueFamilyCount; n++) {
+    VkQueueFlags flags = queueFamilies[n].queueFlags;
+    if (queueFamilies[n].queueCount == 0) continue;
+    if (graphics < 0 && (flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) {
+      VkBool32 presentSupport = engine->config.headless;
+      if (!engine->config.headless) vkGetPhysicalDeviceSurfaceSupportKHR(device, n, engine->surface, &presentSupport);
+      if (presentSupport) graphics = n;
+    }
+    if (compute < 0 && (flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) compute = n;
+    if (transfer < 0 && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) transfer = n;
+  }
+  if (graphics < 0) return 0;
+  families[0] = graphics;
+  families[1] = compute < 0 || engine->config.singleQueue ? graphics : compute;
+  families[2] = transfer < 0 || engine->config.singleQueue ? graphics : transfer;
+  return 1;
+}
+
+// Score every device that can render: discrete beats integrated beats the
+// rest, then a separate compute and transfer family each count.
 void enginePhysicalDeviceSelect(Engine *engine) {
   uint32_t deviceCount;
   vkEnumeratePhysicalDevices(engine->instance, &deviceCount, NULL);
@@ -146,60 +309,171 @@ void enginePhysicalDeviceSelect(Engine *engine) {
   VkPhysicalDevice devices[deviceCount];
   vkEnumeratePhysicalDevices(engine->instance, &deviceCount, devices);
 
-  for (int n = 0; n < deviceCount; n++) {
-    VkPhysicalDevice device = devices[n];
-    uint32_t queueFamilyCount;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, NULL);
-    if (queueFamilyCount == 0) continue;
-    VkQueueFamilyProperties queueFamilies[queueFamilyCount];
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies);
-    for (int n = 0; n < queueFamilyCount; n++) {
-      VkQueueFamilyProperties queueFamily = queueFamilies[n];
-      int required_queue_flags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_TRANSFER_BIT;
-      if (queueFamily.queueFlags & required_queue_flags == required_queue_flags) {
-        VkBool32 presentSupport = VK_FALSE;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, n, engine->surface, &presentSupport);
-        if (presentSupport) {
-          engine->physicalDevice = device;
-          engine->queueFamilyIndex = n;
-          return;
-        }
-      }
-    }
+  int bestScore = -1;
+  for (uint32_t n = 0; n < deviceCount; n++) {
+    uint32_t families[3];
+    if (!enginePhysicalDeviceQueues(engine, devices[n], families)) continue;
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(devices[n], &properties);
+    int score = properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ? 1000 : properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ? 100 : 0;
+    score += (families[1] != families[0]) * 10 + (families[2] != families[0]) * 10;
+    if (score <= bestScore) continue;
+    bestScore = score;
+    engine->physicalDevice = devices[n];
+    engine->physicalDeviceProperties = properties;
+    engine->queueFamilyIndex = families[0];
+    engine->computeFamilyIndex = families[1];
+    engine->transferFamilyIndex = families[2];
+  }
+  if (bestScore < 0) {
     printf("No suitable GPU found!\n");
     exit(EXIT_FAILURE);
   }
+
+  engine->queueFamilies[engine->queueFamilyCount++] = engine->queueFamilyIndex;
+  if (engine->computeFamilyIndex != engine->queueFamilyIndex) engine->queueFamilies[engine->queueFamilyCount++] = engine->computeFamilyIndex;
+  if (engine->transferFamilyIndex != engine->queueFamilyIndex) engine->queueFamilies[engine->queueFamilyCount++] = engine->transferFamilyIndex;
+  printf("GPU: %s, %s compute, %s transfer\n", engine->physicalDeviceProperties.deviceName, engine->computeFamilyIndex != engine->queueFamilyIndex ? "async" : "graphics queue", engine->transferFamilyIndex != engine->queueFamilyIndex ? "dedicated" : "graphics queue");
 }
 
 void engineCreateDevice(Engine *engine) {
-  const char *deviceExtensions = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+  const char *deviceExtensions[5];
+  uint32_t deviceExtensionCount = 0;
+  if (!engine->config.headless) deviceExtensions[deviceExtensionCount++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+
+  // Optional, lets indirect draws take their count from a GPU buffer.
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(engine->physicalDevice, NULL, &extensionCount, NULL);
+  VkExtensionProperties extensions[extensionCount];
+  vkEnumerateDeviceExtensionProperties(engine->physicalDevice, NULL, &extensionCount, extensions);
+  int descriptorIndexingAvailable = 0;
+  int maintenance3Available = 0;
+  int timelineExtension = 0;
+  for (uint32_t n = 0; n < extensionCount; n++) {
+    if (strcmp(extensions[n].extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0) {
+      deviceExtensions[deviceExtensionCount++] = VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+      engine->drawIndirectCount = 1;
+    }
+    if (strcmp(extensions[n].extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0) descriptorIndexingAvailable = 1;
+    if (strcmp(extensions[n].extensionName, VK_KHR_MAINTENANCE3_EXTENSION_NAME) == 0) maintenance3Available = 1;
+    if (strcmp(extensions[n].extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0) timelineExtension = 1;
+  }
 
-  VkDeviceQueueCreateInfo queueCreateInfo;
-  memset(&queueCreateInfo, 0, sizeof(queueCreateInfo));
+  // Required: every queue submission signals a timeline semaphore.
+  int timelineCore = engine->physicalDeviceProperties.apiVersion >= VK_API_VERSION_1_2;
+  VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures;
+  memset(&timelineFeatures, 0, sizeof(timelineFeatures));
+  timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+  VkPhysicalDeviceFeatures2KHR features2;
+  memset(&features2, 0, sizeof(features2));
+  features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+  features2.pNext = &timelineFeatures;
+  if (timelineCore) {
+    vkGetPhysicalDeviceFeatures2(engine->physicalDevice, &features2);
+  } else if (timelineExtension && engine->physicalDeviceProperties2) {
+    // The core entry point isn't valid for devices older than 1.1.
+    PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(engine->instance, "vkGetPhysicalDeviceFeatures2KHR");
+    getFeatures2(engine->physicalDevice, &features2);
+  }
+  if (!timelineFeatures.timelineSemaphore) {
+    printf("Timeline semaphores are not supported!\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!timelineCore) deviceExtensions[deviceExtensionCount++] = VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME;
+
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(engine->physicalDevice, &supportedFeatures);
+
+  // Bindless descriptors need partially bound runtime arrays that can be
+  // updated after binding, including while other entries are in use. The
+  // texture array is indexed with a push constant, which is dynamically
+  // uniform indexing.
+  VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures;
+  memset(&indexingFeatures, 0, sizeof(indexingFeatures));
+  indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+  if (engine->config.bindless && engine->physicalDeviceProperties2 && descriptorIndexingAvailable && maintenance3Available && supportedFeatures.shaderSampledImageArrayDynamicIndexing) {
+    PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(engine->instance, "vkGetPhysicalDeviceFeatures2KHR");
+    PFN_vkGetPhysicalDeviceProperties2KHR getProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(engine->instance, "vkGetPhysicalDeviceProperties2KHR");
+    VkPhysicalDeviceFeatures2KHR features2;
+    memset(&features2, 0, sizeof(features2));
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features2.pNext = &indexingFeatures;
+    getFeatures2(engine->physicalDevice, &features2);
+    if (indexingFeatures.runtimeDescriptorArray && indexingFeatures.descriptorBindingPartiallyBound && indexingFeatures.descriptorBindingSampledImageUpdateAfterBind && indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind && indexingFeatures.descriptorBindingUpdateUnusedWhilePending) {
+      VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties;
+      memset(&indexingProperties, 0, sizeof(indexingProperties));
+      indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+      VkPhysicalDeviceProperties2KHR properties2;
+      memset(&properties2, 0, sizeof(properties2));
+      properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+      properties2.pNext = &indexingProperties;
+      getProperties2(engine->physicalDevice, &properties2);
+      engine->bindlessImageLimit = indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages;
+      if (indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers < engine->bindlessImageLimit) engine->bindlessImageLimit = indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers;
+      engine->bindlessBufferLimit = indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers;
+      if (indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers < engine->bindlessBufferLimit) engine->bindlessBufferLimit = indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers;
+      engine->descriptorIndexing = 1;
+    }
+  }
+  if (engine->descriptorIndexing) {
+    deviceExtensions[deviceExtensionCount++] = VK_KHR_MAINTENANCE3_EXTENSION_NAME;
+    deviceExtensions[deviceExtensionCount++] = VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME;
+    // Enable only what bindless uses rather than everything supported.
+    memset(&indexingFeatures, 0, sizeof(indexingFeatures));
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+    indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+    indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+    indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+  } else if (engine->config.bindless) {
+    printf("Bindless descriptors unavailable, using per-texture descriptor sets\n");
+  }
+
+  // One queue from each family in use.
+  VkDeviceQueueCreateInfo queueCreateInfos[3];
+  memset(queueCreateInfos, 0, sizeof(queueCreateInfos));
   float queuePriority = 1.0f;
-  queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-  queueCreateInfo.queueFamilyIndex = engine->queueFamilyIndex;
-  queueCreateInfo.queueCount = 1;
-  queueCreateInfo.pQueuePriorities = &queuePriority;
+  for (uint32_t n = 0; n < engine->queueFamilyCount; n++) {
+    queueCreateInfos[n].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfos[n].queueFamilyIndex = engine->queueFamilies[n];
+    queueCreateInfos[n].queueCount = 1;
+    queueCreateInfos[n].pQueuePriorities = &queuePriority;
+  }
 
   VkPhysicalDeviceFeatures deviceFeatures;
   memset(&deviceFeatures, 0, sizeof(deviceFeatures));
   deviceFeatures.samplerAnisotropy = VK_TRUE;
+  deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+  deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+  // For wireframe and point pipeline descriptions.
+  deviceFeatures.fillModeNonSolid = supportedFeatures.fillModeNonSolid;
+  // For the Hi-Z benchmark's overdraw count.
+  deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+  // So blended pipelines leave the other G-buffer attachments opaque.
+  deviceFeatures.independentBlend = supportedFeatures.independentBlend;
+  deviceFeatures.shaderSampledImageArrayDynamicIndexing = engine->descriptorIndexing;
 
   VkDeviceCreateInfo deviceCreateInfo;
   memset(&deviceCreateInfo, 0, sizeof(deviceCreateInfo));
   deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-  deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
-  deviceCreateInfo.queueCreateInfoCount = 1;
+  deviceCreateInfo.pNext = &timelineFeatures;
+  if (engine->descriptorIndexing) timelineFeatures.pNext = &indexingFeatures;
+  deviceCreateInfo.pQueueCreateInfos = queueCreateInfos;
+  deviceCreateInfo.queueCreateInfoCount = engine->queueFamilyCount;
   deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
-  deviceCreateInfo.enabledExtensionCount = 0;
-  deviceCreateInfo.enabledExtensionCount = 1;
-  deviceCreateInfo.ppEnabledExtensionNames = &deviceExtensions;
+  deviceCreateInfo.enabledExtensionCount = deviceExtensionCount;
+  deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions;
 
   if (vkCreateDevice(engine->physicalDevice, &deviceCreateInfo, NULL, &engine->device) != VK_SUCCESS) {
     printf("Failed to create logical decvice!\n");
     exit(EXIT_FAILURE);
   }
+  engine->enabledFeatures = deviceFeatures;
+  if (engine->drawIndirectCount) engine->cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(engine->device, "vkCmdDrawIndexedIndirectCountKHR");
+  engine->waitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(engine->device, timelineCore ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR");
+  engine->signalSemaphore = (PFN_vkSignalSemaphoreKHR)vkGetDeviceProcAddr(engine->device, timelineCore ? "vkSignalSemaphore" : "vkSignalSemaphoreKHR");
+  engine->getSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(engine->device, timelineCore ? "vkGetSemaphoreCounterValue" : "vkGetSemaphoreCounterValueKHR");
 }
 
 void engineCreateSwapChain(Engine *engine) {
@@ -212,18 +486,22 @@ void engineCreateSwapChain(Engine *engine) {
   memset(&createInfo, 0, sizeof(VkSwapchainCreateInfoKHR));
   createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
   createInfo.surface = engine->surface;
-  createInfo.minImageCount = 4;
+  createInfo.minImageCount = engine->config.swapChainImages;
+  if (createInfo.minImageCount < capabilities.minImageCount) createInfo.minImageCount = capabilities.minImageCount;
+  if (capabilities.maxImageCount && createInfo.minImageCount > capabilities.maxImageCount) createInfo.minImageCount = capabilities.maxImageCount;
   createInfo.imageFormat = VK_FORMAT_B8G8R8A8_SRGB;
   createInfo.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
   createInfo.imageExtent = engine->extent;
   createInfo.imageArrayLayers = 1;
   createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  if (engine->config.readbackFormat != READBACK_NONE) createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  if (engine->resolution.enabled) createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
   createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
   createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   createInfo.preTransform = capabilities.currentTransform;
-  createInfo.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+  createInfo.presentMode = engineSelectPresentMode(engine);
   createInfo.clipped = VK_TRUE;
-  createInfo.oldSwapchain = VK_NULL_HANDLE;
+  createInfo.oldSwapchain = engine->swapChain;
   if (vkCreateSwapchainKHR(engine->device, &createInfo, NULL, &engine->swapChain) != VK_SUCCESS) {
     printf("Swapchain creation failed!\n");
     exit(1);
@@ -234,23 +512,39 @@ void engineCreateSwapChain(Engine *engine) {
 
   engineCreateSwapChainImageViews(engine);
   engineCreateDepthResources(engine);
+  engineResizeResolution(engine);
+  engineResizeDeferred(engine);
   engineCreateFramebuffers(engine);
+  engineResizeHiZ(engine);
+  engineResizeReadback(engine);
 }
 
-uint32_t engineFindMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-  VkPhysicalDeviceMemoryProperties memProperties;
-  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+// Headless replacement for the swapchain: one engine-owned color image per
+// frame in flight, rendered with the same render pass and framebuffers.
+// There are always MAX_FRAMES_IN_FLIGHT so that the count in use can change.
+void engineCreateOffscreenImages(Engine *engine) {
+  engine->extent.width = engine->config.width;
+  engine->extent.height = engine->config.height;
 
-  for (uint32_t n = 0; n < memProperties.memoryTypeCount; n++) {
-    if ((typeFilter & (1 << n)) && (memProperties.memoryTypes[n].propertyFlags & properties) == properties) {
-      return n;
-    }
+  engine->swapChainImageCount = MAX_FRAMES_IN_FLIGHT;
+  engine->swapChainImages = malloc(engine->swapChainImageCount * sizeof(VkImage));
+  engine->offscreenImageMemory = malloc(engine->swapChainImageCount * sizeof(Allocation));
+  VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  if (engine->resolution.enabled) usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  for (int n = 0; n < engine->swapChainImageCount; n++) {
+    engineCreateImage(engine, engine->extent.width, engine->extent.height, 1, VK_FORMAT_B8G8R8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, engine->swapChainImages + n, engine->offscreenImageMemory + n);
   }
-  printf("Failed to find suitable memory type!\n");
-  exit(1);
+
+  engineCreateSwapChainImageViews(engine);
+  engineCreateDepthResources(engine);
+  engineResizeResolution(engine);
+  engineResizeDeferred(engine);
+  engineCreateFramebuffers(engine);
+  engineResizeHiZ(engine);
+  engineResizeReadback(engine);
 }
 
-void engineCreateImage(Engine *engine, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage *image, VkDeviceMemory *imageMemory) {
+void engineCreateImage(Engine *engine, uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, int dedicated, VkImage *image, Allocation *imageMemory) {
   VkImageCreateInfo imageInfo;
   memset(&imageInfo, 0, sizeof(VkImageCreateInfo));
   imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -258,7 +552,7 @@ void engineCreateImage(Engine *engine, uint32_t width, uint32_t height, VkFormat
   imageInfo.extent.width = width;
   imageInfo.extent.height = height;
   imageInfo.extent.depth = 1;
-  imageInfo.mipLevels = 1;
+  imageInfo.mipLevels = mipLevels;
   imageInfo.arrayLayers = 1;
   imageInfo.format = format;
   imageInfo.tiling = tiling;
@@ -274,20 +568,39 @@ void engineCreateImage(Engine *engine, uint32_t width, uint32_t height, VkFormat
 
   VkMemoryRequirements memRequirements;
   vkGetImageMemoryRequirements(engine->device, *image, &memRequirements);
+  // Transient attachments ask for lazily allocated memory, and get ordinary
+  // memory on devices that have none.
+  if ((properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) && !engineHasMemoryType(engine, memRequirements.memoryTypeBits, properties)) properties &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+  engineAllocate(engine, &memRequirements, properties, tiling == VK_IMAGE_TILING_LINEAR, dedicated, imageMemory);
 
-  VkMemoryAllocateInfo allocInfo;
-  memset(&allocInfo, 0, sizeof(VkMemoryAllocateInfo));
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memRequirements.size;
-  allocInfo.memoryTypeIndex = engineFindMemoryType(engine->physicalDevice, memRequirements.memoryTypeBits, properties);
+  if (vkBindImageMemory(engine->device, *image, imageMemory->memory, imageMemory->offset) != VK_SUCCESS) {
+    printf("Failed to bind image memory!\n");
+    exit(1);
+  }
+}
 
-  if (vkAllocateMemory(engine->device, &allocInfo, NULL, imageMemory) != VK_SUCCESS) {
-    printf("Failed to allocate image memory!\n");
+void engineCreateBuffer(Engine *engine, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer *buffer, Allocation *bufferMemory) {
+  VkBufferCreateInfo bufferInfo;
+  memset(&bufferInfo, 0, sizeof(VkBufferCreateInfo));
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  // Buffers are shared by every queue family in use, so uploads and culling
+  // need no ownership transfers; unlike images they lose nothing by it.
+  bufferInfo.sharingMode = engine->queueFamilyCount > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+  bufferInfo.queueFamilyIndexCount = engine->queueFamilyCount > 1 ? engine->queueFamilyCount : 0;
+  bufferInfo.pQueueFamilyIndices = engine->queueFamilies;
+  if (vkCreateBuffer(engine->device, &bufferInfo, NULL, buffer) != VK_SUCCESS) {
+    printf("Failed to create buffer!\n");
     exit(1);
   }
 
-  if (vkBindImageMemory(engine->device, *image, *imageMemory, 0) != VK_SUCCESS) {
-    printf("Failed to bind image memory!\n");
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(engine->device, *buffer, &memRequirements);
+  engineAllocate(engine, &memRequirements, properties, 1, 0, bufferMemory);
+
+  if (vkBindBufferMemory(engine->device, *buffer, bufferMemory->memory, bufferMemory->offset) != VK_SUCCESS) {
+    printf("Failed to bind buffer memory!\n");
     exit(1);
   }
 }
@@ -318,21 +631,36 @@ void engineCreateSwapChainImageViews(Engine *engine) {
   }
 }
 
+// The depth buffer is never stored, so it is transient unless the depth
+// pre-pass keeps it between render passes for the Hi-Z build to sample.
+// Deferred lighting reads it as an input attachment.
 void engineCreateDepthResources(Engine *engine) {
   VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
-  engineCreateImage(engine, engine->extent.width, engine->extent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &engine->depthImage, &engine->depthImageMemory);
+  VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+  if (engine->config.deferred) usage |= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+  if (engine->hiz.supported) {
+    usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+  } else {
+    usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    properties |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+  }
+  engineCreateImage(engine, engine->extent.width, engine->extent.height, 1, depthFormat, VK_IMAGE_TILING_OPTIMAL, usage, properties, 1, &engine->depthImage, &engine->depthImageMemory);
   engineCreateImageView(engine, engine->depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, &engine->depthImageView);
 }
 
 void engineCreateFramebuffers(Engine *engine) {
   engine->swapChainFramebuffers = malloc(engine->swapChainImageCount * sizeof(VkFramebuffer));
   for (int n = 0; n < engine->swapChainImageCount; n++) {
-    VkImageView attachments[] = {engine->swapChainImageViews[n], engine->depthImageView};
+    // With dynamic resolution every framebuffer draws to the scene target.
+    VkImageView colorView = engine->resolution.enabled ? engine->resolution.view : engine->swapChainImageViews[n];
+    VkImageView attachments[2 + GBUFFER_COUNT] = {colorView, engine->depthImageView};
+    for (int g = 0; g < GBUFFER_COUNT; g++) attachments[2 + g] = engine->deferred.views[g];
     VkFramebufferCreateInfo framebufferInfo;
     memset(&framebufferInfo, 0, sizeof(VkFramebufferCreateInfo));
     framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
     framebufferInfo.renderPass = engine->renderPass;
-    framebufferInfo.attachmentCount = sizeof(attachments) / sizeof(VkImageView);
+    framebufferInfo.attachmentCount = engine->config.deferred ? 2 + GBUFFER_COUNT : 2;
     framebufferInfo.pAttachments = attachments;
     framebufferInfo.width = engine->extent.width;
     framebufferInfo.height = engine->extent.height;
@@ -352,27 +680,54 @@ void engineDestroyViews(VkDevice device, uint32_t swapChainImageCount, VkImageVi
 }
 
 void engineCreateRenderPass(Engine *engine) {
-  VkAttachmentDescription colorAttachment;
-  memset(&colorAttachment, 0, sizeof(VkAttachmentDescription));
-  colorAttachment.format = VK_FORMAT_B8G8R8A8_SRGB;
-  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-  VkAttachmentDescription depthAttachment;
-  memset(&depthAttachment, 0, sizeof(VkAttachmentDescription));
-  depthAttachment.format = VK_FORMAT_D32_SFLOAT;
-  depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-  depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  engineCreateMainRenderPass(engine, VK_ATTACHMENT_LOAD_OP_CLEAR, &engine->renderPass);
+}
+
+// The colour and depth pass everything is drawn in. With depthLoadOp LOAD it
+// continues from the depth pre-pass, whose depth the Hi-Z build has left
+// read-only. In deferred mode subpass 0 draws into the G-buffer attachments
+// and subpass 1 lights the colour attachment from them; the G-buffer and
+// depth are neither loaded nor stored, so a tiled GPU keeps them on chip.
+void engineCreateMainRenderPass(Engine *engine, VkAttachmentLoadOp depthLoadOp, VkRenderPass *renderPass) {
+  int deferred = engine->config.deferred;
+  VkAttachmentDescription attachments[2 + GBUFFER_COUNT];
+  memset(attachments, 0, sizeof(attachments));
+  VkAttachmentDescription *colorAttachment = &attachments[0];
+  colorAttachment->format = VK_FORMAT_B8G8R8A8_SRGB;
+  colorAttachment->samples = VK_SAMPLE_COUNT_1_BIT;
+  colorAttachment->loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  colorAttachment->storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  colorAttachment->stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  colorAttachment->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  colorAttachment->initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  colorAttachment->finalLayout = engine->config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  // The scene target is blitted up to the swapchain image.
+  if (engine->resolution.enabled) colorAttachment->finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+  VkAttachmentDescription *depthAttachment = &attachments[1];
+  depthAttachment->format = VK_FORMAT_D32_SFLOAT;
+  depthAttachment->samples = VK_SAMPLE_COUNT_1_BIT;
+  depthAttachment->loadOp = depthLoadOp;
+  depthAttachment->storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment->stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depthAttachment->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment->initialLayout = depthLoadOp == VK_ATTACHMENT_LOAD_OP_LOAD ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+  depthAttachment->finalLayout = deferred ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  // Whatever the lighting pass doesn't cover is discarded there, so the
+  // G-buffer needs no clear.
+  VkFormat gbufferFormats[GBUFFER_COUNT] = {GBUFFER_ALBEDO_FORMAT, GBUFFER_SLOPE_FORMAT};
+  for (int n = 0; n < GBUFFER_COUNT; n++) {
+    VkAttachmentDescription *gbufferAttachment = &attachments[2 + n];
+    gbufferAttachment->format = gbufferFormats[n];
+    gbufferAttachment->samples = VK_SAMPLE_COUNT_1_BIT;
+    gbufferAttachment->loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    gbufferAttachment->storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    gbufferAttachment->stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    gbufferAttachment->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    gbufferAttachment->initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    gbufferAttachment->finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  }
 
   VkAttachmentReference colorAttachmentRef;
   memset(&colorAttachmentRef, 0, sizeof(VkAttachmentReference));
@@ -384,34 +739,76 @@ void engineCreateRenderPass(Engine *engine) {
   depthAttachmentRef.attachment = 1;
   depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-  VkSubpassDescription subpass;
-  memset(&subpass, 0, sizeof(VkSubpassDescription));
-  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-  subpass.colorAttachmentCount = 1;
-  subpass.pColorAttachments = &colorAttachmentRef;
-  subpass.pDepthStencilAttachment = &depthAttachmentRef;
-
-  VkSubpassDependency dependency;
-  memset(&dependency, 0, sizeof(VkSubpassDependency));
-  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-  dependency.dstSubpass = 0;
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-  dependency.srcAccessMask = 0;
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-  VkAttachmentDescription attachments[2] = {colorAttachment, depthAttachment};
+  VkAttachmentReference gbufferRefs[GBUFFER_COUNT];
+  VkAttachmentReference inputRefs[GBUFFER_COUNT + 1];
+  for (int n = 0; n < GBUFFER_COUNT; n++) {
+    gbufferRefs[n].attachment = 2 + n;
+    gbufferRefs[n].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    inputRefs[n].attachment = 2 + n;
+    inputRefs[n].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  }
+  inputRefs[GBUFFER_COUNT].attachment = 1;
+  inputRefs[GBUFFER_COUNT].layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+  VkSubpassDescription subpasses[2];
+  memset(subpasses, 0, sizeof(subpasses));
+  subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpasses[0].colorAttachmentCount = deferred ? GBUFFER_COUNT : 1;
+  subpasses[0].pColorAttachments = deferred ? gbufferRefs : &colorAttachmentRef;
+  subpasses[0].pDepthStencilAttachment = &depthAttachmentRef;
+  subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpasses[1].inputAttachmentCount = GBUFFER_COUNT + 1;
+  subpasses[1].pInputAttachments = inputRefs;
+  subpasses[1].colorAttachmentCount = 1;
+  subpasses[1].pColorAttachments = &colorAttachmentRef;
+
+  // The previous frame's lighting reads the G-buffer and depth this frame
+  // overwrites. The lighting pass reads this pixel's G-buffer only, so the
+  // dependency between subpasses is by region.
+  VkSubpassDependency dependencies[3];
+  memset(dependencies, 0, sizeof(dependencies));
+  uint32_t dependencyCount = deferred ? 2 : 1;
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+  if (deferred) dependencies[0].srcStageMask |= VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  // And the previous frame's upscale reads the scene target.
+  if (engine->resolution.enabled) dependencies[0].srcStageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+  dependencies[0].srcAccessMask = 0;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+  dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  if (depthLoadOp == VK_ATTACHMENT_LOAD_OP_LOAD) dependencies[0].dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = 1;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+  dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+  // The upscale blit and the readback copy read the colour attachment after
+  // the pass; without this the final layout transition is only ordered
+  // against bottom of pipe, which their barriers don't chain to.
+  if (engine->resolution.enabled || engine->config.readbackFormat != READBACK_NONE) {
+    VkSubpassDependency* last = &dependencies[dependencyCount++];
+    last->srcSubpass = deferred ? 1 : 0;
+    last->dstSubpass = VK_SUBPASS_EXTERNAL;
+    last->srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    last->srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    last->dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    last->dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  }
+
   VkRenderPassCreateInfo renderPassInfo;
   memset(&renderPassInfo, 0, sizeof(VkRenderPassCreateInfo));
   renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  renderPassInfo.attachmentCount = sizeof(attachments) / sizeof(VkAttachmentDescription);
+  renderPassInfo.attachmentCount = deferred ? 2 + GBUFFER_COUNT : 2;
   renderPassInfo.pAttachments = attachments;
-  renderPassInfo.subpassCount = 1;
-  renderPassInfo.pSubpasses = &subpass;
-  renderPassInfo.dependencyCount = 1;
-  renderPassInfo.pDependencies = &dependency;
+  renderPassInfo.subpassCount = deferred ? 2 : 1;
+  renderPassInfo.pSubpasses = subpasses;
+  renderPassInfo.dependencyCount = dependencyCount;
+  renderPassInfo.pDependencies = dependencies;
 
-  if (vkCreateRenderPass(engine->device, &renderPassInfo, NULL, &engine->renderPass) != VK_SUCCESS) {
+  if (vkCreateRenderPass(engine->device, &renderPassInfo, NULL, renderPass) != VK_SUCCESS) {
     printf("Render pass creation failed!\n");
     exit(1);
   }
@@ -442,15 +839,27 @@ void engineCreateCommandBuffers(Engine *engine) {
   }
 }
 
+// Only for shutdown; resizing goes through engineRecreateSwapChain.
 void engineDestroySwapChain(Engine *engine) {
   vkDeviceWaitIdle(engine->device);
 
   vkDestroyImageView(engine->device, engine->depthImageView, NULL);
   vkDestroyImage(engine->device, engine->depthImage, NULL);
-  vkFreeMemory(engine->device, engine->depthImageMemory, NULL);
+  engineFree(engine, &engine->depthImageMemory);
   for (int n = 0; n < engine->swapChainImageCount; n++) vkDestroyFramebuffer(engine->device, engine->swapChainFramebuffers[n], NULL);
   for (int n = 0; n < engine->swapChainImageCount; n++) vkDestroyImageView(engine->device, engine->swapChainImageViews[n], NULL);
-  vkDestroySwapchainKHR(engine->device, engine->swapChain, NULL);
+  if (engine->config.headless) {
+    for (int n = 0; n < engine->swapChainImageCount; n++) {
+      vkDestroyImage(engine->device, engine->swapChainImages[n], NULL);
+      engineFree(engine, engine->offscreenImageMemory + n);
+    }
+    free(engine->offscreenImageMemory);
+  } else {
+    vkDestroySwapchainKHR(engine->device, engine->swapChain, NULL);
+  }
+  free(engine->swapChainImages);
+  free(engine->swapChainImageViews);
+  free(engine->swapChainFramebuffers);
 }
 
 void engineCreateSyncObjects(Engine *engine) {
@@ -458,11 +867,8 @@ void engineCreateSyncObjects(Engine *engine) {
   memset(&semaphoreInfo, 0, sizeof(VkSemaphoreCreateInfo));
   semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-  VkFenceCreateInfo fenceInfo;
-  memset(&fenceInfo, 0, sizeof(VkFenceCreateInfo));
-  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
+  // Frames finish on the graphics timeline; these binary semaphores are
+  // only for acquire and present, which can't use timelines.
   for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
     if (vkCreateSemaphore(engine->device, &semaphoreInfo, NULL, engine->imageAvailableSemaphores + n) != VK_SUCCESS) {
       printf("Failed to create semaphore!\n");
@@ -472,21 +878,37 @@ void engineCreateSyncObjects(Engine *engine) {
       printf("Failed to create semaphore!\n");
       exit(1);
     }
-    if (vkCreateFence(engine->device, &fenceInfo, NULL, engine->inFlightFences + n) != VK_SUCCESS) {
-      printf("Failed to create fence!\n");
-      exit(1);
-    }
   }
 }
 
 void engineDrawFrame(Engine *engine) {
-  vkWaitForFences(engine->device, 1, &engine->inFlightFences[engine->currentFrame], VK_TRUE, UINT64_MAX);
-  uint32_t imageIndex;
-  VkResult result = vkAcquireNextImageKHR(engine->device, engine->swapChain, UINT64_MAX, engine->imageAvailableSemaphores[engine->currentFrame], VK_NULL_HANDLE, &imageIndex);
+  uint64_t phaseStart = traceBegin();
+  engineTimelineWait(engine, engine->graphicsTimeline, engine->frameValues[engine->currentFrame]);
+  traceEnd(engine, TRACE_WAIT_FRAME, phaseStart);
+  engineDeletionBeginFrame(engine);
+  engineProfilerCollect(engine);
+  engineResolutionUpdate(engine);
+  engineIndirectCollect(engine);
+  engineHiZCollect(engine);
+  engineDescriptorsBeginFrame(engine);
+  engineReloadBeginFrame(engine);
+  engineUpdateTextures(engine);
+  // Offscreen images are owned per frame in flight, so waiting for the
+  // frame's value is all the synchronisation they need.
+  uint32_t imageIndex = engine->currentFrame;
+  VkResult result = VK_SUCCESS;
+  phaseStart = traceBegin();
+  if (engine->config.headless) {
+    enginePacingAcquire(engine);
+  } else {
+    result = vkAcquireNextImageKHR(engine->device, engine->swapChain, UINT64_MAX, engine->imageAvailableSemaphores[engine->currentFrame], VK_NULL_HANDLE, &imageIndex);
+  }
+  traceEnd(engine, TRACE_ACQUIRE, phaseStart);
 
   if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-    engineDestroySwapChain(engine);
-    engineCreateSwapChain(engine);
+    phaseStart = traceBegin();
+    engineRecreateSwapChain(engine);
+    traceEnd(engine, TRACE_RECREATE_SWAPCHAIN, phaseStart);
     return;
   } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
     printf("Failed to acquire swap chain image!\n");
@@ -495,7 +917,9 @@ void engineDrawFrame(Engine *engine) {
 
   VkCommandBuffer commandBuffer = engine->commandBuffers[engine->currentFrame];
 
-  vkResetFences(engine->device, 1, &engine->inFlightFences[engine->currentFrame]);
+  engineReadbackCollect(engine);
+  engineInstancerFlush(engine);
+  phaseStart = traceBegin();
   vkResetCommandBuffer(commandBuffer, 0);
 
   VkCommandBufferBeginInfo beginInfo;
@@ -506,6 +930,7 @@ void engineDrawFrame(Engine *engine) {
     printf("Begin command buffer failed!\n");
     exit(1);
   }
+  engineUploadAcquire(engine, commandBuffer);
 
   VkRenderPassBeginInfo renderPassInfo;
   memset(&renderPassInfo, 0, sizeof(VkRenderPassBeginInfo));
@@ -514,7 +939,7 @@ void engineDrawFrame(Engine *engine) {
   renderPassInfo.framebuffer = engine->swapChainFramebuffers[imageIndex];
   renderPassInfo.renderArea.offset.x = 0;
   renderPassInfo.renderArea.offset.y = 0;
-  renderPassInfo.renderArea.extent = engine->extent;
+  renderPassInfo.renderArea.extent = engine->renderExtent;
 
   VkClearValue clearValues[2];
   memset(&clearValues, 0, sizeof(clearValues));
@@ -523,82 +948,94 @@ void engineDrawFrame(Engine *engine) {
   renderPassInfo.clearValueCount = 2;
   renderPassInfo.pClearValues = clearValues;
 
-  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-  VkViewport viewport;
-  memset(&viewport, 0, sizeof(VkViewport));
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = (float)engine->extent.width;
-  viewport.height = (float)engine->extent.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-
-  VkRect2D scissor;
-  memset(&scissor, 0, sizeof(VkRect2D));
-  scissor.offset.x = 0;
-  scissor.offset.y = 0;
-  scissor.extent = engine->extent;
-  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+  uint64_t cullValue = engineIndirectCull(engine, commandBuffer);
+  engineRenderQueueSort(engine);
+  engineProfilerBegin(engine, commandBuffer);
+  if (engineDepthPrepass(engine, commandBuffer)) renderPassInfo.renderPass = engine->hiz.loadRenderPass;
+  engineRecordRenderPass(engine, commandBuffer, &renderPassInfo, engine->renderQueue.sortedCount, engine->recorder.threadCount);
+  engineDepthPrepassEnd(engine, commandBuffer);
+  engineResolutionUpscale(engine, commandBuffer, imageIndex);
+  engineProfilerEnd(engine, commandBuffer);
+  engineRenderQueueClear(engine);
 
-  for (int n = 0; n < engine->pipelineCount; n++) {
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, engine->pipelines[n]);
-    vkCmdDraw(commandBuffer, 3, 1, 0, 0);
-  }
-
-  vkCmdEndRenderPass(commandBuffer);
+  engineReadbackRecord(engine, commandBuffer, imageIndex);
 
   if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
     printf("Failed to record command buffer!\n");
     exit(1);
   }
-
-  VkSubmitInfo submitInfo;
-  memset(&submitInfo, 0, sizeof(VkSubmitInfo));
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-  VkSemaphore waitSemaphores[] = {engine->imageAvailableSemaphores[engine->currentFrame]};
-  VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = waitStages;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffer;
-  VkSemaphore signalSemaphores[] = {engine->renderFinishedSemaphores[engine->currentFrame]};
-  submitInfo.signalSemaphoreCount = 1;
-  submitInfo.pSignalSemaphores = signalSemaphores;
-  if (vkQueueSubmit(engine->queue, 1, &submitInfo, engine->inFlightFences[engine->currentFrame]) != VK_SUCCESS) {
-    printf("Failed to submit draw command buffer!\n");
-    exit(1);
+  traceEnd(engine, TRACE_RECORD, phaseStart);
+
+  // Uploads recorded since the last frame go out as one batch ahead of it.
+  engineFlushUploads(engine);
+  SubmitWaits waits;
+  memset(&waits, 0, sizeof(SubmitWaits));
+  if (!engine->config.headless) engineSubmitWait(&waits, engine->imageAvailableSemaphores[engine->currentFrame], 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+  engineSubmitWaitTimeline(&waits, engine->transferTimeline, engineTakeUploadValue(engine), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+  // Culling on the compute queue waited for the uploads before it, so this
+  // covers them as well as the draw commands. The Hi-Z build mustn't
+  // overwrite the pyramid before the cull has read it.
+  engineSubmitWaitTimeline(&waits, engine->computeTimeline, cullValue, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  VkSemaphore renderFinished = engine->config.headless ? VK_NULL_HANDLE : engine->renderFinishedSemaphores[engine->currentFrame];
+  phaseStart = traceBegin();
+  engine->frameValues[engine->currentFrame] = engineTimelineSubmit(engine, engine->graphicsTimeline, &waits, commandBuffer, renderFinished);
+  engineDeletionSubmitted(engine, engine->frameValues[engine->currentFrame]);
+  engineReadbackSubmitted(engine, engine->frameValues[engine->currentFrame]);
+  traceEnd(engine, TRACE_SUBMIT, phaseStart);
+
+  if (engine->config.headless) {
+    enginePacingPresent(engine);
+    engine->frameCount++;
+    engine->currentFrame++;
+    engine->currentFrame %= engine->framesInFlight;
+    return;
   }
 
   VkPresentInfoKHR presentInfo;
   memset(&presentInfo, 0, sizeof(VkPresentInfoKHR));
   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
   presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = signalSemaphores;
+  presentInfo.pWaitSemaphores = &renderFinished;
   VkSwapchainKHR swapChains[] = {engine->swapChain};
   presentInfo.swapchainCount = 1;
   presentInfo.pSwapchains = swapChains;
   presentInfo.pImageIndices = &imageIndex;
+  enginePacingPresent(engine);
+  phaseStart = traceBegin();
   result = vkQueuePresentKHR(engine->queue, &presentInfo);
+  traceEnd(engine, TRACE_PRESENT, phaseStart);
   if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
-    engineDestroySwapChain(engine);
-    engineCreateSwapChain(engine);
+    phaseStart = traceBegin();
+    engineRecreateSwapChain(engine);
+    traceEnd(engine, TRACE_RECREATE_SWAPCHAIN, phaseStart);
   } else if (result != VK_SUCCESS) {
     printf("Failed to present swap chain image!\n");
     exit(1);
   }
 
+  engine->frameCount++;
   engine->currentFrame++;
-  engine->currentFrame %= MAX_FRAMES_IN_FLIGHT;
+  engine->currentFrame %= engine->framesInFlight;
 }
 
+// Set 0 is a texture's own descriptor set, or in bindless mode the global
+// array indexed through push constants.
 void enginePipelineLayoutCreate(Engine *engine) {
+  VkPushConstantRange range;
+  range.stageFlags = BINDLESS_STAGES;
+  range.offset = 0;
+  range.size = sizeof(BindlessIndices);
+
   VkPipelineLayoutCreateInfo pipelineLayoutInfo;
   memset(&pipelineLayoutInfo, 0, sizeof(VkPipelineLayoutCreateInfo));
   pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &engine->textures.setLayout;
+  if (engine->descriptors.bindless) {
+    pipelineLayoutInfo.pSetLayouts = &engine->descriptors.bindlessSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &range;
+  }
   if (vkCreatePipelineLayout(engine->device, &pipelineLayoutInfo, NULL, &engine->pipelineLayout) != VK_SUCCESS) {
     printf("Failed to create pipeline layout!\n");
     exit(1);
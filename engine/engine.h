@@ -2,28 +2,896 @@
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#include <cglm/cglm.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
 
-#define MAX_FRAMES_IN_FLIGHT 2
+// Per-frame resources are sized for this many; config.framesInFlight picks
+// how many are used.
+#define MAX_FRAMES_IN_FLIGHT 3
+#define MAX_SWAPCHAIN_IMAGES 8
+#define LATENCY_SAMPLES 4096
 #define MAX_PIPELINES 32
+#define PIPELINE_CACHE_PATH "pipeline.cache"
+#define PROFILER_WINDOW 256
+#define PROFILER_QUERIES_PER_FRAME (2 + 2 * MAX_PIPELINES)
+#define ALLOCATOR_BLOCK_SIZE (64 * 1024 * 1024)
+#define ALLOCATOR_MIN_SIZE 256
+#define TRACE_CAPACITY 65536
+#define TRACE_BUCKETS 24
+#define UPLOAD_RING_SIZE (32 * 1024 * 1024)
+#define UPLOAD_BATCHES 8
+#define MODEL_CACHE_DIR "model.cache"
+#define TEXTURE_CACHE_DIR "texture.cache"
+#define MAX_TEXTURES 256
+#define MAX_SAMPLERS 16
+#define TEXTURE_MAX_MIPS 16
+#define TEXTURE_UPLOAD_BUDGET (4 * 1024 * 1024)
+#define RECORD_MAX_THREADS 16
+#define INSTANCE_RING_SIZE (16 * 1024 * 1024)
+#define MAX_INSTANCE_BATCHES 256
+#define RENDER_QUEUE_CAPACITY 65536
+#define DESCRIPTOR_POOL_SETS 256
+#define MAX_DESCRIPTOR_POOLS 16
+#define BINDLESS_MAX_IMAGES 4096
+#define BINDLESS_MAX_BUFFERS 4096
+#define BINDLESS_STAGES (VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
+#define SHADER_DIR "shaders"
+#define MAX_PIPELINE_SOURCES 64
+#define SHADER_PATH_MAX 256
+#define PIPELINE_COMPILE_MAX_THREADS 16
+#define MAX_SUBMIT_WAITS 4
+#define HIZ_MAX_LEVELS 16
+#define GBUFFER_COUNT 2
+#define GBUFFER_ALBEDO_FORMAT VK_FORMAT_R8G8B8A8_UNORM
+#define GBUFFER_SLOPE_FORMAT VK_FORMAT_R16G16_SFLOAT
+
+typedef enum readbackFormat { READBACK_NONE, READBACK_RAW, READBACK_PPM, READBACK_PNG } ReadbackFormat;
+typedef enum presentMode { PRESENT_IMMEDIATE, PRESENT_MAILBOX, PRESENT_FIFO } PresentMode;
+
+typedef struct engineConfig {
+  int headless;
+  int headlessFrames;
+  uint32_t width;
+  uint32_t height;
+  // Frames are written to readbackPath: "-" streams to stdout, a path with a
+  // printf %d writes one file per frame, anything else is a single stream.
+  ReadbackFormat readbackFormat;
+  const char* readbackPath;
+  // GPU timestamp profiling, optionally dumped to stdout every profilerInterval seconds.
+  int profiler;
+  double profilerInterval;
+  // Chrome trace-event JSON of the CPU frame loop, written on engineDestroy.
+  const char* tracePath;
+  // Threads recording draws into secondary command buffers, 0 for one per
+  // core. With 1 everything is recorded inline on the main thread.
+  uint32_t recordThreads;
+  // Sample textures through one descriptor indexing array when supported.
+  int bindless;
+  // Watch SHADER_DIR and rebuild pipelines whose shaders change.
+  int hotReload;
+  // Archive written by engineWriteShaderArchive to load shaders from.
+  const char* shaderArchive;
+  // Present mode, falling back to one the surface supports. How many frames
+  // the CPU may record ahead of the GPU, up to MAX_FRAMES_IN_FLIGHT, and how
+  // many swapchain images to ask for.
+  PresentMode presentMode;
+  uint32_t framesInFlight;
+  uint32_t swapChainImages;
+  // Frames per second to cap engineRun at, 0 for no limit.
+  double frameLimit;
+  // Wait for the frame's timeline value before polling input rather than after, so
+  // the input a frame is recorded from is as fresh as possible.
+  int lateLatch;
+  // Headless only: refresh rate of the simulated display that paces
+  // presents.
+  double refreshRate;
+  // Do everything on the graphics queue even when the device has separate
+  // compute and transfer queue families.
+  int singleQueue;
+  // Draw the indirect scene's depth first, occlusion cull it against the
+  // previous frame's hierarchical-Z and shade it with an EQUAL depth test.
+  int depthPrepass;
+  // Shade in a second subpass from a G-buffer read as input attachments,
+  // with lightCount lights (0 for the default).
+  int deferred;
+  uint32_t lightCount;
+  // GPU frame time in milliseconds to hold by scaling the render resolution,
+  // 0 to always render at full resolution.
+  double targetFrameTime;
+} EngineConfig;
+
+typedef struct memoryBlock {
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  uint8_t* mapped;
+  uint8_t* longest;
+  uint32_t levels;
+  uint32_t allocationCount;
+} MemoryBlock;
+
+typedef struct memoryPool {
+  MemoryBlock** blocks;
+  uint32_t blockCount;
+} MemoryPool;
+
+// A range of device memory. block is NULL for dedicated allocations; mapped
+// points at offset within a persistent mapping for host-visible memory.
+typedef struct allocation {
+  VkDeviceMemory memory;
+  VkDeviceSize offset;
+  VkDeviceSize size;
+  VkDeviceSize requested;
+  void* mapped;
+  MemoryBlock* block;
+  uint32_t memoryType;
+  uint32_t order;
+  int pool;
+} Allocation;
+
+typedef struct allocatorHeapStats {
+  VkDeviceSize blockBytes;
+  VkDeviceSize suballocatedBytes;
+  VkDeviceSize dedicatedBytes;
+  VkDeviceSize requestedBytes;
+  uint32_t blockCount;
+  uint32_t dedicatedCount;
+} AllocatorHeapStats;
+
+typedef struct allocator {
+  VkDeviceSize granularity;
+  VkDeviceSize atomSize;
+  VkDeviceSize blockSize[VK_MAX_MEMORY_TYPES];
+  MemoryPool pools[VK_MAX_MEMORY_TYPES][2];
+  AllocatorHeapStats heaps[VK_MAX_MEMORY_HEAPS];
+  uint32_t allocationCount;
+  uint32_t deviceAllocationCount;
+} Allocator;
+
+typedef struct readbackSlot {
+  VkBuffer buffer;
+  Allocation memory;
+  VkDeviceSize size;
+  uint8_t* data;
+  atomic_int state;
+  uint32_t width;
+  uint32_t height;
+  uint64_t frame;
+  // Set between recording the copy and submitting it.
+  int recorded;
+  // Graphics timeline value of the submission that copies into the slot.
+  uint64_t value;
+} ReadbackSlot;
+
+typedef struct readback {
+  ReadbackSlot slots[MAX_FRAMES_IN_FLIGHT];
+  VkMemoryPropertyFlags memoryProperties;
+  int coherent;
+  FILE* stream;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int queue[MAX_FRAMES_IN_FLIGHT];
+  int queueHead;
+  int queueCount;
+  int stop;
+  double startTime;
+  uint64_t framesWritten;
+  uint64_t bytesWritten;
+  uint64_t framesDropped;
+} Readback;
+
+typedef struct profilerSeries {
+  float samples[PROFILER_WINDOW];
+  uint32_t count;
+  uint32_t next;
+} ProfilerSeries;
+
+// Rolling statistics in milliseconds over the last PROFILER_WINDOW frames.
+typedef struct profilerStats {
+  double min;
+  double avg;
+  double p99;
+  uint32_t samples;
+} ProfilerStats;
+
+typedef struct profiler {
+  int enabled;
+  VkQueryPool queryPool;
+  double period;
+  uint64_t validMask;
+  int recordedPipelines[MAX_FRAMES_IN_FLIGHT];
+  // The dynamic resolution scale each frame slot was recorded at.
+  float recordedScales[MAX_FRAMES_IN_FLIGHT];
+  ProfilerSeries renderPass;
+  ProfilerSeries pipelines[MAX_PIPELINES];
+  double lastDump;
+  // The newest render pass time, the scale it was rendered at and how many
+  // have been collected.
+  double frameTime;
+  float frameScale;
+  uint64_t collected;
+} Profiler;
+
+typedef enum tracePhase {
+  TRACE_FRAME,
+  TRACE_POLL_EVENTS,
+  TRACE_WAIT_FRAME,
+  TRACE_ACQUIRE,
+  TRACE_RECORD,
+  TRACE_SUBMIT,
+  TRACE_PRESENT,
+  TRACE_RECREATE_SWAPCHAIN,
+  TRACE_PACE,
+  TRACE_PHASE_COUNT
+} TracePhase;
+
+typedef struct traceEvent {
+  uint64_t start;
+  uint64_t duration;
+  TracePhase phase;
+  uint32_t thread;
+} TraceEvent;
+
+typedef struct traceHistogram {
+  atomic_uint_fast64_t buckets[TRACE_BUCKETS];
+  atomic_uint_fast64_t count;
+  atomic_uint_fast64_t total;
+  atomic_uint_fast64_t max;
+} TraceHistogram;
+
+typedef struct trace {
+  TraceEvent* events;
+  atomic_uint_fast64_t head;
+  uint64_t origin;
+  TraceHistogram histograms[TRACE_PHASE_COUNT];
+} Trace;
+
+typedef struct vertex {
+  float position[3];
+  float color[3];
+  float uv[2];
+} Vertex;
+
+typedef struct mesh {
+  VkBuffer vertexBuffer;
+  Allocation vertexMemory;
+  VkBuffer indexBuffer;
+  Allocation indexMemory;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  // Sort key field, unique among the first 64k meshes.
+  uint32_t id;
+} Mesh;
+
+// CPU-side geometry of one model with all its meshes merged. The arrays point
+// into mapping when the model came from the cache, otherwise they are malloc'd.
+typedef struct modelData {
+  const char* path;
+  void* mapping;
+  size_t mappingSize;
+  Vertex* vertices;
+  uint32_t* indices;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  int cacheHit;
+  double loadTime;
+} ModelData;
+
+typedef struct modelLoader {
+  ModelData* models;
+  uint32_t count;
+  atomic_uint next;
+} ModelLoader;
+
+typedef enum textureState { TEXTURE_QUEUED, TEXTURE_DECODED, TEXTURE_UPLOADING, TEXTURE_RESIDENT, TEXTURE_FAILED } TextureState;
+
+// A texture streamed in the background. Workers decode the whole mip chain
+// into pixels (largest level first), then the frame loop uploads it smallest
+// level first. views[n] covers levels n and below, residentMip is the largest
+// level uploaded so far and mipLevels while nothing is.
+typedef struct texture {
+  char* path;
+  uint32_t index;
+  atomic_int state;
+  uint32_t width;
+  uint32_t height;
+  uint32_t mipLevels;
+  uint8_t* pixels;
+  void* mapping;
+  size_t mappingSize;
+  VkDeviceSize levelOffsets[TEXTURE_MAX_MIPS];
+  int cacheHit;
+  double decodeTime;
+
+  VkImage image;
+  Allocation memory;
+  VkImageView views[TEXTURE_MAX_MIPS];
+  VkSampler sampler;
+  uint32_t residentMip;
+  VkDescriptorSet descriptorSets[MAX_FRAMES_IN_FLIGHT];
+  // In bindless mode, the first of one image slot per frame in flight.
+  uint32_t bindlessSlot;
+  uint32_t boundMip[MAX_FRAMES_IN_FLIGHT];
+} Texture;
+
+typedef struct textures {
+  Texture* textures[MAX_TEXTURES];
+  uint32_t count;
+  uint32_t decodeNext;
+  pthread_t* threads;
+  uint32_t threadCount;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int stop;
+
+  VkDescriptorSetLayout setLayout;
+  VkDescriptorPool descriptorPool;
+  VkSamplerCreateInfo samplerInfos[MAX_SAMPLERS];
+  VkSampler samplers[MAX_SAMPLERS];
+  uint32_t samplerCount;
+} Textures;
+
+// Push constants selecting bindless resources for a draw.
+typedef struct bindlessIndices {
+  uint32_t image;
+  uint32_t buffer;
+} BindlessIndices;
+
+// Per frame in flight, a chain of descriptor pools that sets are carved from
+// linearly and that is reset wholesale once the frame's submission
+// completes. With descriptor indexing, also one update-after-bind set holding
+// arrays of sampled images (binding 0) and storage buffers (binding 1).
+typedef struct descriptors {
+  VkDescriptorPool framePools[MAX_FRAMES_IN_FLIGHT][MAX_DESCRIPTOR_POOLS];
+  uint32_t framePoolCount[MAX_FRAMES_IN_FLIGHT];
+  uint32_t framePoolCurrent[MAX_FRAMES_IN_FLIGHT];
+  int bindless;
+  VkDescriptorSetLayout bindlessSetLayout;
+  VkDescriptorPool bindlessPool;
+  VkDescriptorSet bindlessSet;
+  uint32_t imageCapacity;
+  uint32_t bufferCapacity;
+  uint32_t imageCount;
+  uint32_t bufferCount;
+  uint64_t setsAllocated;
+  uint64_t updates;
+} Descriptors;
+
+// Bounding sphere of a GPU-culled instance. Its mesh is drawn scaled by
+// radius and centred on center.
+typedef struct instance {
+  float center[3];
+  float radius;
+} Instance;
+
+// GPU-driven instances of one mesh: a compute pass culls instances against
+// the frustum and writes one indexed indirect command per visible instance.
+typedef struct indirect {
+  int supported;
+  Mesh* mesh;
+  uint32_t instanceCount;
+  VkBuffer instanceBuffer;
+  Allocation instanceMemory;
+  // Draw commands and their count, one set per frame in flight so culling
+  // for a frame can start while the previous one still draws.
+  VkBuffer drawBuffers[MAX_FRAMES_IN_FLIGHT];
+  Allocation drawMemory[MAX_FRAMES_IN_FLIGHT];
+  VkBuffer countBuffers[MAX_FRAMES_IN_FLIGHT];
+  Allocation countMemory[MAX_FRAMES_IN_FLIGHT];
+  VkBuffer statsBuffer;
+  Allocation statsMemory;
+  VkDescriptorSetLayout cullSetLayout;
+  VkPipelineLayout cullLayout;
+  VkPipeline cullPipeline;
+  VkDescriptorSetLayout drawSetLayout;
+  VkPipelineLayout drawLayout;
+  VkPipeline drawPipeline;
+  // Depth-only for the pre-pass, then EQUAL without depth writes for the
+  // main pass after it.
+  VkPipeline prepassPipeline;
+  VkPipeline equalPipeline;
+  VkDescriptorPool descriptorPool;
+  VkDescriptorSet cullSets[MAX_FRAMES_IN_FLIGHT];
+  VkDescriptorSet drawSets[MAX_FRAMES_IN_FLIGHT];
+  // With a separate compute family culling is submitted to the compute
+  // queue, and the frame's draws wait for its compute timeline value.
+  int async;
+  VkCommandPool computePool;
+  VkCommandBuffer computeCommandBuffers[MAX_FRAMES_IN_FLIGHT];
+  // Column-major, the engine has no camera yet so this is the identity.
+  float viewProjection[16];
+  uint32_t visibleCount;
+  uint32_t occludedCount;
+} Indirect;
+
+// Matches the Count buffer of cull.comp; visible is also the draw count.
+typedef struct indirectCounts {
+  uint32_t visible;
+  uint32_t occluded;
+} IndirectCounts;
+
+// Depth pre-pass and hierarchical-Z occlusion culling of the indirect scene.
+// The pre-pass draws the scene's depth with fragment-less pipelines, a
+// compute pass reduces it to a pyramid of the farthest depth under each
+// texel, and the next frame's cull tests each instance's bounds against that
+// pyramid before anything is shaded.
+typedef struct hiZ {
+  // The depth buffer can be sampled and indirect drawing is available.
+  int supported;
+  int enabled;
+  // Whether this frame drew the pre-pass, so the main pass loads its depth.
+  int active;
+  VkRenderPass prepassRenderPass;
+  // engine->renderPass loading the pre-pass depth instead of clearing it.
+  // Load and store ops don't affect compatibility, so pipelines and
+  // framebuffers made for one work with the other.
+  VkRenderPass loadRenderPass;
+  VkFramebuffer framebuffer;
+  // Level 0 is half the depth buffer's size.
+  VkImage image;
+  Allocation memory;
+  VkImageView view;
+  VkImageView levelViews[HIZ_MAX_LEVELS];
+  uint32_t width;
+  uint32_t height;
+  uint32_t levelCount;
+  // Until first built the pyramid is in VK_IMAGE_LAYOUT_UNDEFINED.
+  int initialised;
+  VkSampler sampler;
+  VkDescriptorSetLayout buildSetLayout;
+  VkPipelineLayout buildLayout;
+  VkPipeline buildPipeline;
+  VkDescriptorSetLayout cullSetLayout;
+  VkDescriptorPool descriptorPool;
+  VkDescriptorSet buildSets[HIZ_MAX_LEVELS];
+  VkDescriptorSet cullSets[MAX_FRAMES_IN_FLIGHT];
+  VkBuffer uniformBuffers[MAX_FRAMES_IN_FLIGHT];
+  Allocation uniformMemory[MAX_FRAMES_IN_FLIGHT];
+  // Whether the pyramid holds the previous frame's depth, and the
+  // view-projection and render extent that frame was drawn with.
+  int valid;
+  float viewProjection[16];
+  VkExtent2D renderExtent;
+  // Fragment shader invocations per frame, counted while statistics is set
+  // when the device supports pipeline statistics queries.
+  VkQueryPool queryPool;
+  int statistics;
+  int recorded[MAX_FRAMES_IN_FLIGHT];
+  uint64_t fragmentInvocations;
+  uint32_t measuredFrames;
+} HiZ;
+
+// Deferred shading in the main render pass: subpass 0 draws the scene into
+// the G-buffer, albedo and the depth slope (Vertex has no normals, so the
+// lighting pass rebuilds a faceted one from it), then subpass 1 reads it and
+// the depth back as input attachments and sums the lights over it. The
+// G-buffer never leaves the render pass, so it is transient and lazily
+// allocated where the device allows.
+typedef struct deferred {
+  VkImage images[GBUFFER_COUNT];
+  Allocation memory[GBUFFER_COUNT];
+  VkImageView views[GBUFFER_COUNT];
+  VkDescriptorSetLayout setLayout;
+  VkDescriptorPool descriptorPool;
+  VkDescriptorSet set;
+  VkPipelineLayout layout;
+  VkPipeline lightingPipeline;
+  VkBuffer lightBuffer;
+  Allocation lightMemory;
+  uint32_t lightCount;
+} Deferred;
+
+// Dynamic resolution: the scene is drawn into the top-left renderExtent of a
+// colour target sized for the full extent, then blitted up to the swapchain
+// image. Only the render area, viewport and scissor change with the scale,
+// so no pipeline or framebuffer is rebuilt. The scale follows the GPU frame
+// time the profiler measures towards config.targetFrameTime.
+typedef struct resolution {
+  int enabled;
+  VkFilter filter;
+  VkImage image;
+  Allocation memory;
+  VkImageView view;
+  float scale;
+  // The profiler's sample count when the scale was last updated.
+  uint64_t collected;
+  // Since the last log, and over the whole run.
+  double lastLog;
+  uint32_t frames;
+  uint32_t hitches;
+  double frameTimeTotal;
+  double worstFrameTime;
+  double scaleTotal;
+  float minScale;
+  float maxScale;
+  uint64_t totalFrames;
+  uint64_t totalHitches;
+  double totalFrameTime;
+  double totalScale;
+} Resolution;
+
+// Transforms submitted this frame for one pipeline and mesh, drawn as a
+// single instanced draw from offset within the frame's slice of the ring.
+typedef struct instanceBatch {
+  VkPipeline pipeline;
+  Mesh* mesh;
+  mat4* transforms;
+  uint32_t count;
+  uint32_t capacity;
+  // Where the last flush put them, drawn until the next flush.
+  VkDeviceSize offset;
+  uint32_t flushed;
+} InstanceBatch;
+
+// Per-instance transforms live in a persistently mapped, host-coherent
+// buffer with an INSTANCE_RING_SIZE slice per frame in flight, bound as a
+// per-instance vertex stream.
+typedef struct instancer {
+  VkBuffer buffer;
+  Allocation memory;
+  uint8_t* mapped;
+  VkPipeline pipeline;
+  InstanceBatch batches[MAX_INSTANCE_BATCHES];
+  uint32_t batchCount;
+  uint32_t lastBatch;
+  // Draws issued and objects submitted by the last frame, and in total.
+  uint32_t frameDraws;
+  uint32_t frameObjects;
+  uint64_t draws;
+  uint64_t objects;
+  uint64_t frames;
+  uint64_t dropped;
+} Instancer;
+
+// One draw submitted to the render queue. pipeline indexes engine->pipelines;
+// profile is the pipeline to time, or -1.
+typedef struct drawPacket {
+  uint64_t key;
+  uint32_t pipeline;
+  int profile;
+  Texture* texture;
+  Mesh* mesh;
+} DrawPacket;
+
+typedef struct sortEntry {
+  uint64_t key;
+  uint32_t packet;
+} SortEntry;
+
+typedef enum bindType { BIND_PIPELINE, BIND_DESCRIPTOR_SET, BIND_VERTEX_BUFFER, BIND_INDEX_BUFFER, BIND_TYPE_COUNT } BindType;
+
+typedef struct bindCounters {
+  uint64_t issued[BIND_TYPE_COUNT];
+  uint64_t elided[BIND_TYPE_COUNT];
+} BindCounters;
+
+// Draw packets submitted for the next frame and, after engineRenderQueueSort,
+// their order in sorted. Both arenas are allocated once at startup.
+typedef struct renderQueue {
+  DrawPacket* packets;
+  SortEntry* sorted;
+  SortEntry* scratch;
+  uint32_t count;
+  uint32_t sortedCount;
+  uint64_t dropped;
+  // Binds of the last recorded frame, and in total.
+  BindCounters frame;
+  BindCounters total;
+} RenderQueue;
+
+// Thread 0 is the main thread itself and has no pthread.
+typedef struct recordThread {
+  pthread_t thread;
+  struct engine* engine;
+  uint32_t index;
+  VkCommandPool commandPools[MAX_FRAMES_IN_FLIGHT];
+  VkCommandBuffer commandBuffers[MAX_FRAMES_IN_FLIGHT];
+  uint32_t first;
+  uint32_t count;
+  BindCounters counters;
+} RecordThread;
+
+typedef struct recorder {
+  RecordThread threads[RECORD_MAX_THREADS];
+  uint32_t threadCount;
+  pthread_mutex_t mutex;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  uint64_t generation;
+  uint32_t pending;
+  int stop;
+  // The job published with each generation.
+  uint32_t activeCount;
+  VkFramebuffer framebuffer;
+} Recorder;
+
+typedef enum uploadBatchState { UPLOAD_BATCH_IDLE, UPLOAD_BATCH_RECORDING, UPLOAD_BATCH_SUBMITTED } UploadBatchState;
+
+// One submission of copy commands. end is the ring position that becomes
+// free again once the transfer timeline reaches value.
+typedef struct uploadBatch {
+  VkCommandBuffer commandBuffer;
+  uint64_t value;
+  uint64_t end;
+  UploadBatchState state;
+} UploadBatch;
+
+// Staging ring addressed by ever-increasing positions: head is where the next
+// upload is written and tail is the oldest byte still read by the GPU.
+typedef struct uploader {
+  VkBuffer buffer;
+  Allocation memory;
+  uint8_t* mapped;
+  uint64_t head;
+  uint64_t tail;
+  VkCommandPool commandPool;
+  UploadBatch batches[UPLOAD_BATCHES];
+  int current;
+  int oldest;
+  int submittedCount;
+  // Transfer timeline value of the last submitted batch, until a submission
+  // that reads the uploads takes it.
+  uint64_t pendingValue;
+  // Images released by the transfer family, for the next frame to acquire
+  // on the graphics queue.
+  VkImageMemoryBarrier* acquires;
+  uint32_t acquireCount;
+  uint32_t acquireCapacity;
+  uint64_t bytesUploaded;
+  uint64_t copyCount;
+  uint64_t batchCount;
+} Uploader;
+
+typedef enum pipelineKind { PIPELINE_VERTEXLESS, PIPELINE_MESH, PIPELINE_INSTANCED, PIPELINE_COMPUTE } PipelineKind;
+
+typedef enum pipelineBlend { PIPELINE_BLEND_OFF, PIPELINE_BLEND_ALPHA, PIPELINE_BLEND_ADDITIVE } PipelineBlend;
+
+// Fixed-function state of a graphics pipeline; pipelineDefaultState is what
+// the built-in pipelines use.
+typedef struct pipelineState {
+  VkPrimitiveTopology topology;
+  VkPolygonMode polygonMode;
+  VkCullModeFlags cullMode;
+  VkFrontFace frontFace;
+  int depthTest;
+  int depthWrite;
+  VkCompareOp depthCompare;
+  PipelineBlend blend;
+  // No fragment shader or colour output, built for the depth pre-pass.
+  int depthOnly;
+  // Subpass of the main render pass; 1 is the deferred lighting pass.
+  uint32_t subpass;
+} PipelineState;
+
+// Everything needed to build a pipeline again. vertPath is the compute
+// shader for PIPELINE_COMPUTE, which has an empty fragPath. pipeline is the
+// current build, or VK_NULL_HANDLE once its owner has destroyed it.
+typedef struct pipelineSource {
+  PipelineKind kind;
+  char vertPath[SHADER_PATH_MAX];
+  char fragPath[SHADER_PATH_MAX];
+  PipelineState state;
+  VkPipelineLayout layout;
+  VkPipeline pipeline;
+} PipelineSource;
+
+// One engineCompilePipelines call: workers take sources from next and build
+// them with the shader modules shared between them.
+typedef struct pipelineCompiler {
+  struct engine* engine;
+  PipelineSource* sources;
+  VkShaderModule* vertModules;
+  VkShaderModule* fragModules;
+  VkPipeline* pipelines;
+  uint32_t count;
+  atomic_uint next;
+} PipelineCompiler;
+
+// A rebuilt pipeline waiting to be swapped in between frames.
+typedef struct reloadedPipeline {
+  uint32_t source;
+  VkPipeline pipeline;
+} ReloadedPipeline;
+
+// A thread watches SHADER_DIR with inotify, compiles changed GLSL with glslc
+// and rebuilds the pipelines that use changed SPIR-V into ready. The frame
+// loop swaps them in. mutex guards sources, ready and the counters.
+typedef struct shaderReload {
+  PipelineSource sources[MAX_PIPELINE_SOURCES];
+  uint32_t sourceCount;
+  int watch;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  atomic_int stop;
+  ReloadedPipeline ready[MAX_PIPELINE_SOURCES];
+  uint32_t readyCount;
+  uint64_t reloads;
+  uint64_t failures;
+} ShaderReload;
+
+typedef struct shaderModuleEntry {
+  uint64_t hash;
+  size_t size;
+  // The path it was last loaded from.
+  char path[SHADER_PATH_MAX];
+  VkShaderModule module;
+  uint32_t users;
+} ShaderModuleEntry;
+
+typedef struct shaderArchiveHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t reserved;
+} ShaderArchiveHeader;
+
+// Followed by the SPIR-V, each at offset from the start of the archive.
+typedef struct shaderArchiveEntry {
+  char path[SHADER_PATH_MAX];
+  uint64_t offset;
+  uint64_t size;
+  uint64_t hash;
+} ShaderArchiveEntry;
+
+// Shader modules keyed by a hash of their code, so pipelines loading the
+// same SPIR-V, under any path, share one. mutex guards entries and the
+// counters; the archive is read-only once mapped.
+typedef struct shaderCache {
+  pthread_mutex_t mutex;
+  ShaderModuleEntry* entries;
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t created;
+  uint64_t hits;
+  uint64_t misses;
+  uint8_t* archive;
+  size_t archiveSize;
+  ShaderArchiveEntry* archiveEntries;
+  uint32_t archiveCount;
+} ShaderCache;
+
+// Frame limiter and input to present latency. Latency runs from the input
+// poll in engineRunFrame to the present being submitted. Headless, a
+// simulated display scans out at the next vblank after each present, which
+// gives the latency to the photons too; presents not yet shown are queued,
+// and acquire blocks while every other image is queued, as on a swapchain.
+typedef struct framePacing {
+  double frameInterval;
+  double nextFrame;
+  double pollTime;
+  double latencies[LATENCY_SAMPLES];
+  double displayLatencies[LATENCY_SAMPLES];
+  uint64_t latencyCount;
+  double latencyTotal;
+  double latencyMax;
+  double displayLatencyTotal;
+  double displayLatencyMax;
+  double refreshInterval;
+  double vblankOrigin;
+  uint32_t imageCount;
+  double queued[MAX_SWAPCHAIN_IMAGES];
+  uint32_t queuedCount;
+  uint64_t dropped;
+} FramePacing;
+
+typedef enum deletionType {
+  DELETE_PIPELINE,
+  DELETE_BUFFER,
+  DELETE_IMAGE,
+  DELETE_IMAGE_VIEW,
+  DELETE_FRAMEBUFFER,
+  DELETE_DESCRIPTOR_POOL,
+  DELETE_SWAPCHAIN,
+  DELETE_MEMORY,
+  DELETE_MESH,
+  DELETE_CALLBACK,
+  DELETE_TYPE_COUNT
+} DeletionType;
+
+// An object to destroy once the graphics timeline reaches value, the first
+// submission after it was enqueued. handle is the Vulkan handle, allocation
+// the memory for DELETE_MEMORY, and data the Mesh or callback argument.
+typedef struct deletion {
+  DeletionType type;
+  uint64_t handle;
+  Allocation allocation;
+  void (*callback)(struct engine* engine, void* data);
+  void* data;
+  // Graphics timeline value to wait for, 0 until the next frame is submitted.
+  uint64_t value;
+  uint64_t frame;
+  double time;
+} Deletion;
+
+// Objects waiting for the submissions that may use them, oldest first.
+// mutex guards everything so any thread can enqueue.
+typedef struct deletionQueue {
+  pthread_mutex_t mutex;
+  Deletion* entries;
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t peak;
+  uint64_t enqueued[DELETE_TYPE_COUNT];
+  uint64_t destroyed;
+  uint64_t latencyFrames;
+  uint64_t latencyFramesMax;
+  double latencyTime;
+  double latencyTimeMax;
+} DeletionQueue;
+
+// A timeline semaphore for one queue. Every submission to the queue signals
+// the next value, so "this work is done" is a single number that the CPU can
+// poll or wait for and that other queues can wait on.
+typedef struct timeline {
+  VkQueue queue;
+  VkSemaphore semaphore;
+  // The value the latest submission will signal, and the latest value seen
+  // reached.
+  uint64_t submitted;
+  uint64_t completed;
+} Timeline;
+
+// The semaphores a submission waits on. Binary semaphores have a value of 0.
+typedef struct submitWaits {
+  VkSemaphore semaphores[MAX_SUBMIT_WAITS];
+  uint64_t values[MAX_SUBMIT_WAITS];
+  VkPipelineStageFlags stages[MAX_SUBMIT_WAITS];
+  uint32_t count;
+} SubmitWaits;
 
 typedef struct engine {
+  EngineConfig config;
   GLFWwindow* window;
   VkInstance instance;
   VkSurfaceKHR surface;
   VkPhysicalDevice physicalDevice;
+  VkPhysicalDeviceProperties physicalDeviceProperties;
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  // Graphics, compute and transfer families; compute and transfer are the
+  // graphics family when the device has no separate ones. queueFamilies
+  // lists the distinct ones, which buffers are shared between.
   int queueFamilyIndex;
+  int computeFamilyIndex;
+  int transferFamilyIndex;
+  uint32_t queueFamilies[3];
+  uint32_t queueFamilyCount;
   VkDevice device;
+  VkPhysicalDeviceFeatures enabledFeatures;
+  int drawIndirectCount;
+  PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount;
+  // Core on 1.2 devices, VK_KHR_timeline_semaphore before.
+  PFN_vkWaitSemaphoresKHR waitSemaphores;
+  PFN_vkSignalSemaphoreKHR signalSemaphore;
+  PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue;
+  int physicalDeviceProperties2;
+  int descriptorIndexing;
+  uint32_t bindlessImageLimit;
+  uint32_t bindlessBufferLimit;
   VkQueue queue;
+  VkQueue computeQueue;
+  VkQueue transferQueue;
+  // One timeline per distinct queue, and the one each kind of work uses.
+  Timeline timelines[3];
+  Timeline* graphicsTimeline;
+  Timeline* computeTimeline;
+  Timeline* transferTimeline;
   VkExtent2D extent;
+  // The part of extent the scene is drawn at, smaller with dynamic
+  // resolution.
+  VkExtent2D renderExtent;
 
   VkSwapchainKHR swapChain;
   uint32_t swapChainImageCount;
   VkImage* swapChainImages;
   VkImageView* swapChainImageViews;
   VkFramebuffer* swapChainFramebuffers;
+  Allocation* offscreenImageMemory;
+  uint32_t swapChainRecreations;
 
   VkImage depthImage;
-  VkDeviceMemory depthImageMemory;
+  Allocation depthImageMemory;
   VkImageView depthImageView;
 
   VkRenderPass renderPass;
@@ -32,24 +900,226 @@ typedef struct engine {
   VkCommandBuffer commandBuffers[MAX_FRAMES_IN_FLIGHT];
   VkSemaphore imageAvailableSemaphores[MAX_FRAMES_IN_FLIGHT];
   VkSemaphore renderFinishedSemaphores[MAX_FRAMES_IN_FLIGHT];
-  VkFence inFlightFences[MAX_FRAMES_IN_FLIGHT];
+  // The graphics timeline value each frame in flight's submission signals.
+  uint64_t frameValues[MAX_FRAMES_IN_FLIGHT];
 
+  PresentMode presentMode;
+  uint32_t framesInFlight;
   int currentFrame;
+  uint64_t frameCount;
+
+  VkPipelineCache pipelineCache;
+  size_t pipelineCacheLoadedSize;
+  double createTime;
+  double pipelineCreateTime;
+
+  Allocator allocator;
+  Uploader uploader;
+  Textures textures;
+  Descriptors descriptors;
+  Recorder recorder;
+  Indirect indirect;
+  HiZ hiz;
+  Deferred deferred;
+  Resolution resolution;
+  Instancer instancer;
+  RenderQueue renderQueue;
+  Readback readback;
+  Profiler profiler;
+  Trace trace;
+  FramePacing pacing;
+  DeletionQueue deletion;
+  ShaderCache shaders;
+  ShaderReload reload;
 
   VkPipelineLayout pipelineLayout;
   int pipelineCount;
   VkPipeline pipelines[MAX_PIPELINES];
+  Mesh* pipelineMeshes[MAX_PIPELINES];
+  Texture* pipelineTextures[MAX_PIPELINES];
+  uint32_t nextMeshId;
+
+  // Called by engineRun before each frame, for example to submit instances.
+  void (*frameCallback)(struct engine* engine, void* data);
+  void* frameCallbackData;
 } Engine;
 
 typedef struct fileData {
-  uint32_t size;
+  size_t size;
   char* data;
 } FileData;
 
-Engine* engineCreate(void);
+EngineConfig engineDefaultConfig(void);
+Engine* engineCreate(EngineConfig* config);
 void engineRun(Engine* engine);
+void engineRunFrame(Engine* engine);
 void engineDestroy(Engine* engine);
+void engineDrawFrame(Engine* engine);
 void engineAddPipeline(Engine* engine, VkPipeline pipeline);
+void engineAddMeshPipeline(Engine* engine, VkPipeline pipeline, Mesh* mesh, Texture* texture);
+void engineSetFrameCallback(Engine* engine, void (*callback)(Engine* engine, void* data), void* data);
+void engineDrawInstance(Engine* engine, VkPipeline pipeline, Mesh* mesh, mat4 transform);
+uint64_t engineSortKey(uint32_t pipeline, uint32_t material, uint32_t mesh, float depth);
+void engineSubmitDraw(Engine* engine, uint32_t pipeline, Texture* texture, Mesh* mesh, float depth);
+Mesh* engineCreateMesh(Engine* engine, Vertex* vertices, uint32_t vertexCount, uint32_t* indices, uint32_t indexCount);
+void engineDestroyMesh(Engine* engine, Mesh* mesh);
+void engineBenchmarkUploads(Engine* engine);
+Texture* engineLoadTexture(Engine* engine, const char* path);
+VkSampler engineGetSampler(Engine* engine, VkSamplerCreateInfo* samplerInfo);
+void engineBenchmarkRecording(Engine* engine);
+void engineBenchmarkDescriptors(Engine* engine);
+void engineSetIndirectScene(Engine* engine, Mesh* mesh, Instance* instances, uint32_t instanceCount);
+void engineBenchmarkIndirect(Engine* engine);
+void engineFrustumPlanes(const float viewProjection[16], float planes[6][4]);
+uint32_t engineLoadModels(Engine* engine, char** paths, uint32_t count, Mesh** meshes);
+int engineProfilerStats(Engine* engine, int pipelineIndex, ProfilerStats* stats);
+void engineProfilerDump(Engine* engine);
+int engineTraceExport(Engine* engine, const char* path);
+void engineTraceSummary(Engine* engine);
 
 VkPipeline pipelineCreate(Engine* engine);
+VkPipeline meshPipelineCreate(Engine* engine);
+VkPipeline texturedPipelineCreate(Engine* engine);
+VkPipeline instancedPipelineCreate(Engine* engine);
+VkPipeline meshPipelineCreateWithShaders(Engine* engine, char* vertPath, char* fragPath, VkPipelineLayout layout);
+VkPipeline computePipelineCreate(Engine* engine, char* path, VkPipelineLayout layout);
+VkPipeline pipelineCreateWithState(Engine* engine, PipelineKind kind, char* vertPath, char* fragPath, PipelineState* state, VkPipelineLayout layout);
+PipelineState pipelineDefaultState(void);
+int pipelineHasFragment(PipelineSource* source);
+void engineCreateShaders(Engine* engine);
+void engineDestroyShaders(Engine* engine);
+VkShaderModule engineAcquireShaderModule(Engine* engine, const char* path);
+void engineReleaseShaderModule(Engine* engine, VkShaderModule module);
+int engineWriteShaderArchive(const char* dir, const char* archivePath);
+VkPipeline pipelineBuild(Engine* engine, PipelineSource* source);
+VkPipeline pipelineBuildWithModules(Engine* engine, PipelineSource* source, VkShaderModule vertShaderModule, VkShaderModule fragShaderModule);
+int engineLoadPipelineDescription(Engine* engine, const char* path, PipelineSource* source);
+void engineCompilePipelines(Engine* engine, PipelineSource* sources, uint32_t count, uint32_t threadCount, VkPipeline* pipelines);
+void engineBenchmarkPipelines(Engine* engine);
+void engineCreatePacing(Engine* engine);
+void engineDestroyPacing(Engine* engine);
+void enginePaceFrame(Engine* engine);
+void enginePacingPoll(Engine* engine);
+void enginePacingAcquire(Engine* engine);
+void enginePacingPresent(Engine* engine);
+VkPresentModeKHR engineSelectPresentMode(Engine* engine);
+void engineBenchmarkPacing(Engine* engine);
+void engineCreateSwapChain(Engine* engine);
+void engineCreateMainRenderPass(Engine* engine, VkAttachmentLoadOp depthLoadOp, VkRenderPass* renderPass);
+void engineRecreateSwapChain(Engine* engine);
+void engineBenchmarkResize(Engine* engine);
+void engineCreateDeletionQueue(Engine* engine);
+void engineDestroyDeletionQueue(Engine* engine);
+void engineDeletionBeginFrame(Engine* engine);
+void engineDeletionSubmitted(Engine* engine, uint64_t value);
+void engineDeferDestroy(Engine* engine, DeletionType type, uint64_t handle);
+void engineDeferFree(Engine* engine, Allocation* allocation);
+void engineDeferDestroyMesh(Engine* engine, Mesh* mesh);
+void engineDeferCall(Engine* engine, void (*callback)(Engine* engine, void* data), void* data);
+void engineCreateTimelines(Engine* engine);
+void engineDestroyTimelines(Engine* engine);
+void engineSubmitWait(SubmitWaits* waits, VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stage);
+void engineSubmitWaitTimeline(SubmitWaits* waits, Timeline* timeline, uint64_t value, VkPipelineStageFlags stage);
+uint64_t engineTimelineSubmit(Engine* engine, Timeline* timeline, SubmitWaits* waits, VkCommandBuffer commandBuffer, VkSemaphore signal);
+uint64_t engineTimelineCompleted(Engine* engine, Timeline* timeline);
+int engineTimelineReached(Engine* engine, Timeline* timeline, uint64_t value);
+void engineTimelineWait(Engine* engine, Timeline* timeline, uint64_t value);
+void engineBenchmarkSubmit(Engine* engine);
+void engineCreateReload(Engine* engine);
+void engineDestroyReload(Engine* engine);
+void engineRegisterPipelineSource(Engine* engine, PipelineSource* source);
+void engineReloadBeginFrame(Engine* engine);
+void engineCreatePipelineCache(Engine* engine);
+void engineDestroyPipelineCache(Engine* engine);
+void engineCreateAllocator(Engine* engine);
+void engineDestroyAllocator(Engine* engine);
+uint32_t engineFindMemoryType(Engine* engine, uint32_t typeFilter, VkMemoryPropertyFlags properties);
+int engineHasMemoryType(Engine* engine, uint32_t typeFilter, VkMemoryPropertyFlags properties);
+void engineAllocate(Engine* engine, VkMemoryRequirements* requirements, VkMemoryPropertyFlags properties, int linear, int dedicated, Allocation* allocation);
+void engineFree(Engine* engine, Allocation* allocation);
+void engineAllocatorReport(Engine* engine);
+void engineCreateImage(Engine* engine, uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, int dedicated, VkImage* image, Allocation* imageMemory);
+void engineCreateImageView(Engine* engine, VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VkImageView* imageView);
+void engineCreateBuffer(Engine* engine, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer* buffer, Allocation* bufferMemory);
+void engineCreateUploader(Engine* engine);
+void engineDestroyUploader(Engine* engine);
+void engineUploadBuffer(Engine* engine, VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
+void engineUploadImage(Engine* engine, VkImage image, uint32_t mipLevel, uint32_t width, uint32_t height, const uint8_t* pixels);
+VkCommandBuffer engineUploadCommandBuffer(Engine* engine);
+void engineFlushUploads(Engine* engine);
+void engineWaitUploads(Engine* engine);
+uint64_t engineTakeUploadValue(Engine* engine);
+void engineUploadReleaseImage(Engine* engine, VkImage image, uint32_t baseLevel, uint32_t levelCount);
+void engineUploadAcquire(Engine* engine, VkCommandBuffer commandBuffer);
+void engineCreateTextures(Engine* engine);
+void engineDestroyTextures(Engine* engine);
+void engineUpdateTextures(Engine* engine);
+int engineBindTexture(Engine* engine, VkCommandBuffer commandBuffer, Texture* texture);
+void engineCreateDescriptors(Engine* engine);
+void engineDestroyDescriptors(Engine* engine);
+void engineDescriptorsBeginFrame(Engine* engine);
+VkDescriptorSet engineAllocateFrameDescriptorSet(Engine* engine, VkDescriptorSetLayout setLayout);
+uint32_t engineBindlessAllocateImages(Engine* engine, uint32_t count);
+uint32_t engineBindlessAllocateBuffers(Engine* engine, uint32_t count);
+void engineBindlessWriteImage(Engine* engine, uint32_t slot, VkImageView view, VkSampler sampler);
+void engineBindlessWriteBuffer(Engine* engine, uint32_t slot, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+void engineBindBindless(Engine* engine, VkCommandBuffer commandBuffer, uint32_t image, uint32_t buffer);
+void engineCreateRecorder(Engine* engine);
+void engineDestroyRecorder(Engine* engine);
+void engineRecordRenderPass(Engine* engine, VkCommandBuffer commandBuffer, VkRenderPassBeginInfo* renderPassInfo, uint32_t drawCount, uint32_t threadCount);
+void engineSetViewport(Engine* engine, VkCommandBuffer commandBuffer);
+void engineCreateIndirect(Engine* engine);
+void engineDestroyIndirect(Engine* engine);
+void engineIndirectCollect(Engine* engine);
+uint64_t engineIndirectCull(Engine* engine, VkCommandBuffer commandBuffer);
+void engineIndirectDraw(Engine* engine, VkCommandBuffer commandBuffer);
+void engineIndirectDrawDepth(Engine* engine, VkCommandBuffer commandBuffer);
+void engineCreateHiZ(Engine* engine);
+void engineResizeHiZ(Engine* engine);
+void engineDestroyHiZ(Engine* engine);
+void engineHiZCollect(Engine* engine);
+int engineHiZPrepareCull(Engine* engine);
+int engineDepthPrepass(Engine* engine, VkCommandBuffer commandBuffer);
+void engineDepthPrepassEnd(Engine* engine, VkCommandBuffer commandBuffer);
+void engineBenchmarkHiZ(Engine* engine);
+void engineCreateDeferred(Engine* engine);
+void engineResizeDeferred(Engine* engine);
+void engineDestroyDeferred(Engine* engine);
+void engineDeferredLighting(Engine* engine, VkCommandBuffer commandBuffer);
+void engineAttachmentReport(Engine* engine);
+void engineCreateResolution(Engine* engine);
+void engineResizeResolution(Engine* engine);
+void engineDestroyResolution(Engine* engine);
+void engineResolutionUpdate(Engine* engine);
+void engineResolutionUpscale(Engine* engine, VkCommandBuffer commandBuffer, uint32_t imageIndex);
+void engineResolutionReport(Engine* engine);
+void engineCreateInstancer(Engine* engine);
+void engineDestroyInstancer(Engine* engine);
+void engineInstancerFlush(Engine* engine);
+void engineInstancerDraw(Engine* engine, VkCommandBuffer commandBuffer);
+void engineCreateRenderQueue(Engine* engine);
+void engineDestroyRenderQueue(Engine* engine);
+void engineRenderQueueSort(Engine* engine);
+void engineRenderQueueClear(Engine* engine);
+void engineRenderQueueRecord(Engine* engine, VkCommandBuffer commandBuffer, uint32_t first, uint32_t count, BindCounters* counters);
+void engineCreateReadback(Engine* engine);
+void engineResizeReadback(Engine* engine);
+void engineDestroyReadback(Engine* engine);
+void engineReadbackCollect(Engine* engine);
+void engineReadbackRecord(Engine* engine, VkCommandBuffer commandBuffer, uint32_t imageIndex);
+void engineReadbackSubmitted(Engine* engine, uint64_t value);
+uint64_t traceBegin(void);
+void traceEnd(Engine* engine, TracePhase phase, uint64_t start);
+void engineCreateTrace(Engine* engine);
+void engineDestroyTrace(Engine* engine);
+void engineCreateProfiler(Engine* engine);
+void engineDestroyProfiler(Engine* engine);
+void engineProfilerCollect(Engine* engine);
+void engineProfilerBegin(Engine* engine, VkCommandBuffer commandBuffer);
+void engineProfilerEnd(Engine* engine, VkCommandBuffer commandBuffer);
+void engineProfilerPipelineBegin(Engine* engine, VkCommandBuffer commandBuffer, int pipelineIndex);
+void engineProfilerPipelineEnd(Engine* engine, VkCommandBuffer commandBuffer, int pipelineIndex);
 FileData readFile(char* path);
+uint64_t hashPath(const char* path);
+uint64_t hashBytes(const void* data, size_t size);
+double getTime(void);
@@ -0,0 +1,571 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+#define HIZ_WORKGROUP_SIZE 8
+#define HIZ_BENCH_FRAMES 100
+#define HIZ_BENCH_WALL 8
+
+// Matches the Occlusion uniform block of cull.comp.
+typedef struct hizUniform {
+  float viewProjection[16];
+  float depthSize[2];
+  uint32_t levelCount;
+  uint32_t enabled;
+} HiZUniform;
+
+// Matches the Region push constants of hiz.comp.
+typedef struct hizRegion {
+  int32_t sourceSize[2];
+  int32_t size[2];
+} HiZRegion;
+
+// Binding 0 a sampled image, binding 1 of type second.
+void hizCreateSetLayout(Engine* engine, VkDescriptorType second, VkDescriptorSetLayout* setLayout) {
+  VkDescriptorSetLayoutBinding bindings[2];
+  memset(bindings, 0, sizeof(bindings));
+  for (uint32_t n = 0; n < 2; n++) {
+    bindings[n].binding = n;
+    bindings[n].descriptorType = n == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : second;
+    bindings[n].descriptorCount = 1;
+    bindings[n].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo;
+  memset(&layoutInfo, 0, sizeof(VkDescriptorSetLayoutCreateInfo));
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 2;
+  layoutInfo.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(engine->device, &layoutInfo, NULL, setLayout) != VK_SUCCESS) {
+    printf("Failed to create Hi-Z descriptor set layout!\n");
+    exit(1);
+  }
+}
+
+// Depth only, cleared and kept. It finishes read-only for the Hi-Z build and
+// for the main pass, which loads it.
+void hizCreatePrepassRenderPass(Engine* engine) {
+  VkAttachmentDescription depthAttachment;
+  memset(&depthAttachment, 0, sizeof(VkAttachmentDescription));
+  depthAttachment.format = VK_FORMAT_D32_SFLOAT;
+  depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+  VkAttachmentReference depthAttachmentRef;
+  memset(&depthAttachmentRef, 0, sizeof(VkAttachmentReference));
+  depthAttachmentRef.attachment = 0;
+  depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpass;
+  memset(&subpass, 0, sizeof(VkSubpassDescription));
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+  // After the previous frame's depth tests, and before the Hi-Z build reads
+  // the result.
+  VkSubpassDependency dependencies[2];
+  memset(dependencies, 0, sizeof(dependencies));
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  VkRenderPassCreateInfo renderPassInfo;
+  memset(&renderPassInfo, 0, sizeof(VkRenderPassCreateInfo));
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassInfo.attachmentCount = 1;
+  renderPassInfo.pAttachments = &depthAttachment;
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+  renderPassInfo.dependencyCount = 2;
+  renderPassInfo.pDependencies = dependencies;
+  if (vkCreateRenderPass(engine->device, &renderPassInfo, NULL, &engine->hiz.prepassRenderPass) != VK_SUCCESS) {
+    printf("Depth pre-pass render pass creation failed!\n");
+    exit(1);
+  }
+}
+
+void engineCreateHiZ(Engine* engine) {
+  HiZ* hiz = &engine->hiz;
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(engine->physicalDevice, VK_FORMAT_D32_SFLOAT, &formatProperties);
+  int sampled = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+  // Only built when asked for: sampling the depth buffer stops it being a
+  // transient attachment.
+  hiz->supported = engine->config.depthPrepass && engine->enabledFeatures.drawIndirectFirstInstance && sampled;
+  if (engine->config.depthPrepass && !sampled) printf("Depth pre-pass disabled: the depth buffer can't be sampled\n");
+  hiz->enabled = hiz->supported;
+  for (int n = 0; n < 16; n++) hiz->viewProjection[n] = n % 5 == 0 ? 1.0f : 0.0f;
+
+  // The cull always binds the occlusion set; without a pyramid its uniform
+  // just turns the test off.
+  hizCreateSetLayout(engine, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &hiz->cullSetLayout);
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
+    engineCreateBuffer(engine, sizeof(HiZUniform), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &hiz->uniformBuffers[n], &hiz->uniformMemory[n]);
+    memset(hiz->uniformMemory[n].mapped, 0, sizeof(HiZUniform));
+  }
+  // Only ever read with texelFetch.
+  VkSamplerCreateInfo samplerInfo;
+  memset(&samplerInfo, 0, sizeof(VkSamplerCreateInfo));
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+  if (vkCreateSampler(engine->device, &samplerInfo, NULL, &hiz->sampler) != VK_SUCCESS) {
+    printf("Failed to create Hi-Z sampler!\n");
+    exit(1);
+  }
+  if (!hiz->supported) return;
+
+  hizCreatePrepassRenderPass(engine);
+  engineCreateMainRenderPass(engine, VK_ATTACHMENT_LOAD_OP_LOAD, &hiz->loadRenderPass);
+  hizCreateSetLayout(engine, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &hiz->buildSetLayout);
+  VkPipelineLayoutCreateInfo layoutInfo;
+  memset(&layoutInfo, 0, sizeof(VkPipelineLayoutCreateInfo));
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = 1;
+  layoutInfo.pSetLayouts = &hiz->buildSetLayout;
+  VkPushConstantRange range;
+  range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  range.offset = 0;
+  range.size = sizeof(HiZRegion);
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &range;
+  if (vkCreatePipelineLayout(engine->device, &layoutInfo, NULL, &hiz->buildLayout) != VK_SUCCESS) {
+    printf("Failed to create Hi-Z pipeline layout!\n");
+    exit(1);
+  }
+  hiz->buildPipeline = computePipelineCreate(engine, "shaders/hiz.comp.spv", hiz->buildLayout);
+
+  if (!engine->enabledFeatures.pipelineStatisticsQuery) return;
+  VkQueryPoolCreateInfo queryPoolInfo;
+  memset(&queryPoolInfo, 0, sizeof(VkQueryPoolCreateInfo));
+  queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+  queryPoolInfo.queryCount = MAX_FRAMES_IN_FLIGHT;
+  queryPoolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+  if (vkCreateQueryPool(engine->device, &queryPoolInfo, NULL, &hiz->queryPool) != VK_SUCCESS) {
+    printf("Failed to create query pool!\n");
+    exit(1);
+  }
+}
+
+void hizCreateView(Engine* engine, uint32_t baseLevel, uint32_t levelCount, VkImageView* view) {
+  VkImageViewCreateInfo viewInfo;
+  memset(&viewInfo, 0, sizeof(VkImageViewCreateInfo));
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = engine->hiz.image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = VK_FORMAT_R32_SFLOAT;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel = baseLevel;
+  viewInfo.subresourceRange.levelCount = levelCount;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = 1;
+  if (vkCreateImageView(engine->device, &viewInfo, NULL, view) != VK_SUCCESS) {
+    printf("Failed to create image view!\n");
+    exit(1);
+  }
+}
+
+// Written on the graphics queue and read by the cull, which may run on the
+// compute queue, every frame; shared rather than transferred back and forth.
+void hizCreateImage(Engine* engine) {
+  HiZ* hiz = &engine->hiz;
+  VkImageCreateInfo imageInfo;
+  memset(&imageInfo, 0, sizeof(VkImageCreateInfo));
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent.width = hiz->width;
+  imageInfo.extent.height = hiz->height;
+  imageInfo.extent.depth = 1;
+  imageInfo.mipLevels = hiz->levelCount;
+  imageInfo.arrayLayers = 1;
+  imageInfo.format = VK_FORMAT_R32_SFLOAT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.sharingMode = engine->queueFamilyCount > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.queueFamilyIndexCount = engine->queueFamilyCount > 1 ? engine->queueFamilyCount : 0;
+  imageInfo.pQueueFamilyIndices = engine->queueFamilies;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  if (vkCreateImage(engine->device, &imageInfo, NULL, &hiz->image) != VK_SUCCESS) {
+    printf("Failed to create image!\n");
+    exit(1);
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements(engine->device, hiz->image, &memRequirements);
+  engineAllocate(engine, &memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, 0, &hiz->memory);
+  if (vkBindImageMemory(engine->device, hiz->image, hiz->memory.memory, hiz->memory.offset) != VK_SUCCESS) {
+    printf("Failed to bind image memory!\n");
+    exit(1);
+  }
+  hizCreateView(engine, 0, hiz->levelCount, &hiz->view);
+  for (uint32_t level = 0; level < hiz->levelCount; level++) hizCreateView(engine, level, 1, &hiz->levelViews[level]);
+}
+
+void hizCreateDescriptorSets(Engine* engine) {
+  HiZ* hiz = &engine->hiz;
+  uint32_t buildCount = hiz->supported ? hiz->levelCount : 0;
+  VkDescriptorPoolSize poolSizes[3];
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[0].descriptorCount = HIZ_MAX_LEVELS + MAX_FRAMES_IN_FLIGHT;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  poolSizes[1].descriptorCount = HIZ_MAX_LEVELS;
+  poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  poolSizes[2].descriptorCount = MAX_FRAMES_IN_FLIGHT;
+  VkDescriptorPoolCreateInfo poolInfo;
+  memset(&poolInfo, 0, sizeof(VkDescriptorPoolCreateInfo));
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = HIZ_MAX_LEVELS + MAX_FRAMES_IN_FLIGHT;
+  poolInfo.poolSizeCount = 3;
+  poolInfo.pPoolSizes = poolSizes;
+  if (vkCreateDescriptorPool(engine->device, &poolInfo, NULL, &hiz->descriptorPool) != VK_SUCCESS) {
+    printf("Failed to create Hi-Z descriptor pool!\n");
+    exit(1);
+  }
+
+  VkDescriptorSetLayout layouts[HIZ_MAX_LEVELS + MAX_FRAMES_IN_FLIGHT];
+  VkDescriptorSet sets[HIZ_MAX_LEVELS + MAX_FRAMES_IN_FLIGHT];
+  for (uint32_t n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) layouts[n] = hiz->cullSetLayout;
+  for (uint32_t n = 0; n < buildCount; n++) layouts[MAX_FRAMES_IN_FLIGHT + n] = hiz->buildSetLayout;
+  VkDescriptorSetAllocateInfo allocInfo;
+  memset(&allocInfo, 0, sizeof(VkDescriptorSetAllocateInfo));
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = hiz->descriptorPool;
+  allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT + buildCount;
+  allocInfo.pSetLayouts = layouts;
+  if (vkAllocateDescriptorSets(engine->device, &allocInfo, sets) != VK_SUCCESS) {
+    printf("Failed to allocate Hi-Z descriptor sets!\n");
+    exit(1);
+  }
+
+  VkDescriptorImageInfo pyramidInfo = {hiz->sampler, hiz->view, VK_IMAGE_LAYOUT_GENERAL};
+  VkDescriptorBufferInfo uniformInfos[MAX_FRAMES_IN_FLIGHT];
+  VkDescriptorImageInfo sourceInfos[HIZ_MAX_LEVELS];
+  VkDescriptorImageInfo destinationInfos[HIZ_MAX_LEVELS];
+  VkWriteDescriptorSet writes[2 * (HIZ_MAX_LEVELS + MAX_FRAMES_IN_FLIGHT)];
+  memset(writes, 0, sizeof(writes));
+  uint32_t writeCount = 0;
+  for (uint32_t n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
+    hiz->cullSets[n] = sets[n];
+    uniformInfos[n] = (VkDescriptorBufferInfo){hiz->uniformBuffers[n], 0, VK_WHOLE_SIZE};
+    writes[writeCount].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[writeCount].dstSet = sets[n];
+    writes[writeCount].dstBinding = 0;
+    writes[writeCount].descriptorCount = 1;
+    writes[writeCount].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[writeCount++].pImageInfo = &pyramidInfo;
+    writes[writeCount].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[writeCount].dstSet = sets[n];
+    writes[writeCount].dstBinding = 1;
+    writes[writeCount].descriptorCount = 1;
+    writes[writeCount].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    writes[writeCount++].pBufferInfo = &uniformInfos[n];
+  }
+  // Level 0 reduces the depth buffer, each level after it the one before.
+  for (uint32_t level = 0; level < buildCount; level++) {
+    hiz->buildSets[level] = sets[MAX_FRAMES_IN_FLIGHT + level];
+    if (level == 0) {
+      sourceInfos[level] = (VkDescriptorImageInfo){hiz->sampler, engine->depthImageView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL};
+    } else {
+      sourceInfos[level] = (VkDescriptorImageInfo){hiz->sampler, hiz->levelViews[level - 1], VK_IMAGE_LAYOUT_GENERAL};
+    }
+    destinationInfos[level] = (VkDescriptorImageInfo){VK_NULL_HANDLE, hiz->levelViews[level], VK_IMAGE_LAYOUT_GENERAL};
+    writes[writeCount].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[writeCount].dstSet = hiz->buildSets[level];
+    writes[writeCount].dstBinding = 0;
+    writes[writeCount].descriptorCount = 1;
+    writes[writeCount].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[writeCount++].pImageInfo = &sourceInfos[level];
+    writes[writeCount].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[writeCount].dstSet = hiz->buildSets[level];
+    writes[writeCount].dstBinding = 1;
+    writes[writeCount].descriptorCount = 1;
+    writes[writeCount].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    writes[writeCount++].pImageInfo = &destinationInfos[level];
+  }
+  vkUpdateDescriptorSets(engine->device, writeCount, writes, 0, NULL);
+}
+
+// Called with each new depth buffer. The pyramid, the pre-pass framebuffer
+// and the descriptor sets are replaced, the old ones going on the deletion
+// queue while frames in flight may still use them.
+void engineResizeHiZ(Engine* engine) {
+  HiZ* hiz = &engine->hiz;
+  engineDeferDestroy(engine, DELETE_DESCRIPTOR_POOL, (uint64_t)hiz->descriptorPool);
+  engineDeferDestroy(engine, DELETE_FRAMEBUFFER, (uint64_t)hiz->framebuffer);
+  for (uint32_t level = 0; level < hiz->levelCount; level++) engineDeferDestroy(engine, DELETE_IMAGE_VIEW, (uint64_t)hiz->levelViews[level]);
+  engineDeferDestroy(engine, DELETE_IMAGE_VIEW, (uint64_t)hiz->view);
+  engineDeferDestroy(engine, DELETE_IMAGE, (uint64_t)hiz->image);
+  engineDeferFree(engine, &hiz->memory);
+  hiz->valid = 0;
+  hiz->initialised = 0;
+
+  hiz->width = engine->extent.width > 1 ? engine->extent.width / 2 : 1;
+  hiz->height = engine->extent.height > 1 ? engine->extent.height / 2 : 1;
+  uint32_t largest = hiz->width > hiz->height ? hiz->width : hiz->height;
+  hiz->levelCount = 1;
+  while (largest >> hiz->levelCount && hiz->levelCount < HIZ_MAX_LEVELS) hiz->levelCount++;
+  hizCreateImage(engine);
+  hizCreateDescriptorSets(engine);
+  if (!hiz->supported) return;
+
+  VkFramebufferCreateInfo framebufferInfo;
+  memset(&framebufferInfo, 0, sizeof(VkFramebufferCreateInfo));
+  framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebufferInfo.renderPass = hiz->prepassRenderPass;
+  framebufferInfo.attachmentCount = 1;
+  framebufferInfo.pAttachments = &engine->depthImageView;
+  framebufferInfo.width = engine->extent.width;
+  framebufferInfo.height = engine->extent.height;
+  framebufferInfo.layers = 1;
+  if (vkCreateFramebuffer(engine->device, &framebufferInfo, NULL, &hiz->framebuffer) != VK_SUCCESS) {
+    printf("Framebuffer creation failed!\n");
+    exit(1);
+  }
+}
+
+// Called once the device is idle.
+void engineDestroyHiZ(Engine* engine) {
+  HiZ* hiz = &engine->hiz;
+  vkDestroyDescriptorPool(engine->device, hiz->descriptorPool, NULL);
+  vkDestroyFramebuffer(engine->device, hiz->framebuffer, NULL);
+  for (uint32_t level = 0; level < hiz->levelCount; level++) vkDestroyImageView(engine->device, hiz->levelViews[level], NULL);
+  vkDestroyImageView(engine->device, hiz->view, NULL);
+  vkDestroyImage(engine->device, hiz->image, NULL);
+  engineFree(engine, &hiz->memory);
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
+    vkDestroyBuffer(engine->device, hiz->uniformBuffers[n], NULL);
+    engineFree(engine, &hiz->uniformMemory[n]);
+  }
+  vkDestroySampler(engine->device, hiz->sampler, NULL);
+  vkDestroyDescriptorSetLayout(engine->device, hiz->cullSetLayout, NULL);
+  if (!hiz->supported) return;
+  if (hiz->queryPool) vkDestroyQueryPool(engine->device, hiz->queryPool, NULL);
+  vkDestroyPipeline(engine->device, hiz->buildPipeline, NULL);
+  vkDestroyPipelineLayout(engine->device, hiz->buildLayout, NULL);
+  vkDestroyDescriptorSetLayout(engine->device, hiz->buildSetLayout, NULL);
+  vkDestroyRenderPass(engine->device, hiz->loadRenderPass, NULL);
+  vkDestroyRenderPass(engine->device, hiz->prepassRenderPass, NULL);
+}
+
+void hizCollectSlot(Engine* engine, uint32_t slot) {
+  HiZ* hiz = &engine->hiz;
+  if (!hiz->recorded[slot]) return;
+  hiz->recorded[slot] = 0;
+  uint64_t invocations;
+  if (vkGetQueryPoolResults(engine->device, hiz->queryPool, slot, 1, sizeof(uint64_t), &invocations, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) return;
+  hiz->fragmentInvocations += invocations;
+  hiz->measuredFrames++;
+}
+
+// Called once the current frame's previous submission has completed, so its
+// statistics query can be read without waiting.
+void engineHiZCollect(Engine* engine) {
+  hizCollectSlot(engine, engine->currentFrame);
+}
+
+// Called as the current frame's cull is recorded: its uniform gets the
+// pyramid the previous frame built and the view-projection that frame was
+// drawn with. Returns whether the cull tests occlusion.
+int engineHiZPrepareCull(Engine* engine) {
+  HiZ* hiz = &engine->hiz;
+  HiZUniform* uniform = hiz->uniformMemory[engine->currentFrame].mapped;
+  memcpy(uniform->viewProjection, hiz->viewProjection, sizeof(hiz->viewProjection));
+  uniform->depthSize[0] = (float)hiz->renderExtent.width;
+  uniform->depthSize[1] = (float)hiz->renderExtent.height;
+  uniform->levelCount = hiz->levelCount;
+  uniform->enabled = hiz->enabled && hiz->valid;
+  return uniform->enabled;
+}
+
+// Reduce the pre-pass depth into the pyramid a level at a time. The pyramid
+// stays in the general layout once built.
+void hizBuild(Engine* engine, VkCommandBuffer commandBuffer) {
+  HiZ* hiz = &engine->hiz;
+  // This frame's cull reads what the previous frame built first.
+  VkImageMemoryBarrier imageBarrier;
+  memset(&imageBarrier, 0, sizeof(VkImageMemoryBarrier));
+  imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  imageBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  imageBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  imageBarrier.oldLayout = hiz->initialised ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED;
+  imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.image = hiz->image;
+  imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  imageBarrier.subresourceRange.levelCount = hiz->levelCount;
+  imageBarrier.subresourceRange.layerCount = 1;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &imageBarrier);
+
+  VkMemoryBarrier barrier;
+  memset(&barrier, 0, sizeof(VkMemoryBarrier));
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiz->buildPipeline);
+  // Only the region covering the render extent is built, each level halving
+  // the one before it as the full levels do.
+  HiZRegion region;
+  region.size[0] = (int32_t)engine->renderExtent.width;
+  region.size[1] = (int32_t)engine->renderExtent.height;
+  for (uint32_t level = 0; level < hiz->levelCount; level++) {
+    region.sourceSize[0] = region.size[0];
+    region.sourceSize[1] = region.size[1];
+    region.size[0] = region.sourceSize[0] > 1 ? region.sourceSize[0] / 2 : 1;
+    region.size[1] = region.sourceSize[1] > 1 ? region.sourceSize[1] / 2 : 1;
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiz->buildLayout, 0, 1, &hiz->buildSets[level], 0, NULL);
+    vkCmdPushConstants(commandBuffer, hiz->buildLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(HiZRegion), &region);
+    vkCmdDispatch(commandBuffer, (region.size[0] + HIZ_WORKGROUP_SIZE - 1) / HIZ_WORKGROUP_SIZE, (region.size[1] + HIZ_WORKGROUP_SIZE - 1) / HIZ_WORKGROUP_SIZE, 1);
+    // The last level's writes are for the next frame's cull; the main pass
+    // then waits for the depth buffer to have been read.
+    VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    if (level == hiz->levelCount - 1) dstStage |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStage, 0, 1, &barrier, 0, NULL, 0, NULL);
+  }
+  memcpy(hiz->viewProjection, engine->indirect.viewProjection, sizeof(hiz->viewProjection));
+  hiz->renderExtent = engine->renderExtent;
+  hiz->initialised = 1;
+  hiz->valid = 1;
+}
+
+// Recorded outside any render pass before the main one. Draws the indirect
+// scene's depth and builds the pyramid from it, returning whether the main
+// pass should load that depth. Also starts the statistics query when
+// counting, which engineDepthPrepassEnd ends after the main pass.
+int engineDepthPrepass(Engine* engine, VkCommandBuffer commandBuffer) {
+  HiZ* hiz = &engine->hiz;
+  if (hiz->statistics && hiz->queryPool) {
+    vkCmdResetQueryPool(commandBuffer, hiz->queryPool, engine->currentFrame, 1);
+    vkCmdBeginQuery(commandBuffer, hiz->queryPool, engine->currentFrame, 0);
+    hiz->recorded[engine->currentFrame] = 1;
+  }
+  hiz->active = hiz->enabled && engine->indirect.instanceCount > 0;
+  if (!hiz->active) {
+    hiz->valid = 0;
+    return 0;
+  }
+
+  VkClearValue clearValue;
+  memset(&clearValue, 0, sizeof(VkClearValue));
+  clearValue.depthStencil = (VkClearDepthStencilValue){1.0f, 0};
+  VkRenderPassBeginInfo renderPassInfo;
+  memset(&renderPassInfo, 0, sizeof(VkRenderPassBeginInfo));
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  renderPassInfo.renderPass = hiz->prepassRenderPass;
+  renderPassInfo.framebuffer = hiz->framebuffer;
+  renderPassInfo.renderArea.extent = engine->renderExtent;
+  renderPassInfo.clearValueCount = 1;
+  renderPassInfo.pClearValues = &clearValue;
+  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+  engineSetViewport(engine, commandBuffer);
+  engineIndirectDrawDepth(engine, commandBuffer);
+  vkCmdEndRenderPass(commandBuffer);
+
+  hizBuild(engine, commandBuffer);
+  return 1;
+}
+
+void engineDepthPrepassEnd(Engine* engine, VkCommandBuffer commandBuffer) {
+  HiZ* hiz = &engine->hiz;
+  if (hiz->recorded[engine->currentFrame]) vkCmdEndQuery(commandBuffer, hiz->queryPool, engine->currentFrame);
+}
+
+// A field of small quads behind a wall of large ones with gaps between them,
+// drawn with the pre-pass off and on. The wall is drawn last, the worst order
+// for overdraw without a pre-pass. Overdraw is fragment shader invocations
+// per pixel, when the device has pipeline statistics queries.
+void engineBenchmarkHiZ(Engine* engine) {
+  HiZ* hiz = &engine->hiz;
+  Indirect* indirect = &engine->indirect;
+  if (!indirect->supported) return;
+  if (!hiz->supported) {
+    printf("The Hi-Z benchmark needs --depth-prepass and a depth buffer that can be sampled\n");
+    return;
+  }
+
+  Vertex quadVertices[] = {
+      {{-1.0f, -1.0f, 0.0f}, {1.0f, 0.5f, 0.0f}, {0.0f, 0.0f}},
+      {{1.0f, -1.0f, 0.0f}, {1.0f, 0.5f, 0.0f}, {1.0f, 0.0f}},
+      {{1.0f, 1.0f, 0.0f}, {1.0f, 0.5f, 0.0f}, {1.0f, 1.0f}},
+      {{-1.0f, 1.0f, 0.0f}, {1.0f, 0.5f, 0.0f}, {0.0f, 1.0f}},
+  };
+  uint32_t quadIndices[] = {0, 1, 2, 2, 3, 0};
+  Mesh* mesh = engineCreateMesh(engine, quadVertices, 4, quadIndices, 6);
+  int savedEnabled = hiz->enabled;
+  double pixels = (double)engine->extent.width * engine->extent.height;
+
+  uint32_t instanceCounts[] = {10000, 100000, 1000000};
+  for (int c = 0; c < sizeof(instanceCounts) / sizeof(instanceCounts[0]); c++) {
+    uint32_t instanceCount = instanceCounts[c];
+    uint32_t field = instanceCount - HIZ_BENCH_WALL * HIZ_BENCH_WALL;
+    Instance* instances = malloc(sizeof(Instance) * instanceCount);
+    srand(1);
+    for (uint32_t n = 0; n < field; n++) {
+      Instance* instance = &instances[n];
+      instance->center[0] = rand() / (float)RAND_MAX * 2.4f - 1.2f;
+      instance->center[1] = rand() / (float)RAND_MAX * 2.4f - 1.2f;
+      instance->center[2] = rand() / (float)RAND_MAX * 0.6f + 0.3f;
+      instance->radius = 0.02f;
+    }
+    for (uint32_t n = 0; n < HIZ_BENCH_WALL * HIZ_BENCH_WALL; n++) {
+      Instance* instance = &instances[field + n];
+      instance->center[0] = -0.875f + 0.25f * (n % HIZ_BENCH_WALL);
+      instance->center[1] = -0.875f + 0.25f * (n / HIZ_BENCH_WALL);
+      instance->center[2] = 0.1f;
+      instance->radius = 0.1f;
+    }
+    engineSetIndirectScene(engine, mesh, instances, instanceCount);
+    free(instances);
+
+    for (int prepass = 0; prepass <= 1; prepass++) {
+      hiz->enabled = prepass;
+      // Enough frames for the pyramid to be built before timing.
+      for (int n = 0; n <= engine->framesInFlight; n++) engineDrawFrame(engine);
+      vkDeviceWaitIdle(engine->device);
+      hiz->fragmentInvocations = 0;
+      hiz->measuredFrames = 0;
+      hiz->statistics = 1;
+      double startTime = getTime();
+      for (int n = 0; n < HIZ_BENCH_FRAMES; n++) engineDrawFrame(engine);
+      vkDeviceWaitIdle(engine->device);
+      double elapsed = getTime() - startTime;
+      hiz->statistics = 0;
+      for (uint32_t slot = 0; slot < MAX_FRAMES_IN_FLIGHT; slot++) hizCollectSlot(engine, slot);
+
+      // The last frame submitted used the slot before currentFrame.
+      IndirectCounts* counts = &((IndirectCounts*)indirect->statsMemory.mapped)[(engine->currentFrame + engine->framesInFlight - 1) % engine->framesInFlight];
+      printf("HiZ %7u instances, pre-pass %-3s: %7u drawn, %7u frustum culled, %7u occluded, ", instanceCount, prepass ? "on" : "off", counts->visible, instanceCount - counts->visible - counts->occluded, counts->occluded);
+      if (hiz->measuredFrames) {
+        printf("overdraw %.2fx, ", hiz->fragmentInvocations / (double)hiz->measuredFrames / pixels);
+      } else {
+        printf("overdraw n/a, ");
+      }
+      printf("%.3f ms/frame\n", elapsed * 1000.0 / HIZ_BENCH_FRAMES);
+    }
+  }
+  hiz->enabled = savedEnabled;
+}
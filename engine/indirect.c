@@ -0,0 +1,433 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+#define INDIRECT_WORKGROUP_SIZE 64
+#define INDIRECT_BENCH_FRAMES 100
+
+// Matches the push constants of cull.comp.
+typedef struct cullConstants {
+  float planes[6][4];
+  uint32_t instanceCount;
+  uint32_t indexCount;
+  uint32_t compact;
+} CullConstants;
+
+// Gribb-Hartmann planes of a column-major view-projection with Vulkan's 0..1
+// clip depth, normalised so a plane's w is a signed distance.
+void engineFrustumPlanes(const float viewProjection[16], float planes[6][4]) {
+  for (int c = 0; c < 4; c++) {
+    float row0 = viewProjection[c * 4 + 0];
+    float row1 = viewProjection[c * 4 + 1];
+    float row2 = viewProjection[c * 4 + 2];
+    float row3 = viewProjection[c * 4 + 3];
+    planes[0][c] = row3 + row0;
+    planes[1][c] = row3 - row0;
+    planes[2][c] = row3 + row1;
+    planes[3][c] = row3 - row1;
+    planes[4][c] = row2;
+    planes[5][c] = row3 - row2;
+  }
+  for (int p = 0; p < 6; p++) {
+    float length = sqrtf(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+    for (int c = 0; c < 4; c++) planes[p][c] /= length;
+  }
+}
+
+// A GPU-side count needs every draw to fit one call.
+int indirectUseCount(Engine* engine) {
+  return engine->drawIndirectCount && engine->indirect.instanceCount <= engine->physicalDeviceProperties.limits.maxDrawIndirectCount;
+}
+
+void indirectCreateSetLayout(Engine* engine, uint32_t bindingCount, VkShaderStageFlags stages, VkDescriptorSetLayout* setLayout) {
+  VkDescriptorSetLayoutBinding bindings[3];
+  memset(bindings, 0, sizeof(bindings));
+  for (uint32_t n = 0; n < bindingCount; n++) {
+    bindings[n].binding = n;
+    bindings[n].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[n].descriptorCount = 1;
+    bindings[n].stageFlags = stages;
+  }
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo;
+  memset(&layoutInfo, 0, sizeof(VkDescriptorSetLayoutCreateInfo));
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = bindingCount;
+  layoutInfo.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(engine->device, &layoutInfo, NULL, setLayout) != VK_SUCCESS) {
+    printf("Failed to create indirect descriptor set layout!\n");
+    exit(1);
+  }
+}
+
+void indirectCreateLayout(Engine* engine, VkDescriptorSetLayout* setLayouts, uint32_t setLayoutCount, VkShaderStageFlags stages, uint32_t constantsSize, VkPipelineLayout* layout) {
+  VkPushConstantRange range;
+  range.stageFlags = stages;
+  range.offset = 0;
+  range.size = constantsSize;
+
+  VkPipelineLayoutCreateInfo layoutInfo;
+  memset(&layoutInfo, 0, sizeof(VkPipelineLayoutCreateInfo));
+  layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layoutInfo.setLayoutCount = setLayoutCount;
+  layoutInfo.pSetLayouts = setLayouts;
+  layoutInfo.pushConstantRangeCount = 1;
+  layoutInfo.pPushConstantRanges = &range;
+  if (vkCreatePipelineLayout(engine->device, &layoutInfo, NULL, layout) != VK_SUCCESS) {
+    printf("Failed to create indirect pipeline layout!\n");
+    exit(1);
+  }
+}
+
+void engineCreateIndirect(Engine* engine) {
+  Indirect* indirect = &engine->indirect;
+  for (int n = 0; n < 16; n++) indirect->viewProjection[n] = n % 5 == 0 ? 1.0f : 0.0f;
+  // Each draw names its instance through firstInstance.
+  indirect->supported = engine->enabledFeatures.drawIndirectFirstInstance;
+  if (!indirect->supported) {
+    printf("Indirect drawing disabled: drawIndirectFirstInstance is not supported\n");
+    return;
+  }
+
+  // Set 1 is the Hi-Z pyramid and the occlusion test's parameters.
+  indirectCreateSetLayout(engine, 3, VK_SHADER_STAGE_COMPUTE_BIT, &indirect->cullSetLayout);
+  VkDescriptorSetLayout cullSetLayouts[2] = {indirect->cullSetLayout, engine->hiz.cullSetLayout};
+  indirectCreateLayout(engine, cullSetLayouts, 2, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(CullConstants), &indirect->cullLayout);
+  indirect->cullPipeline = computePipelineCreate(engine, "shaders/cull.comp.spv", indirect->cullLayout);
+
+  indirectCreateSetLayout(engine, 1, VK_SHADER_STAGE_VERTEX_BIT, &indirect->drawSetLayout);
+  indirectCreateLayout(engine, &indirect->drawSetLayout, 1, VK_SHADER_STAGE_VERTEX_BIT, sizeof(indirect->viewProjection), &indirect->drawLayout);
+  indirect->drawPipeline = meshPipelineCreateWithShaders(engine, "shaders/indirect.vert.spv", "shaders/triangle.frag.spv", indirect->drawLayout);
+  if (engine->hiz.supported) {
+    PipelineState state = pipelineDefaultState();
+    state.depthOnly = 1;
+    indirect->prepassPipeline = pipelineCreateWithState(engine, PIPELINE_MESH, "shaders/indirect.vert.spv", NULL, &state, indirect->drawLayout);
+    state = pipelineDefaultState();
+    state.depthWrite = 0;
+    state.depthCompare = VK_COMPARE_OP_EQUAL;
+    indirect->equalPipeline = pipelineCreateWithState(engine, PIPELINE_MESH, "shaders/indirect.vert.spv", "shaders/triangle.frag.spv", &state, indirect->drawLayout);
+  }
+
+  VkDescriptorPoolSize poolSize;
+  poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  poolSize.descriptorCount = 4 * MAX_FRAMES_IN_FLIGHT;
+  VkDescriptorPoolCreateInfo poolInfo;
+  memset(&poolInfo, 0, sizeof(VkDescriptorPoolCreateInfo));
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = 2 * MAX_FRAMES_IN_FLIGHT;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  if (vkCreateDescriptorPool(engine->device, &poolInfo, NULL, &indirect->descriptorPool) != VK_SUCCESS) {
+    printf("Failed to create indirect descriptor pool!\n");
+    exit(1);
+  }
+
+  VkDescriptorSetLayout layouts[2 * MAX_FRAMES_IN_FLIGHT];
+  VkDescriptorSet sets[2 * MAX_FRAMES_IN_FLIGHT];
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
+    layouts[n] = indirect->cullSetLayout;
+    layouts[MAX_FRAMES_IN_FLIGHT + n] = indirect->drawSetLayout;
+  }
+  VkDescriptorSetAllocateInfo allocInfo;
+  memset(&allocInfo, 0, sizeof(VkDescriptorSetAllocateInfo));
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = indirect->descriptorPool;
+  allocInfo.descriptorSetCount = 2 * MAX_FRAMES_IN_FLIGHT;
+  allocInfo.pSetLayouts = layouts;
+  if (vkAllocateDescriptorSets(engine->device, &allocInfo, sets) != VK_SUCCESS) {
+    printf("Failed to allocate indirect descriptor sets!\n");
+    exit(1);
+  }
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
+    indirect->cullSets[n] = sets[n];
+    indirect->drawSets[n] = sets[MAX_FRAMES_IN_FLIGHT + n];
+    engineCreateBuffer(engine, sizeof(IndirectCounts), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indirect->countBuffers[n], &indirect->countMemory[n]);
+  }
+  // One set of counts per frame in flight, read back once the frame completes.
+  engineCreateBuffer(engine, sizeof(IndirectCounts) * MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &indirect->statsBuffer, &indirect->statsMemory);
+
+  indirect->async = engine->computeFamilyIndex != engine->queueFamilyIndex;
+  if (!indirect->async) return;
+  VkCommandPoolCreateInfo commandPoolInfo;
+  memset(&commandPoolInfo, 0, sizeof(VkCommandPoolCreateInfo));
+  commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  commandPoolInfo.queueFamilyIndex = engine->computeFamilyIndex;
+  if (vkCreateCommandPool(engine->device, &commandPoolInfo, NULL, &indirect->computePool) != VK_SUCCESS) {
+    printf("Failed to create cull command pool!\n");
+    exit(1);
+  }
+  VkCommandBufferAllocateInfo commandBufferInfo;
+  memset(&commandBufferInfo, 0, sizeof(VkCommandBufferAllocateInfo));
+  commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  commandBufferInfo.commandPool = indirect->computePool;
+  commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  commandBufferInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+  if (vkAllocateCommandBuffers(engine->device, &commandBufferInfo, indirect->computeCommandBuffers) != VK_SUCCESS) {
+    printf("Failed to allocate cull command buffers!\n");
+    exit(1);
+  }
+}
+
+void indirectDestroyScene(Engine* engine) {
+  Indirect* indirect = &engine->indirect;
+  if (indirect->instanceCount == 0) return;
+  vkDestroyBuffer(engine->device, indirect->instanceBuffer, NULL);
+  engineFree(engine, &indirect->instanceMemory);
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
+    vkDestroyBuffer(engine->device, indirect->drawBuffers[n], NULL);
+    engineFree(engine, &indirect->drawMemory[n]);
+  }
+  indirect->instanceCount = 0;
+  indirect->visibleCount = 0;
+  indirect->occludedCount = 0;
+}
+
+void engineDestroyIndirect(Engine* engine) {
+  Indirect* indirect = &engine->indirect;
+  indirectDestroyScene(engine);
+  if (indirect->mesh) engineDestroyMesh(engine, indirect->mesh);
+  if (!indirect->supported) return;
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
+    vkDestroyBuffer(engine->device, indirect->countBuffers[n], NULL);
+    engineFree(engine, &indirect->countMemory[n]);
+  }
+  if (indirect->async) vkDestroyCommandPool(engine->device, indirect->computePool, NULL);
+  vkDestroyBuffer(engine->device, indirect->statsBuffer, NULL);
+  engineFree(engine, &indirect->statsMemory);
+  vkDestroyDescriptorPool(engine->device, indirect->descriptorPool, NULL);
+  vkDestroyPipeline(engine->device, indirect->cullPipeline, NULL);
+  vkDestroyPipelineLayout(engine->device, indirect->cullLayout, NULL);
+  vkDestroyDescriptorSetLayout(engine->device, indirect->cullSetLayout, NULL);
+  vkDestroyPipeline(engine->device, indirect->drawPipeline, NULL);
+  vkDestroyPipeline(engine->device, indirect->prepassPipeline, NULL);
+  vkDestroyPipeline(engine->device, indirect->equalPipeline, NULL);
+  vkDestroyPipelineLayout(engine->device, indirect->drawLayout, NULL);
+  vkDestroyDescriptorSetLayout(engine->device, indirect->drawSetLayout, NULL);
+}
+
+// Replace the GPU-culled scene with instanceCount copies of mesh, each scaled
+// and placed by its bounding sphere. The engine takes ownership of the mesh.
+// Waits for the device, so this is for scene loads rather than every frame.
+void engineSetIndirectScene(Engine* engine, Mesh* mesh, Instance* instances, uint32_t instanceCount) {
+  Indirect* indirect = &engine->indirect;
+  vkDeviceWaitIdle(engine->device);
+  indirectDestroyScene(engine);
+  if (indirect->mesh && indirect->mesh != mesh) engineDestroyMesh(engine, indirect->mesh);
+  indirect->mesh = mesh;
+  // The pyramid's occluders may be gone.
+  engine->hiz.valid = 0;
+  if (!indirect->supported || instanceCount == 0) return;
+
+  VkDeviceSize instanceSize = sizeof(Instance) * instanceCount;
+  VkDeviceSize drawSize = sizeof(VkDrawIndexedIndirectCommand) * instanceCount;
+  engineCreateBuffer(engine, instanceSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indirect->instanceBuffer, &indirect->instanceMemory);
+  engineUploadBuffer(engine, indirect->instanceBuffer, 0, instances, instanceSize);
+  indirect->instanceCount = instanceCount;
+
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
+    engineCreateBuffer(engine, drawSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indirect->drawBuffers[n], &indirect->drawMemory[n]);
+    VkDescriptorBufferInfo bufferInfos[3];
+    bufferInfos[0] = (VkDescriptorBufferInfo){indirect->instanceBuffer, 0, VK_WHOLE_SIZE};
+    bufferInfos[1] = (VkDescriptorBufferInfo){indirect->drawBuffers[n], 0, VK_WHOLE_SIZE};
+    bufferInfos[2] = (VkDescriptorBufferInfo){indirect->countBuffers[n], 0, VK_WHOLE_SIZE};
+    VkWriteDescriptorSet writes[2];
+    memset(writes, 0, sizeof(writes));
+    writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[0].dstSet = indirect->cullSets[n];
+    writes[0].dstBinding = 0;
+    writes[0].descriptorCount = 3;
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[0].pBufferInfo = bufferInfos;
+    writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[1].dstSet = indirect->drawSets[n];
+    writes[1].dstBinding = 0;
+    writes[1].descriptorCount = 1;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[1].pBufferInfo = bufferInfos;
+    vkUpdateDescriptorSets(engine->device, 2, writes, 0, NULL);
+  }
+}
+
+// Called once the current frame's previous submission has completed: the
+// counts it copied out are the last ones the GPU finished.
+void engineIndirectCollect(Engine* engine) {
+  Indirect* indirect = &engine->indirect;
+  if (indirect->instanceCount == 0) return;
+  IndirectCounts* counts = &((IndirectCounts*)indirect->statsMemory.mapped)[engine->currentFrame];
+  indirect->visibleCount = counts->visible;
+  indirect->occludedCount = counts->occluded;
+}
+
+// Record the culling dispatch, outside the render pass. Each frame in flight
+// has its own draw and count buffers, which its last submission has freed, so
+// nothing waits for the previous frame. With a separate compute family the
+// dispatch goes to the compute queue straight away, overlapping the frame
+// still drawing, and this returns the compute timeline value for the frame's
+// submit to wait for; otherwise it's recorded into commandBuffer and this
+// returns 0.
+uint64_t engineIndirectCull(Engine* engine, VkCommandBuffer commandBuffer) {
+  Indirect* indirect = &engine->indirect;
+  if (indirect->instanceCount == 0) return 0;
+  VkBuffer countBuffer = indirect->countBuffers[engine->currentFrame];
+
+  if (indirect->async) {
+    commandBuffer = indirect->computeCommandBuffers[engine->currentFrame];
+    vkResetCommandBuffer(commandBuffer, 0);
+    VkCommandBufferBeginInfo beginInfo;
+    memset(&beginInfo, 0, sizeof(VkCommandBufferBeginInfo));
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+      printf("Begin cull command buffer failed!\n");
+      exit(1);
+    }
+  }
+  vkCmdFillBuffer(commandBuffer, countBuffer, 0, sizeof(IndirectCounts), 0);
+
+  VkMemoryBarrier barrier;
+  memset(&barrier, 0, sizeof(VkMemoryBarrier));
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+
+  CullConstants constants;
+  engineFrustumPlanes(indirect->viewProjection, constants.planes);
+  constants.instanceCount = indirect->instanceCount;
+  constants.indexCount = indirect->mesh->indexCount;
+  constants.compact = indirectUseCount(engine);
+  int occlusion = engineHiZPrepareCull(engine);
+  VkDescriptorSet sets[2] = {indirect->cullSets[engine->currentFrame], engine->hiz.cullSets[engine->currentFrame]};
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, indirect->cullPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, indirect->cullLayout, 0, 2, sets, 0, NULL);
+  vkCmdPushConstants(commandBuffer, indirect->cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants), &constants);
+  vkCmdDispatch(commandBuffer, (indirect->instanceCount + INDIRECT_WORKGROUP_SIZE - 1) / INDIRECT_WORKGROUP_SIZE, 1, 1);
+
+  // Across queues the timeline wait makes the commands visible to the draws.
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | (indirect->async ? 0 : VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | (indirect->async ? 0 : VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT), 0, 1, &barrier, 0, NULL, 0, NULL);
+
+  VkBufferCopy region;
+  region.srcOffset = 0;
+  region.dstOffset = sizeof(IndirectCounts) * engine->currentFrame;
+  region.size = sizeof(IndirectCounts);
+  vkCmdCopyBuffer(commandBuffer, countBuffer, indirect->statsBuffer, 1, &region);
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+  if (!indirect->async) return 0;
+
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    printf("Failed to record cull command buffer!\n");
+    exit(1);
+  }
+  // The instances may have just been uploaded. Whatever else is pending is
+  // then reached by the frame through the compute timeline.
+  engineFlushUploads(engine);
+  SubmitWaits waits;
+  memset(&waits, 0, sizeof(SubmitWaits));
+  engineSubmitWaitTimeline(&waits, engine->transferTimeline, engineTakeUploadValue(engine), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+  // The pyramid is built on the graphics queue by the previous frame, so
+  // testing occlusion gives up overlapping with it.
+  if (occlusion) engineSubmitWaitTimeline(&waits, engine->graphicsTimeline, engine->graphicsTimeline->submitted, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  return engineTimelineSubmit(engine, engine->computeTimeline, &waits, commandBuffer, VK_NULL_HANDLE);
+}
+
+// Without a GPU-side count every instance has a command and culled ones draw
+// nothing; devices without multiDrawIndirect have a maxDrawIndirectCount of 1
+// and fall back to a call per instance.
+void indirectRecordDraws(Engine* engine, VkCommandBuffer commandBuffer, VkPipeline pipeline) {
+  Indirect* indirect = &engine->indirect;
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, indirect->drawLayout, 0, 1, &indirect->drawSets[engine->currentFrame], 0, NULL);
+  vkCmdPushConstants(commandBuffer, indirect->drawLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(indirect->viewProjection), indirect->viewProjection);
+  VkDeviceSize offset = 0;
+  vkCmdBindVertexBuffers(commandBuffer, 0, 1, &indirect->mesh->vertexBuffer, &offset);
+  vkCmdBindIndexBuffer(commandBuffer, indirect->mesh->indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+  VkBuffer drawBuffer = indirect->drawBuffers[engine->currentFrame];
+  uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+  if (indirectUseCount(engine)) {
+    engine->cmdDrawIndexedIndirectCount(commandBuffer, drawBuffer, 0, indirect->countBuffers[engine->currentFrame], 0, indirect->instanceCount, stride);
+    return;
+  }
+  uint32_t batch = engine->physicalDeviceProperties.limits.maxDrawIndirectCount;
+  for (uint32_t first = 0; first < indirect->instanceCount; first += batch) {
+    uint32_t count = indirect->instanceCount - first < batch ? indirect->instanceCount - first : batch;
+    vkCmdDrawIndexedIndirect(commandBuffer, drawBuffer, (VkDeviceSize)first * stride, count, stride);
+  }
+}
+
+// Record the culled draws inside the render pass. After a depth pre-pass
+// they only shade the fragments it left in front.
+void engineIndirectDraw(Engine* engine, VkCommandBuffer commandBuffer) {
+  Indirect* indirect = &engine->indirect;
+  if (indirect->instanceCount == 0) return;
+  indirectRecordDraws(engine, commandBuffer, engine->hiz.active ? indirect->equalPipeline : indirect->drawPipeline);
+}
+
+// The same draws' depth, inside the pre-pass.
+void engineIndirectDrawDepth(Engine* engine, VkCommandBuffer commandBuffer) {
+  Indirect* indirect = &engine->indirect;
+  if (indirect->instanceCount == 0) return;
+  indirectRecordDraws(engine, commandBuffer, indirect->prepassPipeline);
+}
+
+// Render 10k to 1M instances scattered around the view volume, about a
+// quarter of them inside it, and compare the GPU's visible count with a CPU
+// cull of the same spheres.
+void engineBenchmarkIndirect(Engine* engine) {
+  Indirect* indirect = &engine->indirect;
+  if (!indirect->supported) return;
+
+  Vertex quadVertices[] = {
+      {{-1.0f, -1.0f, 0.0f}, {1.0f, 0.5f, 0.0f}, {0.0f, 0.0f}},
+      {{1.0f, -1.0f, 0.0f}, {1.0f, 0.5f, 0.0f}, {1.0f, 0.0f}},
+      {{1.0f, 1.0f, 0.0f}, {1.0f, 0.5f, 0.0f}, {1.0f, 1.0f}},
+      {{-1.0f, 1.0f, 0.0f}, {1.0f, 0.5f, 0.0f}, {0.0f, 1.0f}},
+  };
+  uint32_t quadIndices[] = {0, 1, 2, 2, 3, 0};
+  Mesh* mesh = engineCreateMesh(engine, quadVertices, 4, quadIndices, 6);
+  float planes[6][4];
+  engineFrustumPlanes(indirect->viewProjection, planes);
+
+  uint32_t instanceCounts[] = {10000, 100000, 1000000};
+  for (int c = 0; c < sizeof(instanceCounts) / sizeof(instanceCounts[0]); c++) {
+    uint32_t instanceCount = instanceCounts[c];
+    Instance* instances = malloc(sizeof(Instance) * instanceCount);
+    uint32_t expected = 0;
+    srand(1);
+    for (uint32_t n = 0; n < instanceCount; n++) {
+      Instance* instance = &instances[n];
+      instance->center[0] = rand() / (float)RAND_MAX * 4.0f - 2.0f;
+      instance->center[1] = rand() / (float)RAND_MAX * 4.0f - 2.0f;
+      instance->center[2] = rand() / (float)RAND_MAX * 2.0f - 0.5f;
+      instance->radius = 0.002f;
+      int visible = 1;
+      for (int p = 0; p < 6; p++) {
+        if (planes[p][0] * instance->center[0] + planes[p][1] * instance->center[1] + planes[p][2] * instance->center[2] + planes[p][3] < -instance->radius) visible = 0;
+      }
+      expected += visible;
+    }
+    engineSetIndirectScene(engine, mesh, instances, instanceCount);
+    free(instances);
+
+    for (int n = 0; n < engine->framesInFlight; n++) engineDrawFrame(engine);
+    vkDeviceWaitIdle(engine->device);
+    double startTime = getTime();
+    for (int n = 0; n < INDIRECT_BENCH_FRAMES; n++) engineDrawFrame(engine);
+    vkDeviceWaitIdle(engine->device);
+    double elapsed = getTime() - startTime;
+
+    // The last frame submitted used the slot before currentFrame.
+    uint32_t visible = ((IndirectCounts*)indirect->statsMemory.mapped)[(engine->currentFrame + engine->framesInFlight - 1) % engine->framesInFlight].visible;
+    const char* path = indirectUseCount(engine) ? "draw count" : engine->enabledFeatures.multiDrawIndirect ? "multi-draw" : "per draw";
+    printf("Indirect %7u instances: %7u visible, %7u culled (cpu %u visible), %.3f ms/frame (%s)\n", instanceCount, visible, instanceCount - visible, expected, elapsed * 1000.0 / INDIRECT_BENCH_FRAMES, path);
+  }
+}
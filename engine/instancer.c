@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+#define INSTANCE_BATCH_MIN_CAPACITY 64
+
+void engineCreateInstancer(Engine* engine) {
+  Instancer* instancer = &engine->instancer;
+  engineCreateBuffer(engine, (VkDeviceSize)INSTANCE_RING_SIZE * MAX_FRAMES_IN_FLIGHT, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &instancer->buffer, &instancer->memory);
+  instancer->mapped = instancer->memory.mapped;
+  instancer->pipeline = instancedPipelineCreate(engine);
+}
+
+void engineDestroyInstancer(Engine* engine) {
+  Instancer* instancer = &engine->instancer;
+  if (instancer->frames > 0) {
+    printf("Instancing: %lu objects in %lu draws over %lu frames (%.1f objects per draw), %lu dropped\n", instancer->objects, instancer->draws, instancer->frames, (double)instancer->objects / (instancer->draws ? instancer->draws : 1), instancer->dropped);
+  }
+  for (uint32_t n = 0; n < instancer->batchCount; n++) free(instancer->batches[n].transforms);
+  vkDestroyPipeline(engine->device, instancer->pipeline, NULL);
+  vkDestroyBuffer(engine->device, instancer->buffer, NULL);
+  engineFree(engine, &instancer->memory);
+}
+
+InstanceBatch* instancerFindBatch(Instancer* instancer, VkPipeline pipeline, Mesh* mesh) {
+  // Callers usually submit runs of the same object.
+  if (instancer->lastBatch < instancer->batchCount) {
+    InstanceBatch* batch = &instancer->batches[instancer->lastBatch];
+    if (batch->pipeline == pipeline && batch->mesh == mesh) return batch;
+  }
+  for (uint32_t n = 0; n < instancer->batchCount; n++) {
+    InstanceBatch* batch = &instancer->batches[n];
+    if (batch->pipeline == pipeline && batch->mesh == mesh) {
+      instancer->lastBatch = n;
+      return batch;
+    }
+  }
+  if (instancer->batchCount == MAX_INSTANCE_BATCHES) return NULL;
+  InstanceBatch* batch = &instancer->batches[instancer->batchCount];
+  memset(batch, 0, sizeof(InstanceBatch));
+  batch->pipeline = pipeline;
+  batch->mesh = mesh;
+  instancer->lastBatch = instancer->batchCount++;
+  return batch;
+}
+
+// Queue one instance of mesh for the next frame, drawn with pipeline or with
+// instancedPipelineCreate's pipeline if that is VK_NULL_HANDLE. Submissions
+// sharing a pipeline and mesh become a single instanced draw. Instances only
+// last one frame; the mesh and pipeline stay the caller's and must outlive
+// the frames that draw them.
+void engineDrawInstance(Engine* engine, VkPipeline pipeline, Mesh* mesh, mat4 transform) {
+  Instancer* instancer = &engine->instancer;
+  if (!pipeline) pipeline = instancer->pipeline;
+  InstanceBatch* batch = instancerFindBatch(instancer, pipeline, mesh);
+  if (!batch) {
+    instancer->dropped++;
+    return;
+  }
+  if (batch->count == batch->capacity) {
+    batch->capacity = batch->capacity ? batch->capacity * 2 : INSTANCE_BATCH_MIN_CAPACITY;
+    batch->transforms = realloc(batch->transforms, sizeof(mat4) * batch->capacity);
+  }
+  memcpy(batch->transforms[batch->count++], transform, sizeof(mat4));
+}
+
+// Copy the frame's submissions into its slice of the ring, batch after batch.
+// Called once the current frame's last submission has completed, so the
+// slice is free.
+// Batches nothing was submitted to are dropped from the table.
+void engineInstancerFlush(Engine* engine) {
+  Instancer* instancer = &engine->instancer;
+  VkDeviceSize base = (VkDeviceSize)engine->currentFrame * INSTANCE_RING_SIZE;
+  VkDeviceSize used = 0;
+  uint32_t live = 0;
+  instancer->frameDraws = 0;
+  instancer->frameObjects = 0;
+  for (uint32_t n = 0; n < instancer->batchCount; n++) {
+    InstanceBatch batch = instancer->batches[n];
+    if (batch.count == 0) {
+      free(batch.transforms);
+      continue;
+    }
+    uint32_t count = batch.count;
+    if (used + sizeof(mat4) * count > INSTANCE_RING_SIZE) {
+      count = (INSTANCE_RING_SIZE - used) / sizeof(mat4);
+      instancer->dropped += batch.count - count;
+    }
+    memcpy(instancer->mapped + base + used, batch.transforms, sizeof(mat4) * count);
+    batch.offset = base + used;
+    batch.flushed = count;
+    batch.count = 0;
+    used += sizeof(mat4) * count;
+    if (count) instancer->frameDraws++;
+    instancer->frameObjects += count;
+    instancer->batches[live++] = batch;
+  }
+  instancer->batchCount = live;
+  instancer->lastBatch = 0;
+  if (instancer->frameObjects == 0) return;
+  instancer->draws += instancer->frameDraws;
+  instancer->objects += instancer->frameObjects;
+  instancer->frames++;
+}
+
+// One instanced draw per batch of the last flush, reading the transforms as a
+// per-instance vertex stream from binding 1.
+void engineInstancerDraw(Engine* engine, VkCommandBuffer commandBuffer) {
+  Instancer* instancer = &engine->instancer;
+  VkPipeline bound = VK_NULL_HANDLE;
+  for (uint32_t n = 0; n < instancer->batchCount; n++) {
+    InstanceBatch* batch = &instancer->batches[n];
+    if (batch->flushed == 0) continue;
+    if (batch->pipeline != bound) {
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, batch->pipeline);
+      bound = batch->pipeline;
+    }
+    VkBuffer buffers[2] = {batch->mesh->vertexBuffer, instancer->buffer};
+    VkDeviceSize offsets[2] = {0, batch->offset};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 2, buffers, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, batch->mesh->indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    vkCmdDrawIndexed(commandBuffer, batch->mesh->indexCount, batch->flushed, 0, 0, 0);
+  }
+}
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+// The buffers are filled through the staging ring; the copies are submitted
+// with the next frame at the latest, which waits for them before vertex input.
+Mesh* engineCreateMesh(Engine* engine, Vertex* vertices, uint32_t vertexCount, uint32_t* indices, uint32_t indexCount) {
+  Mesh* mesh = calloc(1, sizeof(Mesh));
+  mesh->id = engine->nextMeshId++;
+  mesh->vertexCount = vertexCount;
+  mesh->indexCount = indexCount;
+
+  VkDeviceSize vertexSize = sizeof(Vertex) * vertexCount;
+  VkDeviceSize indexSize = sizeof(uint32_t) * indexCount;
+  engineCreateBuffer(engine, vertexSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mesh->vertexBuffer, &mesh->vertexMemory);
+  engineCreateBuffer(engine, indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mesh->indexBuffer, &mesh->indexMemory);
+  engineUploadBuffer(engine, mesh->vertexBuffer, 0, vertices, vertexSize);
+  engineUploadBuffer(engine, mesh->indexBuffer, 0, indices, indexSize);
+  return mesh;
+}
+
+// The caller must make sure no frame in flight still draws the mesh.
+void engineDestroyMesh(Engine* engine, Mesh* mesh) {
+  vkDestroyBuffer(engine->device, mesh->vertexBuffer, NULL);
+  engineFree(engine, &mesh->vertexMemory);
+  vkDestroyBuffer(engine->device, mesh->indexBuffer, NULL);
+  engineFree(engine, &mesh->indexMemory);
+  free(mesh);
+}
+
+// Time creating and uploading many small meshes and a few large ones, from
+// the first call to the last copy completing on the GPU.
+void engineBenchmarkUploads(Engine* engine) {
+  struct {
+    const char* name;
+    uint32_t meshCount;
+    uint32_t vertexCount;
+  } cases[] = {{"small", 10000, 24}, {"large", 8, 1 << 20}};
+
+  for (int c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    uint32_t vertexCount = cases[c].vertexCount;
+    uint32_t indexCount = vertexCount / 2 * 3;
+    Vertex* vertices = malloc(sizeof(Vertex) * vertexCount);
+    uint32_t* indices = malloc(sizeof(uint32_t) * indexCount);
+    for (uint32_t n = 0; n < vertexCount; n++) {
+      vertices[n] = (Vertex){{(float)(n % 64), (float)(n / 64), 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 0.0f}};
+    }
+    for (uint32_t n = 0; n < indexCount; n++) indices[n] = n % vertexCount;
+
+    Mesh** meshes = malloc(sizeof(Mesh*) * cases[c].meshCount);
+    uint64_t bytesBefore = engine->uploader.bytesUploaded;
+    uint64_t batchesBefore = engine->uploader.batchCount;
+    double startTime = getTime();
+    for (uint32_t n = 0; n < cases[c].meshCount; n++) {
+      meshes[n] = engineCreateMesh(engine, vertices, vertexCount, indices, indexCount);
+    }
+    engineWaitUploads(engine);
+    double elapsed = getTime() - startTime;
+    double megabytes = (engine->uploader.bytesUploaded - bytesBefore) / (1024.0 * 1024.0);
+    printf("Upload %s: %u meshes, %.1f MB in %.3f s, %lu batches (%.1f MB/s)\n", cases[c].name, cases[c].meshCount, megabytes, elapsed, engine->uploader.batchCount - batchesBefore, megabytes / elapsed);
+
+    for (uint32_t n = 0; n < cases[c].meshCount; n++) engineDestroyMesh(engine, meshes[n]);
+    free(meshes);
+    free(indices);
+    free(vertices);
+  }
+}
@@ -0,0 +1,221 @@
+#include <assimp/cimport.h>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+#define MODEL_CACHE_MAGIC 0x4c444f4d  // "MODL"
+#define MODEL_CACHE_VERSION 2
+
+// Cache file layout: this header, then vertexCount Vertex structs, then
+// indexCount uint32_t indices, ready to be copied into the staging ring.
+typedef struct modelCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceMtime;
+  uint64_t sourceSize;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+} ModelCacheHeader;
+
+// Map a cache file and check it still matches the source.
+int modelCacheLoad(ModelData* model, const char* cachePath, struct stat* source) {
+  int fd = open(cachePath, O_RDONLY);
+  if (fd < 0) return 0;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(ModelCacheHeader)) {
+    close(fd);
+    return 0;
+  }
+  void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return 0;
+
+  ModelCacheHeader* header = mapping;
+  uint64_t mtime = source->st_mtim.tv_sec * 1000000000ULL + source->st_mtim.tv_nsec;
+  size_t expected = sizeof(ModelCacheHeader) + sizeof(Vertex) * (size_t)header->vertexCount + sizeof(uint32_t) * (size_t)header->indexCount;
+  if (header->magic != MODEL_CACHE_MAGIC || header->version != MODEL_CACHE_VERSION || header->sourceMtime != mtime || header->sourceSize != source->st_size || expected != st.st_size) {
+    munmap(mapping, st.st_size);
+    return 0;
+  }
+
+  model->mapping = mapping;
+  model->mappingSize = st.st_size;
+  model->vertexCount = header->vertexCount;
+  model->indexCount = header->indexCount;
+  model->vertices = (Vertex*)(header + 1);
+  model->indices = (uint32_t*)(model->vertices + header->vertexCount);
+  return 1;
+}
+
+// Same write-then-rename as the pipeline cache, so a concurrent reader never
+// maps a half-written file.
+void modelCacheWrite(ModelData* model, const char* cachePath, struct stat* source) {
+  ModelCacheHeader header;
+  memset(&header, 0, sizeof(ModelCacheHeader));
+  header.magic = MODEL_CACHE_MAGIC;
+  header.version = MODEL_CACHE_VERSION;
+  header.sourceMtime = source->st_mtim.tv_sec * 1000000000ULL + source->st_mtim.tv_nsec;
+  header.sourceSize = source->st_size;
+  header.vertexCount = model->vertexCount;
+  header.indexCount = model->indexCount;
+
+  char tmpPath[512];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", cachePath);
+  int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("Failed to write model cache %s\n", tmpPath);
+    return;
+  }
+  size_t vertexSize = sizeof(Vertex) * (size_t)model->vertexCount;
+  size_t indexSize = sizeof(uint32_t) * (size_t)model->indexCount;
+  int ok = write(fd, &header, sizeof(header)) == sizeof(header) && write(fd, model->vertices, vertexSize) == vertexSize && write(fd, model->indices, indexSize) == indexSize && fsync(fd) == 0;
+  close(fd);
+  if (!ok || rename(tmpPath, cachePath) != 0) {
+    printf("Failed to write model cache %s\n", cachePath);
+    unlink(tmpPath);
+  }
+}
+
+// Import with assimp and merge every triangle mesh of the scene into one
+// interleaved vertex array. Vertex colours fall back to the normal, then white.
+int modelParse(ModelData* model) {
+  const struct aiScene* scene = aiImportFile(model->path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_ImproveCacheLocality | aiProcess_SortByPType);
+  if (!scene) {
+    printf("Failed to import %s: %s\n", model->path, aiGetErrorString());
+    return 0;
+  }
+
+  uint64_t vertexCount = 0, indexCount = 0;
+  for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
+    struct aiMesh* mesh = scene->mMeshes[m];
+    for (uint32_t f = 0; f < mesh->mNumFaces; f++) {
+      if (mesh->mFaces[f].mNumIndices == 3) indexCount += 3;
+    }
+    vertexCount += mesh->mNumVertices;
+  }
+  if (indexCount == 0 || vertexCount > UINT32_MAX) {
+    printf("No usable triangles in %s\n", model->path);
+    aiReleaseImport(scene);
+    return 0;
+  }
+
+  model->vertices = malloc(sizeof(Vertex) * vertexCount);
+  model->indices = malloc(sizeof(uint32_t) * indexCount);
+  for (uint32_t m = 0; m < scene->mNumMeshes; m++) {
+    struct aiMesh* mesh = scene->mMeshes[m];
+    uint32_t base = model->vertexCount;
+    for (uint32_t v = 0; v < mesh->mNumVertices; v++) {
+      Vertex* vertex = &model->vertices[base + v];
+      vertex->position[0] = mesh->mVertices[v].x;
+      vertex->position[1] = mesh->mVertices[v].y;
+      vertex->position[2] = mesh->mVertices[v].z;
+      if (mesh->mColors[0]) {
+        vertex->color[0] = mesh->mColors[0][v].r;
+        vertex->color[1] = mesh->mColors[0][v].g;
+        vertex->color[2] = mesh->mColors[0][v].b;
+      } else if (mesh->mNormals) {
+        vertex->color[0] = mesh->mNormals[v].x * 0.5f + 0.5f;
+        vertex->color[1] = mesh->mNormals[v].y * 0.5f + 0.5f;
+        vertex->color[2] = mesh->mNormals[v].z * 0.5f + 0.5f;
+      } else {
+        vertex->color[0] = vertex->color[1] = vertex->color[2] = 1.0f;
+      }
+      vertex->uv[0] = mesh->mTextureCoords[0] ? mesh->mTextureCoords[0][v].x : 0.0f;
+      vertex->uv[1] = mesh->mTextureCoords[0] ? mesh->mTextureCoords[0][v].y : 0.0f;
+    }
+    for (uint32_t f = 0; f < mesh->mNumFaces; f++) {
+      struct aiFace* face = &mesh->mFaces[f];
+      if (face->mNumIndices != 3) continue;
+      for (int i = 0; i < 3; i++) model->indices[model->indexCount++] = base + face->mIndices[i];
+    }
+    model->vertexCount += mesh->mNumVertices;
+  }
+  aiReleaseImport(scene);
+  return 1;
+}
+
+void* modelLoaderThread(void* data) {
+  ModelLoader* loader = data;
+  uint32_t index;
+  while ((index = atomic_fetch_add(&loader->next, 1)) < loader->count) {
+    ModelData* model = &loader->models[index];
+    double startTime = getTime();
+    struct stat source;
+    if (stat(model->path, &source) != 0) {
+      printf("Failed to open model %s\n", model->path);
+      continue;
+    }
+
+    char cachePath[512];
+    uint64_t mtime = source.st_mtim.tv_sec * 1000000000ULL + source.st_mtim.tv_nsec;
+    snprintf(cachePath, sizeof(cachePath), MODEL_CACHE_DIR "/%016lx-%016lx.bin", hashPath(model->path), mtime);
+    if (modelCacheLoad(model, cachePath, &source)) {
+      model->cacheHit = 1;
+    } else if (modelParse(model)) {
+      modelCacheWrite(model, cachePath, &source);
+    }
+    model->loadTime = getTime() - startTime;
+  }
+  return NULL;
+}
+
+// Import the models on a pool of worker threads, one per core, then upload
+// each as a single mesh from the main thread. meshes[n] is NULL for models that
+// failed to load. Returns the number of meshes created.
+uint32_t engineLoadModels(Engine* engine, char** paths, uint32_t count, Mesh** meshes) {
+  if (count == 0) return 0;
+  mkdir(MODEL_CACHE_DIR, 0755);
+
+  ModelLoader loader;
+  memset(&loader, 0, sizeof(ModelLoader));
+  loader.models = calloc(count, sizeof(ModelData));
+  loader.count = count;
+  atomic_init(&loader.next, 0);
+  for (uint32_t n = 0; n < count; n++) loader.models[n].path = paths[n];
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t threadCount = cores < 1 ? 1 : cores < count ? cores : count;
+  pthread_t threads[threadCount];
+  double startTime = getTime();
+  for (uint32_t n = 0; n < threadCount; n++) {
+    if (pthread_create(&threads[n], NULL, modelLoaderThread, &loader) != 0) {
+      printf("Failed to create model loader thread!\n");
+      exit(1);
+    }
+  }
+  for (uint32_t n = 0; n < threadCount; n++) pthread_join(threads[n], NULL);
+  double loadTime = getTime() - startTime;
+
+  uint32_t loaded = 0;
+  double parseTime = 0.0, cacheTime = 0.0;
+  uint32_t parsed = 0, cached = 0;
+  for (uint32_t n = 0; n < count; n++) {
+    ModelData* model = &loader.models[n];
+    meshes[n] = NULL;
+    if (model->indexCount == 0) continue;
+    meshes[n] = engineCreateMesh(engine, model->vertices, model->vertexCount, model->indices, model->indexCount);
+    printf("Model %s: %u vertices, %u indices, %s in %.1f ms\n", model->path, model->vertexCount, model->indexCount, model->cacheHit ? "cache hit" : "parsed", model->loadTime * 1000.0);
+    if (model->cacheHit) {
+      cacheTime += model->loadTime;
+      cached++;
+      munmap(model->mapping, model->mappingSize);
+    } else {
+      parseTime += model->loadTime;
+      parsed++;
+      free(model->vertices);
+      free(model->indices);
+    }
+    loaded++;
+  }
+  printf("Models: %u loaded on %u threads in %.1f ms (%u parsed %.1f ms, %u from cache %.1f ms)\n", loaded, threadCount, loadTime * 1000.0, parsed, parseTime * 1000.0, cached, cacheTime * 1000.0);
+  free(loader.models);
+  return loaded;
+}
@@ -0,0 +1,222 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "engine.h"
+
+// Sleeps overshoot, so waits sleep until this close to the target and spin
+// the rest.
+#define PACING_SPIN_TIME 0.002
+#define PACING_BENCH_FRAMES 120
+
+const char* pacingModeNames[] = {"immediate", "mailbox", "fifo"};
+
+void pacingWaitUntil(double target) {
+  double remaining = target - getTime();
+  if (remaining > PACING_SPIN_TIME) {
+    double sleep = remaining - PACING_SPIN_TIME;
+    struct timespec ts = {(time_t)sleep, (long)((sleep - (time_t)sleep) * 1e9)};
+    nanosleep(&ts, NULL);
+  }
+  while (getTime() < target);
+}
+
+void pacingReset(FramePacing* pacing) {
+  pacing->nextFrame = 0;
+  pacing->pollTime = 0;
+  pacing->latencyCount = 0;
+  pacing->latencyTotal = 0;
+  pacing->latencyMax = 0;
+  pacing->displayLatencyTotal = 0;
+  pacing->displayLatencyMax = 0;
+  pacing->queuedCount = 0;
+  pacing->dropped = 0;
+}
+
+void engineCreatePacing(Engine* engine) {
+  FramePacing* pacing = &engine->pacing;
+  engine->presentMode = engine->config.presentMode;
+  engine->framesInFlight = engine->config.framesInFlight;
+  if (engine->framesInFlight < 1) engine->framesInFlight = 1;
+  if (engine->framesInFlight > MAX_FRAMES_IN_FLIGHT) engine->framesInFlight = MAX_FRAMES_IN_FLIGHT;
+  pacing->frameInterval = engine->config.frameLimit > 0 ? 1.0 / engine->config.frameLimit : 0;
+  pacing->refreshInterval = 1.0 / (engine->config.refreshRate > 0 ? engine->config.refreshRate : 60.0);
+  pacing->vblankOrigin = getTime();
+  pacing->imageCount = engine->config.swapChainImages;
+  if (pacing->imageCount < 2) pacing->imageCount = 2;
+  if (pacing->imageCount > MAX_SWAPCHAIN_IMAGES) pacing->imageCount = MAX_SWAPCHAIN_IMAGES;
+}
+
+int pacingCompare(const void* a, const void* b) {
+  double difference = *(const double*)a - *(const double*)b;
+  return (difference > 0) - (difference < 0);
+}
+
+// Over the most recent LATENCY_SAMPLES frames.
+double pacingPercentile(const double* samples, uint64_t count, double fraction) {
+  uint64_t kept = count < LATENCY_SAMPLES ? count : LATENCY_SAMPLES;
+  if (!kept) return 0;
+  double* sorted = malloc(sizeof(double) * kept);
+  memcpy(sorted, samples, sizeof(double) * kept);
+  qsort(sorted, kept, sizeof(double), pacingCompare);
+  double value = sorted[(uint64_t)(fraction * (kept - 1))];
+  free(sorted);
+  return value;
+}
+
+void pacingPrint(Engine* engine, const char* label) {
+  FramePacing* pacing = &engine->pacing;
+  if (!pacing->latencyCount) return;
+  printf("%s input to present %.3f ms avg, %.3f ms p99, %.3f ms max", label, pacing->latencyTotal * 1000.0 / pacing->latencyCount, pacingPercentile(pacing->latencies, pacing->latencyCount, 0.99) * 1000.0, pacing->latencyMax * 1000.0);
+  if (engine->config.headless) {
+    printf("; to display %.3f ms avg, %.3f ms p99, %.3f ms max, %lu dropped", pacing->displayLatencyTotal * 1000.0 / pacing->latencyCount, pacingPercentile(pacing->displayLatencies, pacing->latencyCount, 0.99) * 1000.0, pacing->displayLatencyMax * 1000.0, pacing->dropped);
+  }
+  printf("\n");
+}
+
+void engineDestroyPacing(Engine* engine) {
+  char label[64];
+  snprintf(label, sizeof(label), "Latency (%s, %u frames in flight):", pacingModeNames[engine->presentMode], engine->framesInFlight);
+  pacingPrint(engine, label);
+}
+
+// The frame limiter, called by engineRunFrame before input is polled so that
+// the time spent waiting doesn't add to latency. A frame that overruns its
+// slot starts a new schedule rather than letting the next ones run back to
+// back to catch up.
+void enginePaceFrame(Engine* engine) {
+  FramePacing* pacing = &engine->pacing;
+  if (pacing->frameInterval == 0) return;
+  uint64_t phaseStart = traceBegin();
+  pacingWaitUntil(pacing->nextFrame);
+  double now = getTime();
+  if (now - pacing->nextFrame > pacing->frameInterval) pacing->nextFrame = now;
+  pacing->nextFrame += pacing->frameInterval;
+  traceEnd(engine, TRACE_PACE, phaseStart);
+}
+
+void enginePacingPoll(Engine* engine) {
+  engine->pacing.pollTime = getTime();
+}
+
+// Queued presents whose vblank has passed are on screen, which frees the
+// image shown before each.
+void pacingRetire(FramePacing* pacing, double now) {
+  uint32_t shown = 0;
+  while (shown < pacing->queuedCount && pacing->queued[shown] <= now) shown++;
+  memmove(pacing->queued, pacing->queued + shown, sizeof(double) * (pacing->queuedCount - shown));
+  pacing->queuedCount -= shown;
+}
+
+double pacingNextVblank(FramePacing* pacing, double time) {
+  return pacing->vblankOrigin + ceil((time - pacing->vblankOrigin) / pacing->refreshInterval) * pacing->refreshInterval;
+}
+
+// Headless stand-in for vkAcquireNextImageKHR. One image is on screen and
+// the one acquired must be free, so with every other image queued this
+// waits for the next to be shown.
+void enginePacingAcquire(Engine* engine) {
+  FramePacing* pacing = &engine->pacing;
+  pacingRetire(pacing, getTime());
+  while (pacing->queuedCount >= pacing->imageCount - 1) {
+    pacingWaitUntil(pacing->queued[0]);
+    pacingRetire(pacing, getTime());
+  }
+}
+
+// Called as the present is submitted. Headless, FIFO queues the frame for
+// the first vblank not already taken, MAILBOX replaces a frame still waiting
+// for the next vblank, and IMMEDIATE shows it at once.
+void enginePacingPresent(Engine* engine) {
+  FramePacing* pacing = &engine->pacing;
+  double now = getTime();
+  double display = now;
+  if (engine->config.headless) {
+    pacingRetire(pacing, now);
+    if (engine->presentMode == PRESENT_FIFO) {
+      display = pacingNextVblank(pacing, now);
+      if (pacing->queuedCount && display <= pacing->queued[pacing->queuedCount - 1]) display = pacing->queued[pacing->queuedCount - 1] + pacing->refreshInterval;
+      pacing->queued[pacing->queuedCount++] = display;
+    } else if (engine->presentMode == PRESENT_MAILBOX) {
+      display = pacingNextVblank(pacing, now);
+      if (pacing->queuedCount) pacing->dropped++;
+      pacing->queued[0] = display;
+      pacing->queuedCount = 1;
+    }
+  }
+  // Frames drawn outside engineRunFrame have no input to measure from.
+  if (!pacing->pollTime) return;
+  double latency = now - pacing->pollTime;
+  double displayLatency = display - pacing->pollTime;
+  pacing->latencies[pacing->latencyCount % LATENCY_SAMPLES] = latency;
+  pacing->displayLatencies[pacing->latencyCount % LATENCY_SAMPLES] = displayLatency;
+  pacing->latencyCount++;
+  pacing->latencyTotal += latency;
+  pacing->displayLatencyTotal += displayLatency;
+  if (latency > pacing->latencyMax) pacing->latencyMax = latency;
+  if (displayLatency > pacing->displayLatencyMax) pacing->displayLatencyMax = displayLatency;
+  pacing->pollTime = 0;
+}
+
+// The configured present mode if the surface supports it. Otherwise
+// IMMEDIATE falls back to MAILBOX, and both fall back to FIFO, which every
+// surface supports and which never tears.
+VkPresentModeKHR engineSelectPresentMode(Engine* engine) {
+  VkPresentModeKHR modes[] = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR};
+  uint32_t supportedCount;
+  vkGetPhysicalDeviceSurfacePresentModesKHR(engine->physicalDevice, engine->surface, &supportedCount, NULL);
+  VkPresentModeKHR* supported = malloc(sizeof(VkPresentModeKHR) * supportedCount);
+  vkGetPhysicalDeviceSurfacePresentModesKHR(engine->physicalDevice, engine->surface, &supportedCount, supported);
+  PresentMode mode = engine->config.presentMode;
+  while (mode != PRESENT_FIFO) {
+    int found = 0;
+    for (uint32_t n = 0; n < supportedCount; n++) found |= supported[n] == modes[mode];
+    if (found) break;
+    mode++;
+  }
+  free(supported);
+  if (mode != engine->config.presentMode) printf("Present mode %s unsupported, using %s\n", pacingModeNames[engine->config.presentMode], pacingModeNames[mode]);
+  engine->presentMode = mode;
+  return modes[mode];
+}
+
+// Runs frames through engineRunFrame against the simulated display for each
+// present mode and number of frames in flight, then with the frame limiter
+// at the refresh rate.
+void engineBenchmarkPacing(Engine* engine) {
+  if (!engine->config.headless) {
+    printf("The pacing benchmark runs against the simulated display, use --headless\n");
+    return;
+  }
+  FramePacing* pacing = &engine->pacing;
+  PresentMode savedMode = engine->presentMode;
+  uint32_t savedFrames = engine->framesInFlight;
+  double savedInterval = pacing->frameInterval;
+  printf("Pacing: %u images, %.1f Hz simulated display, %d frames per run\n", pacing->imageCount, 1.0 / pacing->refreshInterval, PACING_BENCH_FRAMES);
+  for (int run = 0; run <= 3 * MAX_FRAMES_IN_FLIGHT; run++) {
+    int limited = run == 3 * MAX_FRAMES_IN_FLIGHT;
+    vkDeviceWaitIdle(engine->device);
+    engine->presentMode = limited ? PRESENT_IMMEDIATE : run / MAX_FRAMES_IN_FLIGHT;
+    engine->framesInFlight = limited ? savedFrames : run % MAX_FRAMES_IN_FLIGHT + 1;
+    engine->currentFrame = 0;
+    pacing->frameInterval = limited ? pacing->refreshInterval : 0;
+    pacingReset(pacing);
+
+    double startTime = getTime();
+    for (int n = 0; n < PACING_BENCH_FRAMES; n++) engineRunFrame(engine);
+    vkDeviceWaitIdle(engine->device);
+    double elapsed = getTime() - startTime;
+
+    char label[96];
+    snprintf(label, sizeof(label), "  %-9s %u in flight%s %7.1f frames/s,", pacingModeNames[engine->presentMode], engine->framesInFlight, limited ? " limited" : "        ", PACING_BENCH_FRAMES / elapsed);
+    pacingPrint(engine, label);
+  }
+  vkDeviceWaitIdle(engine->device);
+  engine->presentMode = savedMode;
+  engine->framesInFlight = savedFrames;
+  engine->currentFrame = 0;
+  pacing->frameInterval = savedInterval;
+  pacingReset(pacing);
+}
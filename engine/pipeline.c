@@ -1,32 +1,115 @@
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "engine.h"
 
-VkShaderModule createShaderModule(Engine* engine, char* path) {
-  VkShaderModule shaderModule;
-  FileData fileData = readFile(path);
-  VkShaderModuleCreateInfo createInfo;
-  memset(&createInfo, 0, sizeof(VkShaderModuleCreateInfo));
-  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  createInfo.codeSize = fileData.size;
-  createInfo.pCode = (uint32_t*)fileData.data;
-  if (vkCreateShaderModule(engine->device, &createInfo, NULL, &shaderModule) != VK_SUCCESS) {
-    printf("Shader creation failed!\n");
-    exit(1);
+// Nothing for vertex-less pipelines, Vertex from binding 0 for meshes and,
+// when instanced, also a per-instance mat4 from binding 1 into locations 3
+// to 6.
+void pipelineVertexInput(PipelineKind kind, VkVertexInputBindingDescription* bindingDescriptions, VkVertexInputAttributeDescription* attributeDescriptions, VkPipelineVertexInputStateCreateInfo* vertexInputInfo) {
+  memset(bindingDescriptions, 0, sizeof(VkVertexInputBindingDescription) * 2);
+  bindingDescriptions[0].binding = 0;
+  bindingDescriptions[0].stride = sizeof(Vertex);
+  bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+  bindingDescriptions[1].binding = 1;
+  bindingDescriptions[1].stride = sizeof(mat4);
+  bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+  memset(attributeDescriptions, 0, sizeof(VkVertexInputAttributeDescription) * 7);
+  attributeDescriptions[0].binding = 0;
+  attributeDescriptions[0].location = 0;
+  attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+  attributeDescriptions[0].offset = offsetof(Vertex, position);
+  attributeDescriptions[1].binding = 0;
+  attributeDescriptions[1].location = 1;
+  attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+  attributeDescriptions[1].offset = offsetof(Vertex, color);
+  attributeDescriptions[2].binding = 0;
+  attributeDescriptions[2].location = 2;
+  attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
+  attributeDescriptions[2].offset = offsetof(Vertex, uv);
+  for (int column = 0; column < 4; column++) {
+    attributeDescriptions[3 + column].binding = 1;
+    attributeDescriptions[3 + column].location = 3 + column;
+    attributeDescriptions[3 + column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    attributeDescriptions[3 + column].offset = sizeof(vec4) * column;
   }
-  free(fileData.data);
-  return shaderModule;
+
+  memset(vertexInputInfo, 0, sizeof(VkPipelineVertexInputStateCreateInfo));
+  vertexInputInfo->sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  if (kind == PIPELINE_VERTEXLESS) return;
+  vertexInputInfo->vertexBindingDescriptionCount = kind == PIPELINE_INSTANCED ? 2 : 1;
+  vertexInputInfo->pVertexBindingDescriptions = bindingDescriptions;
+  vertexInputInfo->vertexAttributeDescriptionCount = kind == PIPELINE_INSTANCED ? 7 : 3;
+  vertexInputInfo->pVertexAttributeDescriptions = attributeDescriptions;
 }
 
-VkPipeline pipelineCreate(Engine* engine) {
+// The built-in pipelines' state: filled triangles, back faces culled, depth
+// tested and written, no blending.
+PipelineState pipelineDefaultState(void) {
+  PipelineState state;
+  memset(&state, 0, sizeof(PipelineState));
+  state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  state.polygonMode = VK_POLYGON_MODE_FILL;
+  state.cullMode = VK_CULL_MODE_BACK_BIT;
+  state.frontFace = VK_FRONT_FACE_CLOCKWISE;
+  state.depthTest = 1;
+  state.depthWrite = 1;
+  state.depthCompare = VK_COMPARE_OP_LESS;
+  state.blend = PIPELINE_BLEND_OFF;
+  return state;
+}
+
+VkPipeline pipelineBuildCompute(Engine* engine, PipelineSource* source, VkShaderModule shaderModule) {
   VkPipeline pipeline;
+  VkComputePipelineCreateInfo pipelineInfo;
+  memset(&pipelineInfo, 0, sizeof(VkComputePipelineCreateInfo));
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = source->layout;
+  pipelineInfo.basePipelineIndex = -1;
 
-  // Shaders
-  VkShaderModule vertShaderModule = createShaderModule(engine, "shaders/triangle.vert.spv");
-  VkShaderModule fragShaderModule = createShaderModule(engine, "shaders/triangle.frag.spv");
+  if (vkCreateComputePipelines(engine->device, engine->pipelineCache, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) return VK_NULL_HANDLE;
+  return pipeline;
+}
+
+// Compute and depth-only pipelines have no fragment shader.
+int pipelineHasFragment(PipelineSource* source) {
+  return source->kind != PIPELINE_COMPUTE && !source->state.depthOnly;
+}
 
+// Build the pipeline a source describes, or return VK_NULL_HANDLE if a
+// shader is missing or invalid. Safe to call from any thread as the pipeline
+// cache is internally synchronised.
+VkPipeline pipelineBuild(Engine* engine, PipelineSource* source) {
+  VkShaderModule vertShaderModule = engineAcquireShaderModule(engine, source->vertPath);
+  VkShaderModule fragShaderModule = pipelineHasFragment(source) ? engineAcquireShaderModule(engine, source->fragPath) : VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  if (vertShaderModule && (fragShaderModule || !pipelineHasFragment(source))) pipeline = pipelineBuildWithModules(engine, source, vertShaderModule, fragShaderModule);
+  if (vertShaderModule) engineReleaseShaderModule(engine, vertShaderModule);
+  if (fragShaderModule) engineReleaseShaderModule(engine, fragShaderModule);
+  return pipeline;
+}
+
+// As pipelineBuild with modules the caller has acquired. vertShaderModule is
+// the compute shader for compute pipelines, and fragShaderModule is unused
+// for depth-only ones.
+VkPipeline pipelineBuildWithModules(Engine* engine, PipelineSource* source, VkShaderModule vertShaderModule, VkShaderModule fragShaderModule) {
+  if (source->kind == PIPELINE_COMPUTE) return pipelineBuildCompute(engine, source, vertShaderModule);
+  VkPipeline pipeline;
+  PipelineState* state = &source->state;
+
+  VkVertexInputBindingDescription bindingDescriptions[2];
+  VkVertexInputAttributeDescription attributeDescriptions[7];
+  VkPipelineVertexInputStateCreateInfo vertexInputInfo;
+  pipelineVertexInput(source->kind, bindingDescriptions, attributeDescriptions, &vertexInputInfo);
+
+  // Shaders
   VkPipelineShaderStageCreateInfo vertShaderStageInfo;
   memset(&vertShaderStageInfo, 0, sizeof(VkPipelineShaderStageCreateInfo));
   vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -43,17 +126,10 @@ VkPipeline pipelineCreate(Engine* engine) {
 
   VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
-  // Vertex input
-  VkPipelineVertexInputStateCreateInfo vertexInputInfo;
-  memset(&vertexInputInfo, 0, sizeof(VkPipelineVertexInputStateCreateInfo));
-  vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  vertexInputInfo.vertexBindingDescriptionCount = 0;
-  vertexInputInfo.vertexAttributeDescriptionCount = 0;
-
   VkPipelineInputAssemblyStateCreateInfo inputAssembly;
   memset(&inputAssembly, 0, sizeof(VkPipelineInputAssemblyStateCreateInfo));
   inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  inputAssembly.topology = state->topology;
   inputAssembly.primitiveRestartEnable = VK_FALSE;
 
   // Rassterizer
@@ -62,10 +138,10 @@ VkPipeline pipelineCreate(Engine* engine) {
   rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
   rasterizer.depthClampEnable = VK_FALSE;
   rasterizer.rasterizerDiscardEnable = VK_FALSE;
-  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizer.polygonMode = state->polygonMode;
   rasterizer.lineWidth = 1.0f;
-  rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+  rasterizer.cullMode = state->cullMode;
+  rasterizer.frontFace = state->frontFace;
   rasterizer.depthBiasEnable = VK_FALSE;
 
   // Multisampling
@@ -79,15 +155,30 @@ VkPipeline pipelineCreate(Engine* engine) {
   VkPipelineColorBlendAttachmentState colorBlendAttachment;
   memset(&colorBlendAttachment, 0, sizeof(VkPipelineColorBlendAttachmentState));
   colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  colorBlendAttachment.blendEnable = VK_FALSE;
+  colorBlendAttachment.blendEnable = state->blend != PIPELINE_BLEND_OFF;
+  colorBlendAttachment.srcColorBlendFactor = state->blend == PIPELINE_BLEND_ALPHA ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+  colorBlendAttachment.dstColorBlendFactor = state->blend == PIPELINE_BLEND_ALPHA ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+  colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+  colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  colorBlendAttachment.dstAlphaBlendFactor = state->blend == PIPELINE_BLEND_ALPHA ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+  colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+  // The scene subpass writes every G-buffer attachment in deferred mode.
+  // Blending only means anything for colour, the rest are written opaque
+  // where the device lets attachments blend differently.
+  VkPipelineColorBlendAttachmentState colorBlendAttachments[GBUFFER_COUNT];
+  for (int n = 0; n < GBUFFER_COUNT; n++) {
+    colorBlendAttachments[n] = colorBlendAttachment;
+    if (n > 0 && engine->enabledFeatures.independentBlend) colorBlendAttachments[n].blendEnable = VK_FALSE;
+  }
+  uint32_t colorCount = state->subpass == 0 && engine->config.deferred ? GBUFFER_COUNT : 1;
 
   VkPipelineColorBlendStateCreateInfo colorBlending;
   memset(&colorBlending, 0, sizeof(VkPipelineColorBlendStateCreateInfo));
   colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
   colorBlending.logicOpEnable = VK_FALSE;
   colorBlending.logicOp = VK_LOGIC_OP_COPY;
-  colorBlending.attachmentCount = 1;
-  colorBlending.pAttachments = &colorBlendAttachment;
+  colorBlending.attachmentCount = state->depthOnly ? 0 : colorCount;
+  colorBlending.pAttachments = colorBlendAttachments;
   colorBlending.blendConstants[0] = 0.0f;
   colorBlending.blendConstants[1] = 0.0f;
   colorBlending.blendConstants[2] = 0.0f;
@@ -111,9 +202,9 @@ VkPipeline pipelineCreate(Engine* engine) {
   VkPipelineDepthStencilStateCreateInfo depthStencil;
   memset(&depthStencil, 0, sizeof(VkPipelineDepthStencilStateCreateInfo));
   depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-  depthStencil.depthTestEnable = VK_TRUE;
-  depthStencil.depthWriteEnable = VK_TRUE;
-  depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+  depthStencil.depthTestEnable = state->depthTest ? VK_TRUE : VK_FALSE;
+  depthStencil.depthWriteEnable = state->depthWrite ? VK_TRUE : VK_FALSE;
+  depthStencil.depthCompareOp = state->depthCompare;
   depthStencil.depthBoundsTestEnable = VK_FALSE;
   depthStencil.minDepthBounds = 0.0f;  // Optional
   depthStencil.maxDepthBounds = 1.0f;  // Optional
@@ -123,7 +214,7 @@ VkPipeline pipelineCreate(Engine* engine) {
   VkGraphicsPipelineCreateInfo pipelineInfo;
   memset(&pipelineInfo, 0, sizeof(VkGraphicsPipelineCreateInfo));
   pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineInfo.stageCount = 2;
+  pipelineInfo.stageCount = state->depthOnly ? 1 : 2;
   pipelineInfo.pStages = shaderStages;
   pipelineInfo.pVertexInputState = &vertexInputInfo;
   pipelineInfo.pInputAssemblyState = &inputAssembly;
@@ -132,21 +223,76 @@ VkPipeline pipelineCreate(Engine* engine) {
   pipelineInfo.pMultisampleState = &multisampling;
   pipelineInfo.pColorBlendState = &colorBlending;
   pipelineInfo.pDynamicState = &dynamicState;
-  pipelineInfo.layout = engine->pipelineLayout;
-  pipelineInfo.renderPass = engine->renderPass;
-  pipelineInfo.subpass = 0;
+  pipelineInfo.layout = source->layout;
+  pipelineInfo.renderPass = state->depthOnly ? engine->hiz.prepassRenderPass : engine->renderPass;
+  pipelineInfo.subpass = state->subpass;
   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
   pipelineInfo.basePipelineIndex = -1;
   pipelineInfo.pDepthStencilState = &depthStencil;
 
-  if (vkCreateGraphicsPipelines(engine->device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) {
-    printf("Failed to create graphics pipeline!\n");
+  if (vkCreateGraphicsPipelines(engine->device, engine->pipelineCache, 1, &pipelineInfo, NULL, &pipeline) != VK_SUCCESS) return VK_NULL_HANDLE;
+  return pipeline;
+}
+
+// Build a pipeline, exiting if that fails, and register its source so it is
+// rebuilt when its shaders change. fragPath is NULL for compute and
+// depth-only pipelines.
+VkPipeline pipelineCreateWithState(Engine* engine, PipelineKind kind, char* vertPath, char* fragPath, PipelineState* state, VkPipelineLayout layout) {
+  double startTime = getTime();
+  PipelineSource source;
+  memset(&source, 0, sizeof(PipelineSource));
+  source.kind = kind;
+  snprintf(source.vertPath, SHADER_PATH_MAX, "%s", vertPath);
+  if (fragPath) snprintf(source.fragPath, SHADER_PATH_MAX, "%s", fragPath);
+  source.state = *state;
+  source.layout = layout;
+  source.pipeline = pipelineBuild(engine, &source);
+  if (!source.pipeline) {
+    printf("Failed to create %s pipeline from %s!\n", kind == PIPELINE_COMPUTE ? "compute" : "graphics", vertPath);
     exit(EXIT_FAILURE);
   }
+  engineRegisterPipelineSource(engine, &source);
+  engine->pipelineCreateTime += getTime() - startTime;
+  return source.pipeline;
+}
 
-  vkDestroyShaderModule(engine->device, fragShaderModule, NULL);
-  vkDestroyShaderModule(engine->device, vertShaderModule, NULL);
+VkPipeline pipelineCreateFromSource(Engine* engine, PipelineKind kind, char* vertPath, char* fragPath, VkPipelineLayout layout) {
+  PipelineState state = pipelineDefaultState();
+  return pipelineCreateWithState(engine, kind, vertPath, fragPath, &state, layout);
+}
 
-  return pipeline;
+// Geometry generated in the vertex shader, no vertex buffers.
+VkPipeline pipelineCreate(Engine* engine) {
+  return pipelineCreateFromSource(engine, PIPELINE_VERTEXLESS, "shaders/triangle.vert.spv", "shaders/triangle.frag.spv", engine->pipelineLayout);
+}
+
+// Reads Vertex from binding 0. Instanced pipelines also read a per-instance
+// mat4 from binding 1 into locations 3 to 6.
+VkPipeline meshPipelineCreateWithBindings(Engine* engine, char* vertPath, char* fragPath, VkPipelineLayout layout, int instanced) {
+  return pipelineCreateFromSource(engine, instanced ? PIPELINE_INSTANCED : PIPELINE_MESH, vertPath, fragPath, layout);
+}
+
+// For meshes drawn with engineAddMeshPipeline.
+VkPipeline meshPipelineCreateWithShaders(Engine* engine, char* vertPath, char* fragPath, VkPipelineLayout layout) {
+  return meshPipelineCreateWithBindings(engine, vertPath, fragPath, layout, 0);
+}
+
+VkPipeline meshPipelineCreate(Engine* engine) {
+  return meshPipelineCreateWithShaders(engine, "shaders/mesh.vert.spv", "shaders/triangle.frag.spv", engine->pipelineLayout);
+}
+
+// Mesh pipeline that samples the texture bound at set 0.
+VkPipeline texturedPipelineCreate(Engine* engine) {
+  if (engine->descriptors.bindless) return meshPipelineCreateWithShaders(engine, "shaders/mesh.vert.spv", "shaders/bindless.frag.spv", engine->pipelineLayout);
+  return meshPipelineCreateWithShaders(engine, "shaders/mesh.vert.spv", "shaders/textured.frag.spv", engine->pipelineLayout);
+}
+
+// For meshes drawn with engineDrawInstance, placed by their instance transform.
+VkPipeline instancedPipelineCreate(Engine* engine) {
+  return meshPipelineCreateWithBindings(engine, "shaders/instanced.vert.spv", "shaders/triangle.frag.spv", engine->pipelineLayout, 1);
+}
+
+VkPipeline computePipelineCreate(Engine* engine, char* path, VkPipelineLayout layout) {
+  return pipelineCreateFromSource(engine, PIPELINE_COMPUTE, path, NULL, layout);
 }
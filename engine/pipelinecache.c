@@ -0,0 +1,101 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+// Header written by the driver at the start of every pipeline cache blob
+// (VkPipelineCacheHeaderVersionOne).
+typedef struct pipelineCacheHeader {
+  uint32_t headerSize;
+  uint32_t headerVersion;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+} PipelineCacheHeader;
+
+// Returns 1 if the blob was produced by this exact driver and device.
+int pipelineCacheHeaderValid(Engine* engine, char* data, size_t size) {
+  PipelineCacheHeader header;
+  if (size < sizeof(PipelineCacheHeader)) return 0;
+  memcpy(&header, data, sizeof(PipelineCacheHeader));
+  if (header.headerSize < sizeof(PipelineCacheHeader) || header.headerSize > size) return 0;
+  if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) return 0;
+  if (header.vendorID != engine->physicalDeviceProperties.vendorID) return 0;
+  if (header.deviceID != engine->physicalDeviceProperties.deviceID) return 0;
+  if (memcmp(header.pipelineCacheUUID, engine->physicalDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0) return 0;
+  return 1;
+}
+
+void engineCreatePipelineCache(Engine* engine) {
+  FileData fileData;
+  fileData.size = 0;
+  fileData.data = NULL;
+
+  // A missing or unreadable cache is not an error, we just start cold.
+  int fd = open(PIPELINE_CACHE_PATH, O_RDONLY);
+  if (fd >= 0) {
+    off_t size = lseek(fd, 0, SEEK_END);
+    lseek(fd, 0, SEEK_SET);
+    if (size > 0) {
+      fileData.data = malloc(size);
+      if (read(fd, fileData.data, size) == size) fileData.size = size;
+    }
+    close(fd);
+  }
+
+  if (fileData.size > 0 && !pipelineCacheHeaderValid(engine, fileData.data, fileData.size)) {
+    printf("Discarding pipeline cache %s: created by a different device or driver\n", PIPELINE_CACHE_PATH);
+    fileData.size = 0;
+  }
+
+  VkPipelineCacheCreateInfo createInfo;
+  memset(&createInfo, 0, sizeof(VkPipelineCacheCreateInfo));
+  createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  createInfo.initialDataSize = fileData.size;
+  createInfo.pInitialData = fileData.size ? fileData.data : NULL;
+
+  if (vkCreatePipelineCache(engine->device, &createInfo, NULL, &engine->pipelineCache) != VK_SUCCESS) {
+    // The driver may still reject data that passed the header check, retry empty.
+    createInfo.initialDataSize = 0;
+    createInfo.pInitialData = NULL;
+    fileData.size = 0;
+    if (vkCreatePipelineCache(engine->device, &createInfo, NULL, &engine->pipelineCache) != VK_SUCCESS) {
+      printf("Failed to create pipeline cache!\n");
+      exit(1);
+    }
+  }
+  engine->pipelineCacheLoadedSize = fileData.size;
+  free(fileData.data);
+}
+
+// Write the cache to a temporary file and rename it over the old one so a
+// crash mid-write never leaves a truncated cache behind.
+void engineDestroyPipelineCache(Engine* engine) {
+  size_t size = 0;
+  char* data = NULL;
+  if (vkGetPipelineCacheData(engine->device, engine->pipelineCache, &size, NULL) == VK_SUCCESS && size > 0) {
+    data = malloc(size);
+    if (vkGetPipelineCacheData(engine->device, engine->pipelineCache, &size, data) != VK_SUCCESS) size = 0;
+  }
+
+  if (size > 0) {
+    char tmpPath[] = PIPELINE_CACHE_PATH ".tmp";
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      printf("Failed to write pipeline cache %s\n", tmpPath);
+    } else {
+      int ok = write(fd, data, size) == size && fsync(fd) == 0;
+      close(fd);
+      if (!ok || rename(tmpPath, PIPELINE_CACHE_PATH) != 0) {
+        printf("Failed to write pipeline cache %s\n", PIPELINE_CACHE_PATH);
+        unlink(tmpPath);
+      }
+    }
+  }
+  free(data);
+
+  vkDestroyPipelineCache(engine->device, engine->pipelineCache, NULL);
+}
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+// Query layout within a frame's slice of the pool: the render pass start and
+// end, then a start/end pair per pipeline draw.
+#define PROFILER_RENDER_PASS_BEGIN 0
+#define PROFILER_RENDER_PASS_END 1
+#define PROFILER_PIPELINE_BEGIN(n) (2 + (n) * 2)
+#define PROFILER_PIPELINE_END(n) (3 + (n) * 2)
+
+uint32_t profilerQuery(Engine* engine, uint32_t query) {
+  return engine->currentFrame * PROFILER_QUERIES_PER_FRAME + query;
+}
+
+void profilerSeriesAdd(ProfilerSeries* series, float milliseconds) {
+  series->samples[series->next] = milliseconds;
+  series->next = (series->next + 1) % PROFILER_WINDOW;
+  if (series->count < PROFILER_WINDOW) series->count++;
+}
+
+int profilerCompare(const void* a, const void* b) {
+  float x = *(const float*)a;
+  float y = *(const float*)b;
+  return (x > y) - (x < y);
+}
+
+void profilerSeriesStats(ProfilerSeries* series, ProfilerStats* stats) {
+  memset(stats, 0, sizeof(ProfilerStats));
+  stats->samples = series->count;
+  if (series->count == 0) return;
+
+  float sorted[PROFILER_WINDOW];
+  memcpy(sorted, series->samples, series->count * sizeof(float));
+  qsort(sorted, series->count, sizeof(float), profilerCompare);
+
+  double total = 0.0;
+  for (uint32_t n = 0; n < series->count; n++) total += sorted[n];
+  stats->min = sorted[0];
+  stats->avg = total / series->count;
+  stats->p99 = sorted[(series->count * 99) / 100];
+}
+
+void engineCreateProfiler(Engine* engine) {
+  Profiler* profiler = &engine->profiler;
+  // Dynamic resolution scales to the GPU frame time.
+  if (!engine->config.profiler && engine->config.targetFrameTime <= 0) return;
+
+  uint32_t queueFamilyCount;
+  vkGetPhysicalDeviceQueueFamilyProperties(engine->physicalDevice, &queueFamilyCount, NULL);
+  VkQueueFamilyProperties queueFamilies[queueFamilyCount];
+  vkGetPhysicalDeviceQueueFamilyProperties(engine->physicalDevice, &queueFamilyCount, queueFamilies);
+  uint32_t validBits = queueFamilies[engine->queueFamilyIndex].timestampValidBits;
+  if (validBits == 0) {
+    printf("GPU profiler disabled: queue does not support timestamps\n");
+    return;
+  }
+  profiler->validMask = validBits >= 64 ? UINT64_MAX : (1ULL << validBits) - 1;
+  profiler->period = engine->physicalDeviceProperties.limits.timestampPeriod;
+
+  VkQueryPoolCreateInfo queryPoolInfo;
+  memset(&queryPoolInfo, 0, sizeof(VkQueryPoolCreateInfo));
+  queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  queryPoolInfo.queryCount = MAX_FRAMES_IN_FLIGHT * PROFILER_QUERIES_PER_FRAME;
+  if (vkCreateQueryPool(engine->device, &queryPoolInfo, NULL, &profiler->queryPool) != VK_SUCCESS) {
+    printf("Failed to create query pool!\n");
+    exit(1);
+  }
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) profiler->recordedPipelines[n] = -1;
+  profiler->lastDump = getTime();
+  profiler->enabled = 1;
+}
+
+void engineDestroyProfiler(Engine* engine) {
+  if (!engine->profiler.enabled) return;
+  vkDestroyQueryPool(engine->device, engine->profiler.queryPool, NULL);
+}
+
+int engineProfilerStats(Engine* engine, int pipelineIndex, ProfilerStats* stats) {
+  Profiler* profiler = &engine->profiler;
+  if (!profiler->enabled || pipelineIndex >= MAX_PIPELINES) return 0;
+  profilerSeriesStats(pipelineIndex < 0 ? &profiler->renderPass : &profiler->pipelines[pipelineIndex], stats);
+  return stats->samples > 0;
+}
+
+void engineProfilerDump(Engine* engine) {
+  ProfilerStats stats;
+  if (!engineProfilerStats(engine, -1, &stats)) return;
+  printf("GPU render pass: min %.3f avg %.3f p99 %.3f ms\n", stats.min, stats.avg, stats.p99);
+  for (int n = 0; n < engine->pipelineCount; n++) {
+    if (!engineProfilerStats(engine, n, &stats)) continue;
+    printf("GPU pipeline %d: min %.3f avg %.3f p99 %.3f ms\n", n, stats.min, stats.avg, stats.p99);
+  }
+}
+
+// Milliseconds between two queries, if both were written.
+int profilerElapsed(Profiler* profiler, uint64_t results[][2], uint32_t begin, uint32_t end, double scale, double* elapsed) {
+  if (!results[begin][1] || !results[end][1]) return 0;
+  *elapsed = ((results[end][0] - results[begin][0]) & profiler->validMask) * scale;
+  return 1;
+}
+
+// Called once the current frame's last submission has completed, so the
+// queries it wrote last time round can be read without waiting.
+void engineProfilerCollect(Engine* engine) {
+  Profiler* profiler = &engine->profiler;
+  if (!profiler->enabled) return;
+  int pipelineCount = profiler->recordedPipelines[engine->currentFrame];
+  if (pipelineCount < 0) return;
+  profiler->recordedPipelines[engine->currentFrame] = -1;
+
+  // Value/availability pairs: a query that was never written this time, such
+  // as a pipeline skipped when the render queue overflowed, only drops its
+  // own range.
+  uint64_t results[PROFILER_QUERIES_PER_FRAME][2];
+  uint32_t queryCount = PROFILER_PIPELINE_BEGIN(pipelineCount);
+  VkResult result = vkGetQueryPoolResults(engine->device, profiler->queryPool, profilerQuery(engine, 0), queryCount, sizeof(results), results, sizeof(results[0]), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  if (result != VK_SUCCESS && result != VK_NOT_READY) return;
+
+  double scale = profiler->period / 1e6;
+  if (profilerElapsed(profiler, results, PROFILER_RENDER_PASS_BEGIN, PROFILER_RENDER_PASS_END, scale, &profiler->frameTime)) {
+    profiler->frameScale = profiler->recordedScales[engine->currentFrame];
+    profiler->collected++;
+    profilerSeriesAdd(&profiler->renderPass, profiler->frameTime);
+  }
+  for (int n = 0; n < pipelineCount; n++) {
+    double elapsed;
+    if (profilerElapsed(profiler, results, PROFILER_PIPELINE_BEGIN(n), PROFILER_PIPELINE_END(n), scale, &elapsed)) profilerSeriesAdd(&profiler->pipelines[n], elapsed);
+  }
+
+  if (engine->config.profilerInterval > 0 && getTime() - profiler->lastDump >= engine->config.profilerInterval) {
+    engineProfilerDump(engine);
+    profiler->lastDump = getTime();
+  }
+}
+
+// Must be recorded outside the render pass, the query reset is not allowed inside one.
+void engineProfilerBegin(Engine* engine, VkCommandBuffer commandBuffer) {
+  Profiler* profiler = &engine->profiler;
+  if (!profiler->enabled) return;
+  vkCmdResetQueryPool(commandBuffer, profiler->queryPool, profilerQuery(engine, 0), PROFILER_QUERIES_PER_FRAME);
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->queryPool, profilerQuery(engine, PROFILER_RENDER_PASS_BEGIN));
+}
+
+void engineProfilerEnd(Engine* engine, VkCommandBuffer commandBuffer) {
+  Profiler* profiler = &engine->profiler;
+  if (!profiler->enabled) return;
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->queryPool, profilerQuery(engine, PROFILER_RENDER_PASS_END));
+  profiler->recordedPipelines[engine->currentFrame] = engine->pipelineCount;
+  profiler->recordedScales[engine->currentFrame] = engine->resolution.scale;
+}
+
+void engineProfilerPipelineBegin(Engine* engine, VkCommandBuffer commandBuffer, int pipelineIndex) {
+  Profiler* profiler = &engine->profiler;
+  if (!profiler->enabled) return;
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->queryPool, profilerQuery(engine, PROFILER_PIPELINE_BEGIN(pipelineIndex)));
+}
+
+void engineProfilerPipelineEnd(Engine* engine, VkCommandBuffer commandBuffer, int pipelineIndex) {
+  Profiler* profiler = &engine->profiler;
+  if (!profiler->enabled) return;
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->queryPool, profilerQuery(engine, PROFILER_PIPELINE_END(pipelineIndex)));
+}
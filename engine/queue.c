@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+const char* bindTypeNames[BIND_TYPE_COUNT] = {"pipeline", "descriptor set", "vertex buffer", "index buffer"};
+
+void engineCreateRenderQueue(Engine* engine) {
+  RenderQueue* queue = &engine->renderQueue;
+  queue->packets = malloc(sizeof(DrawPacket) * RENDER_QUEUE_CAPACITY);
+  queue->sorted = malloc(sizeof(SortEntry) * RENDER_QUEUE_CAPACITY);
+  queue->scratch = malloc(sizeof(SortEntry) * RENDER_QUEUE_CAPACITY);
+}
+
+void engineDestroyRenderQueue(Engine* engine) {
+  RenderQueue* queue = &engine->renderQueue;
+  uint64_t total = 0;
+  for (int type = 0; type < BIND_TYPE_COUNT; type++) total += queue->total.issued[type] + queue->total.elided[type];
+  if (total > 0) {
+    printf("Render queue binds (issued/elided):");
+    for (int type = 0; type < BIND_TYPE_COUNT; type++) printf(" %s %lu/%lu", bindTypeNames[type], queue->total.issued[type], queue->total.elided[type]);
+    printf(", %lu packets dropped\n", queue->dropped);
+  }
+  free(queue->packets);
+  free(queue->sorted);
+  free(queue->scratch);
+}
+
+// Most significant first: 8 bits of pipeline, 16 of material, 16 of mesh and
+// 24 of depth in 0..1, so draws group by the costliest state to change and
+// run front to back within a group.
+uint64_t engineSortKey(uint32_t pipeline, uint32_t material, uint32_t mesh, float depth) {
+  if (depth < 0.0f) depth = 0.0f;
+  if (depth > 1.0f) depth = 1.0f;
+  uint64_t quantized = (uint64_t)(depth * 0xFFFFFF);
+  return (uint64_t)(pipeline & 0xFF) << 56 | (uint64_t)(material & 0xFFFF) << 40 | (uint64_t)(mesh & 0xFFFF) << 24 | quantized;
+}
+
+void queueAppend(Engine* engine, uint32_t pipeline, int profile, Texture* texture, Mesh* mesh, float depth) {
+  RenderQueue* queue = &engine->renderQueue;
+  if (queue->count == RENDER_QUEUE_CAPACITY) {
+    queue->dropped++;
+    return;
+  }
+  DrawPacket* packet = &queue->packets[queue->count++];
+  packet->key = engineSortKey(pipeline, texture ? texture->index + 1 : 0, mesh ? mesh->id + 1 : 0, depth);
+  packet->pipeline = pipeline;
+  packet->profile = profile;
+  packet->texture = texture;
+  packet->mesh = mesh;
+}
+
+// Queue a draw of mesh with engine->pipelines[pipeline] for the next frame,
+// sampling texture if it isn't NULL, or a vertex-less triangle if mesh is
+// NULL. depth orders draws sharing all other state.
+void engineSubmitDraw(Engine* engine, uint32_t pipeline, Texture* texture, Mesh* mesh, float depth) {
+  if (pipeline >= engine->pipelineCount) return;
+  queueAppend(engine, pipeline, -1, texture, mesh, depth);
+}
+
+// Add the registered pipelines, which draw every frame, then LSD radix sort
+// the keys a byte at a time, ping-ponging between the two arenas. Bytes that
+// are equal across all keys are skipped.
+void engineRenderQueueSort(Engine* engine) {
+  RenderQueue* queue = &engine->renderQueue;
+  for (int n = 0; n < engine->pipelineCount; n++) queueAppend(engine, n, n, engine->pipelineTextures[n], engine->pipelineMeshes[n], 0.0f);
+  uint32_t count = queue->count;
+  for (uint32_t n = 0; n < count; n++) {
+    queue->sorted[n].key = queue->packets[n].key;
+    queue->sorted[n].packet = n;
+  }
+  queue->sortedCount = count;
+  if (count < 2) return;
+
+  for (int shift = 0; shift < 64; shift += 8) {
+    uint32_t histogram[256];
+    memset(histogram, 0, sizeof(histogram));
+    for (uint32_t n = 0; n < count; n++) histogram[(queue->sorted[n].key >> shift) & 0xFF]++;
+    if (histogram[(queue->sorted[0].key >> shift) & 0xFF] == count) continue;
+
+    uint32_t offset = 0;
+    for (int bucket = 0; bucket < 256; bucket++) {
+      uint32_t size = histogram[bucket];
+      histogram[bucket] = offset;
+      offset += size;
+    }
+    for (uint32_t n = 0; n < count; n++) queue->scratch[histogram[(queue->sorted[n].key >> shift) & 0xFF]++] = queue->sorted[n];
+    SortEntry* swap = queue->sorted;
+    queue->sorted = queue->scratch;
+    queue->scratch = swap;
+  }
+}
+
+// Called after the frame is recorded, ready for the next frame's submissions.
+void engineRenderQueueClear(Engine* engine) {
+  RenderQueue* queue = &engine->renderQueue;
+  for (int type = 0; type < BIND_TYPE_COUNT; type++) {
+    queue->total.issued[type] += queue->frame.issued[type];
+    queue->total.elided[type] += queue->frame.elided[type];
+  }
+  queue->count = 0;
+  queue->sortedCount = 0;
+}
+
+// Returns whether the bind is needed, counting it either way.
+int queueBind(BindCounters* counters, BindType type, int changed) {
+  if (changed) {
+    counters->issued[type]++;
+  } else {
+    counters->elided[type]++;
+  }
+  return changed;
+}
+
+// Record sorted draws first to first + count, wrapping round the queue so the
+// recording benchmark can ask for more draws than were submitted; only the
+// first round is profiled. State starts unknown, as every secondary buffer
+// does, and each bind is skipped when it matches what is already bound. All
+// queue pipelines share engine->pipelineLayout, so a bound texture survives a
+// pipeline change.
+void engineRenderQueueRecord(Engine* engine, VkCommandBuffer commandBuffer, uint32_t first, uint32_t count, BindCounters* counters) {
+  RenderQueue* queue = &engine->renderQueue;
+  if (queue->sortedCount == 0) return;
+  VkPipeline boundPipeline = VK_NULL_HANDLE;
+  Texture* boundTexture = NULL;
+  VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+  VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+
+  for (uint32_t draw = first; draw < first + count; draw++) {
+    DrawPacket* packet = &queue->packets[queue->sorted[draw % queue->sortedCount].packet];
+    int profile = draw < queue->sortedCount ? packet->profile : -1;
+    if (profile >= 0) engineProfilerPipelineBegin(engine, commandBuffer, profile);
+
+    VkPipeline pipeline = engine->pipelines[packet->pipeline];
+    if (queueBind(counters, BIND_PIPELINE, pipeline != boundPipeline)) {
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+      boundPipeline = pipeline;
+    }
+
+    // A texture that is still streaming in has nothing to sample yet.
+    int ready = 1;
+    if (packet->texture && packet->texture == boundTexture) {
+      queueBind(counters, BIND_DESCRIPTOR_SET, 0);
+    } else if (packet->texture) {
+      ready = engineBindTexture(engine, commandBuffer, packet->texture);
+      if (ready) {
+        queueBind(counters, BIND_DESCRIPTOR_SET, 1);
+        boundTexture = packet->texture;
+      }
+    }
+
+    Mesh* mesh = packet->mesh;
+    if (ready && mesh) {
+      if (queueBind(counters, BIND_VERTEX_BUFFER, mesh->vertexBuffer != boundVertexBuffer)) {
+        VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &mesh->vertexBuffer, &offset);
+        boundVertexBuffer = mesh->vertexBuffer;
+      }
+      if (queueBind(counters, BIND_INDEX_BUFFER, mesh->indexBuffer != boundIndexBuffer)) {
+        vkCmdBindIndexBuffer(commandBuffer, mesh->indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        boundIndexBuffer = mesh->indexBuffer;
+      }
+      vkCmdDrawIndexed(commandBuffer, mesh->indexCount, 1, 0, 0, 0);
+    } else if (ready) {
+      vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+    }
+    if (profile >= 0) engineProfilerPipelineEnd(engine, commandBuffer, profile);
+  }
+}
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <stb/stb_image_write.h>
+
+#include "engine.h"
+
+// Each frame in flight owns one host-visible staging buffer. A slot moves
+// FREE -> PENDING when the copy is submitted, PENDING -> WRITING once the
+// graphics timeline reaches the slot's value, and back to FREE when the
+// writer thread has finished with the mapped memory. The render thread never waits on the
+// writer: if a slot is still being written the frame is dropped instead.
+enum { READBACK_FREE, READBACK_PENDING, READBACK_WRITING };
+
+typedef struct pngContext {
+  FILE* stream;
+  uint64_t bytes;
+} PngContext;
+
+void readbackPngWrite(void* context, void* data, int size) {
+  PngContext* png = context;
+  png->bytes += fwrite(data, 1, size, png->stream);
+}
+
+void readbackWriteSlot(Engine* engine, ReadbackSlot* slot) {
+  Readback* readback = &engine->readback;
+  uint8_t* pixels = slot->data;
+  size_t pixelCount = (size_t)slot->width * slot->height;
+
+  // The images are B8G8R8A8, swizzle to RGBA in place rather than copying.
+  for (size_t n = 0; n < pixelCount; n++) {
+    uint8_t blue = pixels[n * 4];
+    pixels[n * 4] = pixels[n * 4 + 2];
+    pixels[n * 4 + 2] = blue;
+  }
+
+  FILE* stream = readback->stream;
+  if (!stream) {
+    char path[4096];
+    snprintf(path, sizeof(path), engine->config.readbackPath, (int)slot->frame);
+    stream = fopen(path, "wb");
+    if (!stream) {
+      printf("Failed to open readback output %s\n", path);
+      return;
+    }
+  }
+
+  uint64_t bytes = 0;
+  if (engine->config.readbackFormat == READBACK_RAW) {
+    bytes = fwrite(pixels, 1, pixelCount * 4, stream);
+  } else if (engine->config.readbackFormat == READBACK_PPM) {
+    for (size_t n = 0; n < pixelCount; n++) {
+      pixels[n * 3] = pixels[n * 4];
+      pixels[n * 3 + 1] = pixels[n * 4 + 1];
+      pixels[n * 3 + 2] = pixels[n * 4 + 2];
+    }
+    bytes = fprintf(stream, "P6\n%u %u\n255\n", slot->width, slot->height);
+    bytes += fwrite(pixels, 1, pixelCount * 3, stream);
+  } else if (engine->config.readbackFormat == READBACK_PNG) {
+    PngContext png = {stream, 0};
+    stbi_write_png_to_func(readbackPngWrite, &png, slot->width, slot->height, 4, pixels, slot->width * 4);
+    bytes = png.bytes;
+  }
+
+  if (stream != readback->stream) fclose(stream);
+
+  readback->framesWritten++;
+  readback->bytesWritten += bytes;
+}
+
+void* readbackThread(void* arg) {
+  Engine* engine = arg;
+  Readback* readback = &engine->readback;
+
+  pthread_mutex_lock(&readback->mutex);
+  while (1) {
+    while (readback->queueCount == 0 && !readback->stop) pthread_cond_wait(&readback->cond, &readback->mutex);
+    if (readback->queueCount == 0) break;
+    ReadbackSlot* slot = &readback->slots[readback->queue[readback->queueHead]];
+    readback->queueHead = (readback->queueHead + 1) % MAX_FRAMES_IN_FLIGHT;
+    readback->queueCount--;
+    pthread_mutex_unlock(&readback->mutex);
+
+    readbackWriteSlot(engine, slot);
+
+    pthread_mutex_lock(&readback->mutex);
+    atomic_store(&slot->state, READBACK_FREE);
+    pthread_cond_broadcast(&readback->cond);
+  }
+  pthread_mutex_unlock(&readback->mutex);
+  return NULL;
+}
+
+// Hand a slot whose copy has completed to the writer thread.
+void readbackSubmit(Engine* engine, int frame) {
+  Readback* readback = &engine->readback;
+  ReadbackSlot* slot = &readback->slots[frame];
+
+  if (!readback->coherent) {
+    VkMappedMemoryRange range;
+    memset(&range, 0, sizeof(VkMappedMemoryRange));
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = slot->memory.memory;
+    range.offset = slot->memory.offset;
+    range.size = slot->memory.size;
+    vkInvalidateMappedMemoryRanges(engine->device, 1, &range);
+  }
+
+  pthread_mutex_lock(&readback->mutex);
+  atomic_store(&slot->state, READBACK_WRITING);
+  readback->queue[(readback->queueHead + readback->queueCount) % MAX_FRAMES_IN_FLIGHT] = frame;
+  readback->queueCount++;
+  pthread_cond_broadcast(&readback->cond);
+  pthread_mutex_unlock(&readback->mutex);
+}
+
+// Hand off every pending slot and wait for the writer to release them all.
+// Only at shutdown: resizing replaces each slot's buffer once it is free.
+void readbackDrain(Engine* engine) {
+  Readback* readback = &engine->readback;
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
+    if (atomic_load(&readback->slots[n].state) == READBACK_PENDING) {
+      engineTimelineWait(engine, engine->graphicsTimeline, readback->slots[n].value);
+      readbackSubmit(engine, n);
+    }
+  }
+  pthread_mutex_lock(&readback->mutex);
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
+    while (atomic_load(&readback->slots[n].state) != READBACK_FREE) pthread_cond_wait(&readback->cond, &readback->mutex);
+  }
+  pthread_mutex_unlock(&readback->mutex);
+}
+
+// A per-frame output path is used as a printf format with the frame number,
+// so it may hold exactly one integer conversion and otherwise only %%.
+int readbackPathValid(const char* path) {
+  int conversions = 0;
+  for (const char* c = path; *c; c++) {
+    if (*c != '%') continue;
+    if (*++c == '%') continue;
+    while (*c && strchr("-+ 0#", *c)) c++;
+    while (*c >= '0' && *c <= '9') c++;
+    if (*c != 'd' && *c != 'i') return 0;
+    conversions++;
+  }
+  return conversions == 1;
+}
+
+void engineCreateReadback(Engine* engine) {
+  Readback* readback = &engine->readback;
+  if (engine->config.readbackFormat == READBACK_NONE) return;
+
+  // Prefer cached memory, the writer thread reads every byte on the CPU.
+  readback->memoryProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  for (uint32_t n = 0; n < engine->memoryProperties.memoryTypeCount; n++) {
+    VkMemoryPropertyFlags flags = engine->memoryProperties.memoryTypes[n].propertyFlags;
+    if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT)) {
+      readback->memoryProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+      readback->coherent = (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+      break;
+    }
+  }
+  if (!(readback->memoryProperties & VK_MEMORY_PROPERTY_HOST_CACHED_BIT)) readback->coherent = 1;
+
+  // Streaming to stdout: keep the real stdout for frames and send the
+  // engine's own log output to stderr so it can't corrupt the stream.
+  if (strcmp(engine->config.readbackPath, "-") == 0) {
+    fflush(stdout);
+    readback->stream = fdopen(dup(STDOUT_FILENO), "wb");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+  } else if (!strchr(engine->config.readbackPath, '%')) {
+    readback->stream = fopen(engine->config.readbackPath, "wb");
+  } else if (!readbackPathValid(engine->config.readbackPath)) {
+    printf("Readback path %s must hold one integer conversion for the frame number\n", engine->config.readbackPath);
+    exit(1);
+  }
+  if (!readback->stream && !strchr(engine->config.readbackPath, '%')) {
+    printf("Failed to open readback output %s\n", engine->config.readbackPath);
+    exit(1);
+  }
+
+  pthread_mutex_init(&readback->mutex, NULL);
+  pthread_cond_init(&readback->cond, NULL);
+  if (pthread_create(&readback->thread, NULL, readbackThread, engine) != 0) {
+    printf("Failed to create readback thread!\n");
+    exit(1);
+  }
+  readback->startTime = getTime();
+}
+
+// Replace a free slot's staging buffer with one for the current extent. The
+// old one goes on the deletion queue in case its last copy's submission is
+// still in flight.
+void readbackResizeSlot(Engine* engine, ReadbackSlot* slot) {
+  VkDeviceSize size = (VkDeviceSize)engine->extent.width * engine->extent.height * 4;
+  if (slot->size == size) return;
+  engineDeferDestroy(engine, DELETE_BUFFER, (uint64_t)slot->buffer);
+  engineDeferFree(engine, &slot->memory);
+  engineCreateBuffer(engine, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, engine->readback.memoryProperties, &slot->buffer, &slot->memory);
+  slot->data = slot->memory.mapped;
+  slot->size = size;
+}
+
+// (Re)size the staging buffers to the current extent. Called whenever the
+// swapchain or offscreen images are created. Slots still pending or being
+// written keep their old buffer and finish at the old size; they are
+// resized when next recorded.
+void engineResizeReadback(Engine* engine) {
+  Readback* readback = &engine->readback;
+  if (engine->config.readbackFormat == READBACK_NONE) return;
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
+    if (atomic_load(&readback->slots[n].state) == READBACK_FREE) readbackResizeSlot(engine, &readback->slots[n]);
+  }
+}
+
+void engineDestroyReadback(Engine* engine) {
+  Readback* readback = &engine->readback;
+  if (engine->config.readbackFormat == READBACK_NONE) return;
+
+  readbackDrain(engine);
+  pthread_mutex_lock(&readback->mutex);
+  readback->stop = 1;
+  pthread_cond_broadcast(&readback->cond);
+  pthread_mutex_unlock(&readback->mutex);
+  pthread_join(readback->thread, NULL);
+  pthread_cond_destroy(&readback->cond);
+  pthread_mutex_destroy(&readback->mutex);
+  if (readback->stream) fclose(readback->stream);
+
+  double elapsed = getTime() - readback->startTime;
+  printf("Readback: %lu frames, %.1f MB in %.3f s (%.1f frames/s, %.1f MB/s), %lu dropped\n", readback->framesWritten, readback->bytesWritten / 1e6, elapsed, readback->framesWritten / elapsed, readback->bytesWritten / 1e6 / elapsed, readback->framesDropped);
+
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) {
+    ReadbackSlot* slot = &readback->slots[n];
+    if (!slot->size) continue;
+    vkDestroyBuffer(engine->device, slot->buffer, NULL);
+    engineFree(engine, &slot->memory);
+  }
+}
+
+// Called once the current frame's previous submission has completed, so the
+// copy recorded the last time this frame slot was used has too. Slots are
+// handed over in frame order, which streams depend on.
+void engineReadbackCollect(Engine* engine) {
+  if (engine->config.readbackFormat == READBACK_NONE) return;
+  ReadbackSlot* slot = &engine->readback.slots[engine->currentFrame];
+  if (atomic_load(&slot->state) == READBACK_PENDING && engineTimelineReached(engine, engine->graphicsTimeline, slot->value)) readbackSubmit(engine, engine->currentFrame);
+}
+
+// Record the copy of the rendered image into this frame's staging buffer,
+// after the render pass has ended.
+void engineReadbackRecord(Engine* engine, VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+  Readback* readback = &engine->readback;
+  if (engine->config.readbackFormat == READBACK_NONE) return;
+  ReadbackSlot* slot = &readback->slots[engine->currentFrame];
+  if (atomic_load(&slot->state) != READBACK_FREE) {
+    readback->framesDropped++;
+    return;
+  }
+  readbackResizeSlot(engine, slot);
+
+  VkImageLayout finalLayout = engine->config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  VkImageMemoryBarrier imageBarrier;
+  memset(&imageBarrier, 0, sizeof(VkImageMemoryBarrier));
+  imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  imageBarrier.oldLayout = finalLayout;
+  imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.image = engine->swapChainImages[imageIndex];
+  imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  imageBarrier.subresourceRange.levelCount = 1;
+  imageBarrier.subresourceRange.layerCount = 1;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageBarrier);
+
+  VkBufferImageCopy region;
+  memset(&region, 0, sizeof(VkBufferImageCopy));
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent.width = engine->extent.width;
+  region.imageExtent.height = engine->extent.height;
+  region.imageExtent.depth = 1;
+  vkCmdCopyImageToBuffer(commandBuffer, engine->swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer, 1, &region);
+
+  VkBufferMemoryBarrier bufferBarrier;
+  memset(&bufferBarrier, 0, sizeof(VkBufferMemoryBarrier));
+  bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  bufferBarrier.buffer = slot->buffer;
+  bufferBarrier.size = VK_WHOLE_SIZE;
+
+  // Swapchain images go back to the layout the present expects.
+  imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  imageBarrier.dstAccessMask = 0;
+  imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  imageBarrier.newLayout = finalLayout;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 1, &bufferBarrier, engine->config.headless ? 0 : 1, &imageBarrier);
+
+  slot->width = engine->extent.width;
+  slot->height = engine->extent.height;
+  slot->frame = engine->frameCount;
+  slot->recorded = 1;
+}
+
+// Called with the value of the frame's graphics submission, which is only
+// known once submitted: uploads flushed after recording can share the
+// graphics timeline.
+void engineReadbackSubmitted(Engine* engine, uint64_t value) {
+  if (engine->config.readbackFormat == READBACK_NONE) return;
+  ReadbackSlot* slot = &engine->readback.slots[engine->currentFrame];
+  if (!slot->recorded) return;
+  slot->recorded = 0;
+  slot->value = value;
+  atomic_store(&slot->state, READBACK_PENDING);
+}
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+#define RECORD_BENCH_ITERATIONS 10
+// Below this many draws per thread waking the workers costs more than it saves.
+#define RECORD_MIN_DRAWS_PER_THREAD 32
+
+// Dynamic state is not inherited by secondary command buffers, so every
+// buffer that draws sets it again.
+void engineSetViewport(Engine* engine, VkCommandBuffer commandBuffer) {
+  VkViewport viewport;
+  memset(&viewport, 0, sizeof(VkViewport));
+  viewport.x = 0.0f;
+  viewport.y = 0.0f;
+  viewport.width = (float)engine->renderExtent.width;
+  viewport.height = (float)engine->renderExtent.height;
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+  VkRect2D scissor;
+  memset(&scissor, 0, sizeof(VkRect2D));
+  scissor.offset.x = 0;
+  scissor.offset.y = 0;
+  scissor.extent = engine->renderExtent;
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
+
+// The slice starting at draw 0 also records the GPU-culled indirect draws and
+// the instanced ones ahead of the sorted render queue.
+void recorderRecordDraws(Engine* engine, VkCommandBuffer commandBuffer, uint32_t first, uint32_t count, BindCounters* counters) {
+  if (first == 0) {
+    engineIndirectDraw(engine, commandBuffer);
+    engineInstancerDraw(engine, commandBuffer);
+  }
+  engineRenderQueueRecord(engine, commandBuffer, first, count, counters);
+}
+
+// Record this thread's slice into its secondary buffer for the current frame.
+// The frame's last submission has completed, so resetting the whole pool is
+// safe.
+void recorderRecordSlice(Engine* engine, RecordThread* thread) {
+  Recorder* recorder = &engine->recorder;
+  VkCommandBuffer commandBuffer = thread->commandBuffers[engine->currentFrame];
+  vkResetCommandPool(engine->device, thread->commandPools[engine->currentFrame], 0);
+
+  VkCommandBufferInheritanceInfo inheritanceInfo;
+  memset(&inheritanceInfo, 0, sizeof(VkCommandBufferInheritanceInfo));
+  inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritanceInfo.renderPass = engine->renderPass;
+  inheritanceInfo.subpass = 0;
+  inheritanceInfo.framebuffer = recorder->framebuffer;
+
+  VkCommandBufferBeginInfo beginInfo;
+  memset(&beginInfo, 0, sizeof(VkCommandBufferBeginInfo));
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  beginInfo.pInheritanceInfo = &inheritanceInfo;
+  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+    printf("Begin secondary command buffer failed!\n");
+    exit(1);
+  }
+  engineSetViewport(engine, commandBuffer);
+  recorderRecordDraws(engine, commandBuffer, thread->first, thread->count, &thread->counters);
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    printf("Failed to record secondary command buffer!\n");
+    exit(1);
+  }
+}
+
+void* recorderThread(void* data) {
+  RecordThread* thread = data;
+  Recorder* recorder = &thread->engine->recorder;
+  uint64_t generation = 0;
+  pthread_mutex_lock(&recorder->mutex);
+  while (1) {
+    while (!recorder->stop && recorder->generation == generation) pthread_cond_wait(&recorder->start, &recorder->mutex);
+    if (recorder->stop) break;
+    generation = recorder->generation;
+    int active = thread->index < recorder->activeCount;
+    pthread_mutex_unlock(&recorder->mutex);
+    if (active) recorderRecordSlice(thread->engine, thread);
+    pthread_mutex_lock(&recorder->mutex);
+    if (active && --recorder->pending == 0) pthread_cond_signal(&recorder->done);
+  }
+  pthread_mutex_unlock(&recorder->mutex);
+  return NULL;
+}
+
+void engineCreateRecorder(Engine* engine) {
+  Recorder* recorder = &engine->recorder;
+  recorder->threadCount = engine->config.recordThreads;
+  if (recorder->threadCount == 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    recorder->threadCount = cores < 1 ? 1 : cores;
+  }
+  if (recorder->threadCount > RECORD_MAX_THREADS) recorder->threadCount = RECORD_MAX_THREADS;
+  pthread_mutex_init(&recorder->mutex, NULL);
+  pthread_cond_init(&recorder->start, NULL);
+  pthread_cond_init(&recorder->done, NULL);
+
+  for (uint32_t n = 0; n < recorder->threadCount; n++) {
+    RecordThread* thread = &recorder->threads[n];
+    thread->engine = engine;
+    thread->index = n;
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+      VkCommandPoolCreateInfo poolInfo;
+      memset(&poolInfo, 0, sizeof(VkCommandPoolCreateInfo));
+      poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+      poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+      poolInfo.queueFamilyIndex = engine->queueFamilyIndex;
+      if (vkCreateCommandPool(engine->device, &poolInfo, NULL, &thread->commandPools[frame]) != VK_SUCCESS) {
+        printf("Record command pool creation failed!\n");
+        exit(1);
+      }
+
+      VkCommandBufferAllocateInfo allocInfo;
+      memset(&allocInfo, 0, sizeof(VkCommandBufferAllocateInfo));
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = thread->commandPools[frame];
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+      allocInfo.commandBufferCount = 1;
+      if (vkAllocateCommandBuffers(engine->device, &allocInfo, &thread->commandBuffers[frame]) != VK_SUCCESS) {
+        printf("Secondary command buffer creation failed!\n");
+        exit(1);
+      }
+    }
+    if (n > 0 && pthread_create(&thread->thread, NULL, recorderThread, thread) != 0) {
+      printf("Failed to create record thread!\n");
+      exit(1);
+    }
+  }
+}
+
+void engineDestroyRecorder(Engine* engine) {
+  Recorder* recorder = &engine->recorder;
+  pthread_mutex_lock(&recorder->mutex);
+  recorder->stop = 1;
+  pthread_cond_broadcast(&recorder->start);
+  pthread_mutex_unlock(&recorder->mutex);
+  for (uint32_t n = 0; n < recorder->threadCount; n++) {
+    if (n > 0) pthread_join(recorder->threads[n].thread, NULL);
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+      vkDestroyCommandPool(engine->device, recorder->threads[n].commandPools[frame], NULL);
+    }
+  }
+  pthread_mutex_destroy(&recorder->mutex);
+  pthread_cond_destroy(&recorder->start);
+  pthread_cond_destroy(&recorder->done);
+}
+
+// Sum the slices' bind counters into the queue's counts for this frame.
+void recorderCollectCounters(Engine* engine, uint32_t threadCount) {
+  BindCounters* frame = &engine->renderQueue.frame;
+  memset(frame, 0, sizeof(BindCounters));
+  for (uint32_t n = 0; n < threadCount; n++) {
+    for (int type = 0; type < BIND_TYPE_COUNT; type++) {
+      frame->issued[type] += engine->recorder.threads[n].counters.issued[type];
+      frame->elided[type] += engine->recorder.threads[n].counters.elided[type];
+    }
+  }
+}
+
+// Record the render pass into commandBuffer from the sorted render queue.
+// With more than one thread the draws are split into contiguous slices
+// recorded in parallel into secondary buffers, the main thread taking the
+// first slice, and executed in order. Deferred lighting follows inline in
+// its own subpass.
+void engineRecordRenderPass(Engine* engine, VkCommandBuffer commandBuffer, VkRenderPassBeginInfo* renderPassInfo, uint32_t drawCount, uint32_t threadCount) {
+  Recorder* recorder = &engine->recorder;
+  if (threadCount > recorder->threadCount) threadCount = recorder->threadCount;
+  if (threadCount > drawCount / RECORD_MIN_DRAWS_PER_THREAD) threadCount = drawCount / RECORD_MIN_DRAWS_PER_THREAD;
+  // The Hi-Z statistics query spans the pass, and secondary buffers don't
+  // inherit it, so a counted frame is recorded inline.
+  if (engine->hiz.recorded[engine->currentFrame]) threadCount = 1;
+  for (uint32_t n = 0; n < recorder->threadCount; n++) memset(&recorder->threads[n].counters, 0, sizeof(BindCounters));
+
+  if (threadCount <= 1) {
+    vkCmdBeginRenderPass(commandBuffer, renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    engineSetViewport(engine, commandBuffer);
+    recorderRecordDraws(engine, commandBuffer, 0, drawCount, &recorder->threads[0].counters);
+    engineDeferredLighting(engine, commandBuffer);
+    vkCmdEndRenderPass(commandBuffer);
+    recorderCollectCounters(engine, 1);
+    return;
+  }
+
+  vkCmdBeginRenderPass(commandBuffer, renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+  pthread_mutex_lock(&recorder->mutex);
+  for (uint32_t n = 0; n < threadCount; n++) {
+    recorder->threads[n].first = (uint64_t)drawCount * n / threadCount;
+    recorder->threads[n].count = (uint64_t)drawCount * (n + 1) / threadCount - recorder->threads[n].first;
+  }
+  recorder->activeCount = threadCount;
+  recorder->framebuffer = renderPassInfo->framebuffer;
+  recorder->pending = threadCount - 1;
+  recorder->generation++;
+  pthread_cond_broadcast(&recorder->start);
+  pthread_mutex_unlock(&recorder->mutex);
+
+  recorderRecordSlice(engine, &recorder->threads[0]);
+
+  pthread_mutex_lock(&recorder->mutex);
+  while (recorder->pending > 0) pthread_cond_wait(&recorder->done, &recorder->mutex);
+  pthread_mutex_unlock(&recorder->mutex);
+
+  VkCommandBuffer secondaries[RECORD_MAX_THREADS];
+  for (uint32_t n = 0; n < threadCount; n++) secondaries[n] = recorder->threads[n].commandBuffers[engine->currentFrame];
+  vkCmdExecuteCommands(commandBuffer, threadCount, secondaries);
+  engineDeferredLighting(engine, commandBuffer);
+  vkCmdEndRenderPass(commandBuffer);
+  recorderCollectCounters(engine, threadCount);
+}
+
+// Time recording 1k to 100k draws with 1, 2, 4... threads up to the pool size,
+// cycling through the registered pipelines. Nothing is submitted, so only CPU
+// recording cost is measured.
+void engineBenchmarkRecording(Engine* engine) {
+  Recorder* recorder = &engine->recorder;
+  if (engine->pipelineCount == 0) return;
+  vkDeviceWaitIdle(engine->device);
+  engineRenderQueueSort(engine);
+
+  VkCommandBuffer commandBuffer = engine->commandBuffers[engine->currentFrame];
+  VkRenderPassBeginInfo renderPassInfo;
+  memset(&renderPassInfo, 0, sizeof(VkRenderPassBeginInfo));
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  renderPassInfo.renderPass = engine->renderPass;
+  renderPassInfo.framebuffer = engine->swapChainFramebuffers[0];
+  renderPassInfo.renderArea.extent = engine->renderExtent;
+  VkClearValue clearValues[2];
+  memset(&clearValues, 0, sizeof(clearValues));
+  renderPassInfo.clearValueCount = 2;
+  renderPassInfo.pClearValues = clearValues;
+
+  uint32_t drawCounts[] = {1000, 10000, 100000};
+  for (int d = 0; d < sizeof(drawCounts) / sizeof(drawCounts[0]); d++) {
+    double baseline = 0.0;
+    for (uint32_t threads = 1;; threads = threads * 2 < recorder->threadCount ? threads * 2 : recorder->threadCount) {
+      double best = 0.0;
+      for (int iteration = 0; iteration < RECORD_BENCH_ITERATIONS; iteration++) {
+        double startTime = getTime();
+        vkResetCommandBuffer(commandBuffer, 0);
+        VkCommandBufferBeginInfo beginInfo;
+        memset(&beginInfo, 0, sizeof(VkCommandBufferBeginInfo));
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        engineRecordRenderPass(engine, commandBuffer, &renderPassInfo, drawCounts[d], threads);
+        vkEndCommandBuffer(commandBuffer);
+        double elapsed = getTime() - startTime;
+        if (iteration == 0 || elapsed < best) best = elapsed;
+      }
+      if (threads == 1) baseline = best;
+      BindCounters* counters = &engine->renderQueue.frame;
+      printf("Record %6u draws on %2u threads: %8.3f ms (%.2fx), pipeline binds %lu issued %lu elided\n", drawCounts[d], threads, best * 1000.0, baseline / best, counters->issued[BIND_PIPELINE], counters->elided[BIND_PIPELINE]);
+      if (threads >= recorder->threadCount) break;
+    }
+  }
+  vkResetCommandBuffer(commandBuffer, 0);
+  memset(&engine->renderQueue.frame, 0, sizeof(BindCounters));
+  engineRenderQueueClear(engine);
+}
@@ -0,0 +1,196 @@
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+int reloadHasSuffix(const char* name, const char* suffix) {
+  size_t nameLength = strlen(name);
+  size_t suffixLength = strlen(suffix);
+  return nameLength > suffixLength && strcmp(name + nameLength - suffixLength, suffix) == 0;
+}
+
+// Compile GLSL next to itself as the Makefile does. The new .spv arrives as
+// a change of its own; on an error glslc leaves the old one, and so the old
+// pipeline, in place.
+void reloadCompile(Engine* engine, const char* path) {
+  ShaderReload* reload = &engine->reload;
+  if (strchr(path, '\'')) return;
+  char command[PATH_MAX * 2 + 32];
+  snprintf(command, sizeof(command), "glslc '%s' -o '%s.spv'", path, path);
+  if (system(command) == 0) return;
+  printf("Shader reload: %s failed to compile, keeping the old pipeline\n", path);
+  pthread_mutex_lock(&reload->mutex);
+  reload->failures++;
+  pthread_mutex_unlock(&reload->mutex);
+}
+
+// Rebuild every live pipeline using the SPIR-V at path. Sources are copied
+// out so that the lock isn't held while the driver compiles.
+void reloadRebuild(Engine* engine, const char* path) {
+  ShaderReload* reload = &engine->reload;
+  pthread_mutex_lock(&reload->mutex);
+  uint32_t count = reload->sourceCount;
+  pthread_mutex_unlock(&reload->mutex);
+  for (uint32_t n = 0; n < count; n++) {
+    pthread_mutex_lock(&reload->mutex);
+    PipelineSource source = reload->sources[n];
+    pthread_mutex_unlock(&reload->mutex);
+    if (!source.pipeline) continue;
+    if (strcmp(source.vertPath, path) != 0 && strcmp(source.fragPath, path) != 0) continue;
+
+    double startTime = getTime();
+    VkPipeline pipeline = pipelineBuild(engine, &source);
+    pthread_mutex_lock(&reload->mutex);
+    if (pipeline && reload->readyCount < MAX_PIPELINE_SOURCES) {
+      reload->ready[reload->readyCount].source = n;
+      reload->ready[reload->readyCount].pipeline = pipeline;
+      reload->readyCount++;
+      printf("Shader reload: rebuilt pipeline from %s in %.1f ms\n", path, (getTime() - startTime) * 1000.0);
+    } else {
+      if (pipeline) vkDestroyPipeline(engine->device, pipeline, NULL);
+      reload->failures++;
+      printf("Shader reload: failed to rebuild pipeline from %s, keeping the old one\n", path);
+    }
+    pthread_mutex_unlock(&reload->mutex);
+  }
+}
+
+void* reloadThread(void* data) {
+  Engine* engine = data;
+  ShaderReload* reload = &engine->reload;
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  while (!atomic_load(&reload->stop)) {
+    // Wake regularly to notice shutdown.
+    struct pollfd pollFd = {reload->watch, POLLIN, 0};
+    if (poll(&pollFd, 1, 100) <= 0) continue;
+    ssize_t length = read(reload->watch, buffer, sizeof(buffer));
+    for (ssize_t offset = 0; offset < length;) {
+      struct inotify_event* event = (struct inotify_event*)(buffer + offset);
+      offset += sizeof(struct inotify_event) + event->len;
+      if (event->len == 0) continue;
+      char path[PATH_MAX];
+      snprintf(path, sizeof(path), SHADER_DIR "/%s", event->name);
+      if (reloadHasSuffix(event->name, ".spv")) {
+        reloadRebuild(engine, path);
+      } else if (reloadHasSuffix(event->name, ".vert") || reloadHasSuffix(event->name, ".frag") || reloadHasSuffix(event->name, ".comp")) {
+        reloadCompile(engine, path);
+      }
+    }
+  }
+  return NULL;
+}
+
+void engineCreateReload(Engine* engine) {
+  ShaderReload* reload = &engine->reload;
+  pthread_mutex_init(&reload->mutex, NULL);
+  reload->watch = -1;
+  if (!engine->config.hotReload) return;
+  reload->watch = inotify_init1(IN_CLOEXEC);
+  if (reload->watch < 0 || inotify_add_watch(reload->watch, SHADER_DIR, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    printf("Failed to watch %s, shader hot reload disabled\n", SHADER_DIR);
+    if (reload->watch >= 0) close(reload->watch);
+    reload->watch = -1;
+    return;
+  }
+  pthread_create(&reload->thread, NULL, reloadThread, engine);
+}
+
+// Called first thing on shutdown, before any pipeline owner destroys its own.
+void engineDestroyReload(Engine* engine) {
+  ShaderReload* reload = &engine->reload;
+  if (reload->watch >= 0) {
+    atomic_store(&reload->stop, 1);
+    pthread_join(reload->thread, NULL);
+    close(reload->watch);
+  }
+  vkDeviceWaitIdle(engine->device);
+  for (uint32_t n = 0; n < reload->readyCount; n++) vkDestroyPipeline(engine->device, reload->ready[n].pipeline, NULL);
+  if (reload->reloads || reload->failures) printf("Shader reload: %lu pipelines swapped, %lu failures\n", reload->reloads, reload->failures);
+  pthread_mutex_destroy(&reload->mutex);
+}
+
+// Remember how a pipeline was built. A handle the driver has reused belongs
+// to the new source from now on.
+void engineRegisterPipelineSource(Engine* engine, PipelineSource* source) {
+  ShaderReload* reload = &engine->reload;
+  pthread_mutex_lock(&reload->mutex);
+  for (uint32_t n = 0; n < reload->sourceCount; n++) {
+    if (reload->sources[n].pipeline == source->pipeline) reload->sources[n].pipeline = VK_NULL_HANDLE;
+  }
+  if (reload->sourceCount < MAX_PIPELINE_SOURCES) reload->sources[reload->sourceCount++] = *source;
+  pthread_mutex_unlock(&reload->mutex);
+}
+
+// Point every engine-owned slot holding old at replacement. Returns how many
+// did.
+uint32_t reloadReplace(Engine* engine, VkPipeline old, VkPipeline replacement) {
+  uint32_t replaced = 0;
+  for (int n = 0; n < engine->pipelineCount; n++) {
+    if (engine->pipelines[n] == old) {
+      engine->pipelines[n] = replacement;
+      replaced++;
+    }
+  }
+  Instancer* instancer = &engine->instancer;
+  if (instancer->pipeline == old) {
+    instancer->pipeline = replacement;
+    replaced++;
+  }
+  for (uint32_t n = 0; n < instancer->batchCount; n++) {
+    if (instancer->batches[n].pipeline == old) instancer->batches[n].pipeline = replacement;
+  }
+  if (engine->indirect.cullPipeline == old) {
+    engine->indirect.cullPipeline = replacement;
+    replaced++;
+  }
+  if (engine->indirect.drawPipeline == old) {
+    engine->indirect.drawPipeline = replacement;
+    replaced++;
+  }
+  if (engine->indirect.prepassPipeline == old) {
+    engine->indirect.prepassPipeline = replacement;
+    replaced++;
+  }
+  if (engine->indirect.equalPipeline == old) {
+    engine->indirect.equalPipeline = replacement;
+    replaced++;
+  }
+  if (engine->deferred.lightingPipeline == old) {
+    engine->deferred.lightingPipeline = replacement;
+    replaced++;
+  }
+  if (engine->hiz.buildPipeline == old) {
+    engine->hiz.buildPipeline = replacement;
+    replaced++;
+  }
+  return replaced;
+}
+
+// Called before anything is recorded. Swaps rebuilt pipelines into their
+// slots. A replaced pipeline may still be used by the frames in flight, so
+// it goes on the deletion queue. Pipelines held only outside the engine's
+// slots are rebuilt but never swapped, so callers should keep slot indices
+// instead.
+void engineReloadBeginFrame(Engine* engine) {
+  ShaderReload* reload = &engine->reload;
+  if (reload->watch < 0) return;
+  pthread_mutex_lock(&reload->mutex);
+  for (uint32_t n = 0; n < reload->readyCount; n++) {
+    PipelineSource* source = &reload->sources[reload->ready[n].source];
+    VkPipeline pipeline = reload->ready[n].pipeline;
+    if (!source->pipeline || !reloadReplace(engine, source->pipeline, pipeline)) {
+      vkDestroyPipeline(engine->device, pipeline, NULL);
+      continue;
+    }
+    engineDeferDestroy(engine, DELETE_PIPELINE, (uint64_t)source->pipeline);
+    source->pipeline = pipeline;
+    reload->reloads++;
+  }
+  reload->readyCount = 0;
+  pthread_mutex_unlock(&reload->mutex);
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+#define RESIZE_BENCH_STEPS 200
+#define RESIZE_BENCH_FRAMES 3
+#define RESIZE_BENCH_BASELINE_FRAMES 60
+
+// Build a swapchain for the window's new size, handing the old one over as
+// oldSwapchain. The old one and everything built on it go on the deletion
+// queue until the frames in flight are done with them, so the device never
+// idles.
+void engineRecreateSwapChain(Engine* engine) {
+  int width, height;
+  glfwGetFramebufferSize(engine->window, &width, &height);
+  // A minimised window has no size to build a swapchain for.
+  while (width == 0 || height == 0) {
+    glfwWaitEvents();
+    glfwGetFramebufferSize(engine->window, &width, &height);
+  }
+
+  for (uint32_t n = 0; n < engine->swapChainImageCount; n++) {
+    engineDeferDestroy(engine, DELETE_FRAMEBUFFER, (uint64_t)engine->swapChainFramebuffers[n]);
+    engineDeferDestroy(engine, DELETE_IMAGE_VIEW, (uint64_t)engine->swapChainImageViews[n]);
+  }
+  free(engine->swapChainFramebuffers);
+  free(engine->swapChainImageViews);
+  free(engine->swapChainImages);
+  engineDeferDestroy(engine, DELETE_IMAGE_VIEW, (uint64_t)engine->depthImageView);
+  engineDeferDestroy(engine, DELETE_IMAGE, (uint64_t)engine->depthImage);
+  engineDeferFree(engine, &engine->depthImageMemory);
+  VkSwapchainKHR oldSwapChain = engine->swapChain;
+
+  engineCreateSwapChain(engine);
+  engineDeferDestroy(engine, DELETE_SWAPCHAIN, (uint64_t)oldSwapChain);
+  engine->swapChainRecreations++;
+}
+
+size_t resizeResidentBytes(void) {
+  FILE* file = fopen("/proc/self/statm", "r");
+  if (!file) return 0;
+  unsigned long pages = 0;
+  if (fscanf(file, "%*lu %lu", &pages) != 1) pages = 0;
+  fclose(file);
+  return pages * sysconf(_SC_PAGESIZE);
+}
+
+VkDeviceSize resizeDeviceBytes(Engine* engine) {
+  VkDeviceSize bytes = 0;
+  for (uint32_t heap = 0; heap < engine->memoryProperties.memoryHeapCount; heap++) {
+    bytes += engine->allocator.heaps[heap].blockBytes + engine->allocator.heaps[heap].dedicatedBytes;
+  }
+  return bytes;
+}
+
+// Resize the window every few frames and watch for frame time spikes and
+// for host or device memory that grows with the number of resizes.
+void engineBenchmarkResize(Engine* engine) {
+  if (engine->config.headless) {
+    printf("The resize benchmark resizes the window, run it without --headless\n");
+    return;
+  }
+  int width, height;
+  glfwGetWindowSize(engine->window, &width, &height);
+
+  double baseline = getTime();
+  for (int n = 0; n < RESIZE_BENCH_BASELINE_FRAMES; n++) engineRunFrame(engine);
+  baseline = (getTime() - baseline) / RESIZE_BENCH_BASELINE_FRAMES;
+
+  uint32_t recreations = engine->swapChainRecreations;
+  size_t residentStart = resizeResidentBytes();
+  VkDeviceSize deviceStart = resizeDeviceBytes(engine);
+  double total = 0;
+  double worst = 0;
+  uint32_t spikes = 0;
+  for (int step = 0; step < RESIZE_BENCH_STEPS; step++) {
+    int shrink = step % 2 ? 16 * (step % 8 + 1) : 0;
+    glfwSetWindowSize(engine->window, width - shrink, height - shrink);
+    for (int n = 0; n < RESIZE_BENCH_FRAMES; n++) {
+      double startTime = getTime();
+      engineRunFrame(engine);
+      double elapsed = getTime() - startTime;
+      total += elapsed;
+      if (elapsed > worst) worst = elapsed;
+      if (elapsed > baseline * 4) spikes++;
+    }
+    if (step % 50 == 49) {
+      printf("Resize %3d: %u recreations, %u objects awaiting deletion, host %.1f MB, device %.1f MB\n", step + 1, engine->swapChainRecreations - recreations, engine->deletion.count, resizeResidentBytes() / 1048576.0, resizeDeviceBytes(engine) / 1048576.0);
+    }
+  }
+  glfwSetWindowSize(engine->window, width, height);
+  for (int n = 0; n < RESIZE_BENCH_FRAMES; n++) engineRunFrame(engine);
+  vkDeviceWaitIdle(engine->device);
+
+  uint32_t frames = RESIZE_BENCH_STEPS * RESIZE_BENCH_FRAMES;
+  printf("Resize: %d resizes, %u swapchain recreations, %.3f ms/frame (%.3f ms before resizing), %.3f ms worst, %u frames over 4x\n", RESIZE_BENCH_STEPS, engine->swapChainRecreations - recreations, total * 1000.0 / frames, baseline * 1000.0, worst * 1000.0, spikes);
+  printf("Resize: host memory %+.1f MB, device memory %+.1f MB\n", ((double)resizeResidentBytes() - residentStart) / 1048576.0, ((double)resizeDeviceBytes(engine) - deviceStart) / 1048576.0);
+}
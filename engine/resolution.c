@@ -0,0 +1,179 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+#define RESOLUTION_MIN_SCALE 0.5f
+// Aim a little under the target so noise doesn't push frames over it.
+#define RESOLUTION_HEADROOM 0.9
+// How far towards the wanted scale each new GPU time moves it: quickly down
+// to recover from a heavy frame, slowly back up so the scale doesn't hunt.
+#define RESOLUTION_DOWN_RATE 0.5f
+#define RESOLUTION_UP_RATE 0.1f
+// A frame this far over the target counts as a hitch.
+#define RESOLUTION_HITCH 1.5
+#define RESOLUTION_LOG_INTERVAL 1.0
+
+// Called before the render pass is created, whose colour attachment goes to
+// the scene target rather than the swapchain image when this is enabled.
+void engineCreateResolution(Engine* engine) {
+  Resolution* resolution = &engine->resolution;
+  resolution->scale = 1.0f;
+  if (engine->config.targetFrameTime <= 0) return;
+
+  // The upscale blits into the swapchain image.
+  if (!engine->config.headless) {
+    VkSurfaceCapabilitiesKHR capabilities;
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(engine->physicalDevice, engine->surface, &capabilities);
+    if (!(capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+      printf("Dynamic resolution disabled: swapchain images can't be blitted to\n");
+      return;
+    }
+  }
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(engine->physicalDevice, VK_FORMAT_B8G8R8A8_SRGB, &formatProperties);
+  resolution->filter = formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+  resolution->minScale = 1.0f;
+  resolution->maxScale = 0.0f;
+  resolution->lastLog = getTime();
+  resolution->enabled = 1;
+}
+
+void resolutionSetRenderExtent(Engine* engine) {
+  float scale = engine->resolution.enabled ? engine->resolution.scale : 1.0f;
+  engine->renderExtent.width = (uint32_t)(engine->extent.width * scale + 0.5f);
+  engine->renderExtent.height = (uint32_t)(engine->extent.height * scale + 0.5f);
+  if (engine->renderExtent.width < 1) engine->renderExtent.width = 1;
+  if (engine->renderExtent.height < 1) engine->renderExtent.height = 1;
+  if (engine->renderExtent.width > engine->extent.width) engine->renderExtent.width = engine->extent.width;
+  if (engine->renderExtent.height > engine->extent.height) engine->renderExtent.height = engine->extent.height;
+}
+
+// Called with each new extent, before the framebuffers are built on the
+// scene target. It is sized for the full extent, so any scale fits.
+void engineResizeResolution(Engine* engine) {
+  Resolution* resolution = &engine->resolution;
+  resolutionSetRenderExtent(engine);
+  if (!resolution->enabled) return;
+  engineDeferDestroy(engine, DELETE_IMAGE_VIEW, (uint64_t)resolution->view);
+  engineDeferDestroy(engine, DELETE_IMAGE, (uint64_t)resolution->image);
+  engineDeferFree(engine, &resolution->memory);
+  engineCreateImage(engine, engine->extent.width, engine->extent.height, 1, VK_FORMAT_B8G8R8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1, &resolution->image, &resolution->memory);
+  engineCreateImageView(engine, resolution->image, VK_FORMAT_B8G8R8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, &resolution->view);
+}
+
+// Called once the device is idle.
+void engineDestroyResolution(Engine* engine) {
+  Resolution* resolution = &engine->resolution;
+  if (!resolution->enabled) return;
+  vkDestroyImageView(engine->device, resolution->view, NULL);
+  vkDestroyImage(engine->device, resolution->image, NULL);
+  engineFree(engine, &resolution->memory);
+}
+
+void resolutionLog(Engine* engine) {
+  Resolution* resolution = &engine->resolution;
+  if (!resolution->frames) return;
+  printf("Resolution: scale %.2f avg (%.2f-%.2f), %ux%u of %ux%u, GPU %.3f ms avg %.3f ms worst (target %.3f ms), %u hitches\n", resolution->scaleTotal / resolution->frames, resolution->minScale, resolution->maxScale, engine->renderExtent.width, engine->renderExtent.height, engine->extent.width, engine->extent.height, resolution->frameTimeTotal / resolution->frames, resolution->worstFrameTime, engine->config.targetFrameTime, resolution->hitches);
+  resolution->frames = 0;
+  resolution->hitches = 0;
+  resolution->frameTimeTotal = 0.0;
+  resolution->worstFrameTime = 0.0;
+  resolution->scaleTotal = 0.0;
+  resolution->minScale = 1.0f;
+  resolution->maxScale = 0.0f;
+}
+
+// Called once per frame after the profiler has collected, to pick this
+// frame's render extent. Each new GPU frame time moves the scale towards the
+// one that would have hit the target, taking GPU time to follow the pixel
+// count. The time is from a frame recorded up to MAX_FRAMES_IN_FLIGHT ago,
+// so it is corrected from the scale that frame used rather than the current
+// one, or corrections still in flight would compound.
+void engineResolutionUpdate(Engine* engine) {
+  Resolution* resolution = &engine->resolution;
+  Profiler* profiler = &engine->profiler;
+  if (resolution->enabled && profiler->collected != resolution->collected && profiler->frameTime > 0) {
+    resolution->collected = profiler->collected;
+    double target = engine->config.targetFrameTime;
+    float wanted = profiler->frameScale * sqrt(target * RESOLUTION_HEADROOM / profiler->frameTime);
+    if (wanted < RESOLUTION_MIN_SCALE) wanted = RESOLUTION_MIN_SCALE;
+    if (wanted > 1.0f) wanted = 1.0f;
+    resolution->scale += (wanted - resolution->scale) * (wanted < resolution->scale ? RESOLUTION_DOWN_RATE : RESOLUTION_UP_RATE);
+
+    int hitch = profiler->frameTime > target * RESOLUTION_HITCH;
+    resolution->frames++;
+    resolution->hitches += hitch;
+    resolution->frameTimeTotal += profiler->frameTime;
+    if (profiler->frameTime > resolution->worstFrameTime) resolution->worstFrameTime = profiler->frameTime;
+    resolution->scaleTotal += resolution->scale;
+    if (resolution->scale < resolution->minScale) resolution->minScale = resolution->scale;
+    if (resolution->scale > resolution->maxScale) resolution->maxScale = resolution->scale;
+    resolution->totalFrames++;
+    resolution->totalHitches += hitch;
+    resolution->totalFrameTime += profiler->frameTime;
+    resolution->totalScale += resolution->scale;
+  }
+  resolutionSetRenderExtent(engine);
+  if (resolution->enabled && getTime() - resolution->lastLog >= RESOLUTION_LOG_INTERVAL) {
+    resolutionLog(engine);
+    resolution->lastLog = getTime();
+  }
+}
+
+// Recorded after the main render pass, which leaves the scene target ready to
+// be read: scales its render extent up to the whole swapchain image and
+// leaves that in the layout the render pass would have.
+void engineResolutionUpscale(Engine* engine, VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+  Resolution* resolution = &engine->resolution;
+  if (!resolution->enabled) return;
+  VkImageMemoryBarrier barriers[2];
+  memset(barriers, 0, sizeof(barriers));
+  for (int n = 0; n < 2; n++) {
+    barriers[n].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[n].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[n].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[n].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barriers[n].subresourceRange.levelCount = 1;
+    barriers[n].subresourceRange.layerCount = 1;
+  }
+  barriers[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barriers[0].image = resolution->image;
+  // Waiting at colour output chains onto the acquire semaphore's wait.
+  barriers[1].srcAccessMask = 0;
+  barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barriers[1].image = engine->swapChainImages[imageIndex];
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 2, barriers);
+
+  VkImageBlit region;
+  memset(&region, 0, sizeof(VkImageBlit));
+  region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.srcSubresource.layerCount = 1;
+  region.srcOffsets[1] = (VkOffset3D){(int32_t)engine->renderExtent.width, (int32_t)engine->renderExtent.height, 1};
+  region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.dstSubresource.layerCount = 1;
+  region.dstOffsets[1] = (VkOffset3D){(int32_t)engine->extent.width, (int32_t)engine->extent.height, 1};
+  vkCmdBlitImage(commandBuffer, resolution->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, engine->swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, resolution->filter);
+
+  // Readback copies from it afterwards, from colour output onwards.
+  barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barriers[1].newLayout = engine->config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, NULL, 0, NULL, 1, &barriers[1]);
+}
+
+// Totals over the run.
+void engineResolutionReport(Engine* engine) {
+  Resolution* resolution = &engine->resolution;
+  if (!resolution->enabled || !resolution->totalFrames) return;
+  resolutionLog(engine);
+  printf("Resolution: %lu frames at scale %.2f avg, GPU %.3f ms avg (target %.3f ms), %lu hitches over %.3f ms (%.1f%%)\n", resolution->totalFrames, resolution->totalScale / resolution->totalFrames, resolution->totalFrameTime / resolution->totalFrames, engine->config.targetFrameTime, resolution->totalHitches, engine->config.targetFrameTime * RESOLUTION_HITCH, 100.0 * resolution->totalHitches / resolution->totalFrames);
+}
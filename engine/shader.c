@@ -0,0 +1,259 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+#define SPIRV_MAGIC 0x07230203
+#define SHADER_ARCHIVE_MAGIC 0x41565053  // "SPVA"
+#define SHADER_ARCHIVE_VERSION 1
+
+// A SPIR-V module is at least its five word header, a whole number of words
+// and word aligned, and starts with the magic number in host byte order.
+int shaderValid(const void* code, size_t size) {
+  if (size < 20 || size % 4 != 0 || (uintptr_t)code % 4 != 0) return 0;
+  return *(const uint32_t*)code == SPIRV_MAGIC;
+}
+
+// Map a file read-only. Returns NULL if it can't be opened or is empty.
+void* shaderMapFile(const char* path, size_t* size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return NULL;
+  *size = st.st_size;
+  return mapping;
+}
+
+// Map the archive named by config.shaderArchive in one go. Its shaders are
+// used in place of the loose files unless hot reload is watching those.
+void engineCreateShaders(Engine* engine) {
+  ShaderCache* shaders = &engine->shaders;
+  pthread_mutex_init(&shaders->mutex, NULL);
+  if (!engine->config.shaderArchive) return;
+  if (engine->config.hotReload) {
+    printf("Shader archive %s ignored while hot reloading\n", engine->config.shaderArchive);
+    return;
+  }
+  size_t size;
+  uint8_t* archive = shaderMapFile(engine->config.shaderArchive, &size);
+  if (!archive) {
+    printf("Failed to open shader archive %s\n", engine->config.shaderArchive);
+    return;
+  }
+  ShaderArchiveHeader* header = (ShaderArchiveHeader*)archive;
+  ShaderArchiveEntry* entries = (ShaderArchiveEntry*)(header + 1);
+  int valid = size >= sizeof(ShaderArchiveHeader) && header->magic == SHADER_ARCHIVE_MAGIC && header->version == SHADER_ARCHIVE_VERSION && sizeof(ShaderArchiveHeader) + sizeof(ShaderArchiveEntry) * (size_t)header->count <= size;
+  for (uint32_t n = 0; valid && n < header->count; n++) {
+    valid = entries[n].offset + entries[n].size <= size && shaderValid(archive + entries[n].offset, entries[n].size);
+  }
+  if (!valid) {
+    printf("Discarding shader archive %s: invalid\n", engine->config.shaderArchive);
+    munmap(archive, size);
+    return;
+  }
+  shaders->archive = archive;
+  shaders->archiveSize = size;
+  shaders->archiveEntries = entries;
+  shaders->archiveCount = header->count;
+}
+
+void engineDestroyShaders(Engine* engine) {
+  ShaderCache* shaders = &engine->shaders;
+  if (shaders->hits + shaders->misses > 0) {
+    printf("Shader modules: %u created, %lu loads shared an existing module%s\n", shaders->created, shaders->hits, shaders->archive ? ", from archive" : "");
+  }
+  for (uint32_t n = 0; n < shaders->count; n++) vkDestroyShaderModule(engine->device, shaders->entries[n].module, NULL);
+  free(shaders->entries);
+  if (shaders->archive) munmap(shaders->archive, shaders->archiveSize);
+  pthread_mutex_destroy(&shaders->mutex);
+}
+
+// Returns the archived code for path, or NULL.
+ShaderArchiveEntry* shaderArchiveFind(ShaderCache* shaders, const char* path) {
+  for (uint32_t n = 0; n < shaders->archiveCount; n++) {
+    if (strcmp(shaders->archiveEntries[n].path, path) == 0) return &shaders->archiveEntries[n];
+  }
+  return NULL;
+}
+
+// Drop modules last loaded from path that no one is using and that hold
+// different code, which after a hot reload is the old version.
+void shaderEvictStale(Engine* engine, const char* path, uint64_t hash, size_t size) {
+  ShaderCache* shaders = &engine->shaders;
+  for (uint32_t n = 0; n < shaders->count;) {
+    ShaderModuleEntry* entry = &shaders->entries[n];
+    if (entry->users == 0 && strcmp(entry->path, path) == 0 && (entry->hash != hash || entry->size != size)) {
+      vkDestroyShaderModule(engine->device, entry->module, NULL);
+      *entry = shaders->entries[--shaders->count];
+    } else {
+      n++;
+    }
+  }
+}
+
+// A module for the SPIR-V at path, shared with every other user of the same
+// code, or VK_NULL_HANDLE if it can't be loaded. The code is read straight
+// from the mapping without a heap copy. Pair with engineReleaseShaderModule
+// once the pipeline is created. Safe to call from any thread.
+VkShaderModule engineAcquireShaderModule(Engine* engine, const char* path) {
+  ShaderCache* shaders = &engine->shaders;
+  const void* code;
+  size_t size;
+  uint64_t hash;
+  void* mapping = NULL;
+  size_t mappingSize = 0;
+  ShaderArchiveEntry* archived = shaderArchiveFind(shaders, path);
+  if (archived) {
+    code = shaders->archive + archived->offset;
+    size = archived->size;
+    hash = archived->hash;
+  } else {
+    mapping = shaderMapFile(path, &mappingSize);
+    if (!mapping) {
+      printf("Failed to open shader %s\n", path);
+      return VK_NULL_HANDLE;
+    }
+    code = mapping;
+    size = mappingSize;
+    if (!shaderValid(code, size)) {
+      printf("Invalid SPIR-V: %s\n", path);
+      munmap(mapping, mappingSize);
+      return VK_NULL_HANDLE;
+    }
+    hash = hashBytes(code, size);
+  }
+
+  VkShaderModule module = VK_NULL_HANDLE;
+  pthread_mutex_lock(&shaders->mutex);
+  for (uint32_t n = 0; n < shaders->count; n++) {
+    ShaderModuleEntry* entry = &shaders->entries[n];
+    if (entry->hash == hash && entry->size == size) {
+      entry->users++;
+      snprintf(entry->path, SHADER_PATH_MAX, "%s", path);
+      module = entry->module;
+      shaders->hits++;
+      break;
+    }
+  }
+  if (!module) {
+    VkShaderModuleCreateInfo createInfo;
+    memset(&createInfo, 0, sizeof(VkShaderModuleCreateInfo));
+    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    createInfo.codeSize = size;
+    createInfo.pCode = code;
+    if (vkCreateShaderModule(engine->device, &createInfo, NULL, &module) == VK_SUCCESS) {
+      shaderEvictStale(engine, path, hash, size);
+      if (shaders->count == shaders->capacity) {
+        shaders->capacity = shaders->capacity ? shaders->capacity * 2 : 16;
+        shaders->entries = realloc(shaders->entries, sizeof(ShaderModuleEntry) * shaders->capacity);
+      }
+      ShaderModuleEntry* entry = &shaders->entries[shaders->count++];
+      entry->hash = hash;
+      entry->size = size;
+      snprintf(entry->path, SHADER_PATH_MAX, "%s", path);
+      entry->module = module;
+      entry->users = 1;
+      shaders->created++;
+    } else {
+      module = VK_NULL_HANDLE;
+    }
+    shaders->misses++;
+  }
+  pthread_mutex_unlock(&shaders->mutex);
+  if (mapping) munmap(mapping, mappingSize);
+  return module;
+}
+
+// The module stays cached for the next pipeline that uses the same code.
+void engineReleaseShaderModule(Engine* engine, VkShaderModule module) {
+  ShaderCache* shaders = &engine->shaders;
+  pthread_mutex_lock(&shaders->mutex);
+  for (uint32_t n = 0; n < shaders->count; n++) {
+    if (shaders->entries[n].module == module) {
+      shaders->entries[n].users--;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&shaders->mutex);
+}
+
+// Pack every .spv in dir into one archive, named by the paths pipelines
+// load them by. Written beside and renamed over archivePath, as the other
+// caches are. Needs no device, so it runs before engineCreate. Returns 0 on
+// failure.
+int engineWriteShaderArchive(const char* dir, const char* archivePath) {
+  DIR* directory = opendir(dir);
+  if (!directory) {
+    printf("Failed to open %s\n", dir);
+    return 0;
+  }
+  ShaderArchiveEntry* entries = NULL;
+  void** mappings = NULL;
+  uint32_t count = 0;
+  struct dirent* dirent;
+  while ((dirent = readdir(directory))) {
+    size_t length = strlen(dirent->d_name);
+    if (length < 5 || strcmp(dirent->d_name + length - 4, ".spv") != 0) continue;
+    entries = realloc(entries, sizeof(ShaderArchiveEntry) * (count + 1));
+    mappings = realloc(mappings, sizeof(void*) * (count + 1));
+    ShaderArchiveEntry* entry = &entries[count];
+    memset(entry, 0, sizeof(ShaderArchiveEntry));
+    snprintf(entry->path, SHADER_PATH_MAX, "%s/%s", dir, dirent->d_name);
+    size_t size;
+    mappings[count] = shaderMapFile(entry->path, &size);
+    if (!mappings[count] || !shaderValid(mappings[count], size)) {
+      printf("Skipping %s: not valid SPIR-V\n", entry->path);
+      if (mappings[count]) munmap(mappings[count], size);
+      continue;
+    }
+    entry->size = size;
+    entry->hash = hashBytes(mappings[count], size);
+    count++;
+  }
+  closedir(directory);
+
+  ShaderArchiveHeader header;
+  memset(&header, 0, sizeof(ShaderArchiveHeader));
+  header.magic = SHADER_ARCHIVE_MAGIC;
+  header.version = SHADER_ARCHIVE_VERSION;
+  header.count = count;
+  uint64_t offset = sizeof(ShaderArchiveHeader) + sizeof(ShaderArchiveEntry) * (uint64_t)count;
+  for (uint32_t n = 0; n < count; n++) {
+    entries[n].offset = offset;
+    offset += entries[n].size;
+  }
+
+  char tempPath[SHADER_PATH_MAX + 8];
+  snprintf(tempPath, sizeof(tempPath), "%s.tmp", archivePath);
+  FILE* file = fopen(tempPath, "wb");
+  int written = file != NULL;
+  if (file) {
+    written = fwrite(&header, sizeof(ShaderArchiveHeader), 1, file) == 1;
+    if (count) written = written && fwrite(entries, sizeof(ShaderArchiveEntry), count, file) == count;
+    for (uint32_t n = 0; n < count; n++) written = written && fwrite(mappings[n], entries[n].size, 1, file) == 1;
+    written = fclose(file) == 0 && written;
+  }
+  if (written) written = rename(tempPath, archivePath) == 0;
+  if (!written) {
+    printf("Failed to write shader archive %s\n", archivePath);
+    unlink(tempPath);
+  } else {
+    printf("Shader archive %s: %u shaders, %lu bytes\n", archivePath, count, offset);
+  }
+  for (uint32_t n = 0; n < count; n++) munmap(mappings[n], entries[n].size);
+  free(mappings);
+  free(entries);
+  return written;
+}
@@ -0,0 +1,475 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stb/stb_image.h>
+
+#include "engine.h"
+
+#define TEXTURE_CACHE_MAGIC 0x50494d54  // "TMIP"
+#define TEXTURE_CACHE_VERSION 2
+
+// Cache file layout: this header followed by every mip level as tightly
+// packed RGBA8, largest first.
+typedef struct textureCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceMtime;
+  uint64_t sourceSize;
+  uint32_t width;
+  uint32_t height;
+  uint32_t mipLevels;
+  uint32_t padding;
+} TextureCacheHeader;
+
+uint32_t textureLevelWidth(Texture* texture, uint32_t level) {
+  return texture->width >> level ? texture->width >> level : 1;
+}
+
+uint32_t textureLevelHeight(Texture* texture, uint32_t level) {
+  return texture->height >> level ? texture->height >> level : 1;
+}
+
+// Fill in mipLevels and levelOffsets from the base size. Returns the total
+// size of the chain in bytes.
+size_t textureLayoutLevels(Texture* texture) {
+  uint32_t largest = texture->width > texture->height ? texture->width : texture->height;
+  texture->mipLevels = 1;
+  while (largest >> texture->mipLevels && texture->mipLevels < TEXTURE_MAX_MIPS) texture->mipLevels++;
+
+  size_t size = 0;
+  for (uint32_t level = 0; level < texture->mipLevels; level++) {
+    texture->levelOffsets[level] = size;
+    size += (size_t)textureLevelWidth(texture, level) * textureLevelHeight(texture, level) * 4;
+  }
+  return size;
+}
+
+// The levels are sampled as SRGB, so colour is averaged in linear space:
+// averaging the encoded bytes darkens every level. Decoding is a lookup per
+// byte, encoding a lookup on the linear value quantised to 16 bits.
+#define TEXTURE_LINEAR_STEPS 65536
+float textureSrgbToLinear[256];
+uint8_t textureLinearToSrgb[TEXTURE_LINEAR_STEPS];
+pthread_once_t textureSrgbOnce = PTHREAD_ONCE_INIT;
+
+void textureInitSrgb(void) {
+  for (int n = 0; n < 256; n++) {
+    float c = n / 255.0f;
+    textureSrgbToLinear[n] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+  }
+  for (int n = 0; n < TEXTURE_LINEAR_STEPS; n++) {
+    float c = n / (float)(TEXTURE_LINEAR_STEPS - 1);
+    float encoded = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+    textureLinearToSrgb[n] = (uint8_t)(encoded * 255.0f + 0.5f);
+  }
+}
+
+// 2x2 box filter, clamping at the edges of odd-sized levels. Alpha is linear
+// already and is averaged as stored.
+void textureDownsample(const uint8_t* src, uint32_t srcWidth, uint32_t srcHeight, uint8_t* dst, uint32_t dstWidth, uint32_t dstHeight) {
+  pthread_once(&textureSrgbOnce, textureInitSrgb);
+  for (uint32_t y = 0; y < dstHeight; y++) {
+    uint32_t y0 = y * 2 < srcHeight ? y * 2 : srcHeight - 1;
+    uint32_t y1 = y * 2 + 1 < srcHeight ? y * 2 + 1 : srcHeight - 1;
+    for (uint32_t x = 0; x < dstWidth; x++) {
+      uint32_t x0 = x * 2 < srcWidth ? x * 2 : srcWidth - 1;
+      uint32_t x1 = x * 2 + 1 < srcWidth ? x * 2 + 1 : srcWidth - 1;
+      for (int c = 0; c < 3; c++) {
+        float sum = textureSrgbToLinear[src[(y0 * srcWidth + x0) * 4 + c]] + textureSrgbToLinear[src[(y0 * srcWidth + x1) * 4 + c]] + textureSrgbToLinear[src[(y1 * srcWidth + x0) * 4 + c]] + textureSrgbToLinear[src[(y1 * srcWidth + x1) * 4 + c]];
+        dst[(y * dstWidth + x) * 4 + c] = textureLinearToSrgb[(uint32_t)(sum * 0.25f * (TEXTURE_LINEAR_STEPS - 1) + 0.5f)];
+      }
+      uint32_t alpha = src[(y0 * srcWidth + x0) * 4 + 3] + src[(y0 * srcWidth + x1) * 4 + 3] + src[(y1 * srcWidth + x0) * 4 + 3] + src[(y1 * srcWidth + x1) * 4 + 3];
+      dst[(y * dstWidth + x) * 4 + 3] = (alpha + 2) / 4;
+    }
+  }
+}
+
+int textureCacheLoad(Texture* texture, const char* cachePath, struct stat* source) {
+  int fd = open(cachePath, O_RDONLY);
+  if (fd < 0) return 0;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(TextureCacheHeader)) {
+    close(fd);
+    return 0;
+  }
+  void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return 0;
+
+  TextureCacheHeader* header = mapping;
+  uint64_t mtime = source->st_mtim.tv_sec * 1000000000ULL + source->st_mtim.tv_nsec;
+  texture->width = header->width;
+  texture->height = header->height;
+  size_t size = textureLayoutLevels(texture);
+  if (header->magic != TEXTURE_CACHE_MAGIC || header->version != TEXTURE_CACHE_VERSION || header->sourceMtime != mtime || header->sourceSize != source->st_size || header->mipLevels != texture->mipLevels || sizeof(TextureCacheHeader) + size != st.st_size) {
+    munmap(mapping, st.st_size);
+    return 0;
+  }
+  texture->mapping = mapping;
+  texture->mappingSize = st.st_size;
+  texture->pixels = (uint8_t*)(header + 1);
+  return 1;
+}
+
+void textureCacheWrite(Texture* texture, size_t size, const char* cachePath, struct stat* source) {
+  TextureCacheHeader header;
+  memset(&header, 0, sizeof(TextureCacheHeader));
+  header.magic = TEXTURE_CACHE_MAGIC;
+  header.version = TEXTURE_CACHE_VERSION;
+  header.sourceMtime = source->st_mtim.tv_sec * 1000000000ULL + source->st_mtim.tv_nsec;
+  header.sourceSize = source->st_size;
+  header.width = texture->width;
+  header.height = texture->height;
+  header.mipLevels = texture->mipLevels;
+
+  char tmpPath[512];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", cachePath);
+  int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("Failed to write texture cache %s\n", tmpPath);
+    return;
+  }
+  int ok = write(fd, &header, sizeof(header)) == sizeof(header) && write(fd, texture->pixels, size) == size && fsync(fd) == 0;
+  close(fd);
+  if (!ok || rename(tmpPath, cachePath) != 0) {
+    printf("Failed to write texture cache %s\n", cachePath);
+    unlink(tmpPath);
+  }
+}
+
+// Runs on a worker: map the mip chain from the cache, or decode the source
+// with stb_image and build the chain on the CPU.
+void textureDecode(Texture* texture) {
+  double startTime = getTime();
+  struct stat source;
+  if (stat(texture->path, &source) != 0) {
+    printf("Failed to open texture %s\n", texture->path);
+    atomic_store(&texture->state, TEXTURE_FAILED);
+    return;
+  }
+
+  char cachePath[512];
+  uint64_t mtime = source.st_mtim.tv_sec * 1000000000ULL + source.st_mtim.tv_nsec;
+  snprintf(cachePath, sizeof(cachePath), TEXTURE_CACHE_DIR "/%016lx-%016lx.bin", hashPath(texture->path), mtime);
+  if (textureCacheLoad(texture, cachePath, &source)) {
+    texture->cacheHit = 1;
+  } else {
+    int width, height, channels;
+    stbi_uc* decoded = stbi_load(texture->path, &width, &height, &channels, STBI_rgb_alpha);
+    if (!decoded) {
+      printf("Failed to decode texture %s: %s\n", texture->path, stbi_failure_reason());
+      atomic_store(&texture->state, TEXTURE_FAILED);
+      return;
+    }
+    texture->width = width;
+    texture->height = height;
+    size_t size = textureLayoutLevels(texture);
+    texture->pixels = malloc(size);
+    memcpy(texture->pixels, decoded, (size_t)width * height * 4);
+    stbi_image_free(decoded);
+    for (uint32_t level = 1; level < texture->mipLevels; level++) {
+      textureDownsample(texture->pixels + texture->levelOffsets[level - 1], textureLevelWidth(texture, level - 1), textureLevelHeight(texture, level - 1), texture->pixels + texture->levelOffsets[level], textureLevelWidth(texture, level), textureLevelHeight(texture, level));
+    }
+    textureCacheWrite(texture, size, cachePath, &source);
+  }
+  texture->decodeTime = getTime() - startTime;
+  atomic_store(&texture->state, TEXTURE_DECODED);
+}
+
+void* textureThread(void* data) {
+  Textures* textures = data;
+  pthread_mutex_lock(&textures->mutex);
+  while (!textures->stop) {
+    if (textures->decodeNext < textures->count) {
+      Texture* texture = textures->textures[textures->decodeNext++];
+      pthread_mutex_unlock(&textures->mutex);
+      textureDecode(texture);
+      pthread_mutex_lock(&textures->mutex);
+      continue;
+    }
+    pthread_cond_wait(&textures->cond, &textures->mutex);
+  }
+  pthread_mutex_unlock(&textures->mutex);
+  return NULL;
+}
+
+// Every level starts out as a copy destination on the upload queue; each is
+// handed to fragment shaders by engineUploadReleaseImage once written.
+void textureBarrier(VkCommandBuffer commandBuffer, Texture* texture) {
+  VkImageMemoryBarrier barrier;
+  memset(&barrier, 0, sizeof(VkImageMemoryBarrier));
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = texture->image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = texture->mipLevels;
+  barrier.subresourceRange.layerCount = 1;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+// Create the image, one view per resident range and the per-frame descriptor
+// sets, or bindless slots, once the decoded size is known.
+void textureCreateResources(Engine* engine, Texture* texture) {
+  Textures* textures = &engine->textures;
+  engineCreateImage(engine, texture->width, texture->height, texture->mipLevels, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &texture->image, &texture->memory);
+
+  for (uint32_t level = 0; level < texture->mipLevels; level++) {
+    VkImageViewCreateInfo viewInfo;
+    memset(&viewInfo, 0, sizeof(VkImageViewCreateInfo));
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = texture->image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = level;
+    viewInfo.subresourceRange.levelCount = texture->mipLevels - level;
+    viewInfo.subresourceRange.layerCount = 1;
+    if (vkCreateImageView(engine->device, &viewInfo, NULL, &texture->views[level]) != VK_SUCCESS) {
+      printf("Failed to create texture image view!\n");
+      exit(1);
+    }
+  }
+
+  VkSamplerCreateInfo samplerInfo;
+  memset(&samplerInfo, 0, sizeof(VkSamplerCreateInfo));
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_LINEAR;
+  samplerInfo.minFilter = VK_FILTER_LINEAR;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  samplerInfo.anisotropyEnable = VK_TRUE;
+  samplerInfo.maxAnisotropy = engine->physicalDeviceProperties.limits.maxSamplerAnisotropy;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+  samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+  texture->sampler = engineGetSampler(engine, &samplerInfo);
+
+  if (engine->descriptors.bindless) {
+    texture->bindlessSlot = engineBindlessAllocateImages(engine, MAX_FRAMES_IN_FLIGHT);
+  } else {
+    VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT];
+    for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) layouts[n] = textures->setLayout;
+    VkDescriptorSetAllocateInfo allocInfo;
+    memset(&allocInfo, 0, sizeof(VkDescriptorSetAllocateInfo));
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = textures->descriptorPool;
+    allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+    allocInfo.pSetLayouts = layouts;
+    if (vkAllocateDescriptorSets(engine->device, &allocInfo, texture->descriptorSets) != VK_SUCCESS) {
+      printf("Failed to allocate texture descriptor sets!\n");
+      exit(1);
+    }
+  }
+
+  texture->residentMip = texture->mipLevels;
+  for (int n = 0; n < MAX_FRAMES_IN_FLIGHT; n++) texture->boundMip[n] = texture->mipLevels;
+  textureBarrier(engineUploadCommandBuffer(engine), texture);
+}
+
+void textureReleasePixels(Texture* texture) {
+  if (texture->mapping) {
+    munmap(texture->mapping, texture->mappingSize);
+  } else {
+    free(texture->pixels);
+  }
+  texture->mapping = NULL;
+  texture->pixels = NULL;
+}
+
+void engineCreateTextures(Engine* engine) {
+  Textures* textures = &engine->textures;
+  mkdir(TEXTURE_CACHE_DIR, 0755);
+
+  VkDescriptorSetLayoutBinding binding;
+  memset(&binding, 0, sizeof(VkDescriptorSetLayoutBinding));
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo;
+  memset(&layoutInfo, 0, sizeof(VkDescriptorSetLayoutCreateInfo));
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &binding;
+  if (vkCreateDescriptorSetLayout(engine->device, &layoutInfo, NULL, &textures->setLayout) != VK_SUCCESS) {
+    printf("Failed to create texture descriptor set layout!\n");
+    exit(1);
+  }
+
+  VkDescriptorPoolSize poolSize;
+  poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSize.descriptorCount = MAX_TEXTURES * MAX_FRAMES_IN_FLIGHT;
+  VkDescriptorPoolCreateInfo poolInfo;
+  memset(&poolInfo, 0, sizeof(VkDescriptorPoolCreateInfo));
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = MAX_TEXTURES * MAX_FRAMES_IN_FLIGHT;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  if (vkCreateDescriptorPool(engine->device, &poolInfo, NULL, &textures->descriptorPool) != VK_SUCCESS) {
+    printf("Failed to create texture descriptor pool!\n");
+    exit(1);
+  }
+
+  // Leave a core for the frame loop.
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  textures->threadCount = cores > 2 ? cores - 1 : 1;
+  textures->threads = malloc(sizeof(pthread_t) * textures->threadCount);
+  pthread_mutex_init(&textures->mutex, NULL);
+  pthread_cond_init(&textures->cond, NULL);
+  for (uint32_t n = 0; n < textures->threadCount; n++) {
+    if (pthread_create(&textures->threads[n], NULL, textureThread, textures) != 0) {
+      printf("Failed to create texture thread!\n");
+      exit(1);
+    }
+  }
+}
+
+void engineDestroyTextures(Engine* engine) {
+  Textures* textures = &engine->textures;
+  pthread_mutex_lock(&textures->mutex);
+  textures->stop = 1;
+  pthread_cond_broadcast(&textures->cond);
+  pthread_mutex_unlock(&textures->mutex);
+  for (uint32_t n = 0; n < textures->threadCount; n++) pthread_join(textures->threads[n], NULL);
+  free(textures->threads);
+  pthread_mutex_destroy(&textures->mutex);
+  pthread_cond_destroy(&textures->cond);
+
+  for (uint32_t n = 0; n < textures->count; n++) {
+    Texture* texture = textures->textures[n];
+    if (texture->image) {
+      for (uint32_t level = 0; level < texture->mipLevels; level++) vkDestroyImageView(engine->device, texture->views[level], NULL);
+      vkDestroyImage(engine->device, texture->image, NULL);
+      engineFree(engine, &texture->memory);
+    }
+    textureReleasePixels(texture);
+    free(texture->path);
+    free(texture);
+  }
+  for (uint32_t n = 0; n < textures->samplerCount; n++) vkDestroySampler(engine->device, textures->samplers[n], NULL);
+  vkDestroyDescriptorPool(engine->device, textures->descriptorPool, NULL);
+  vkDestroyDescriptorSetLayout(engine->device, textures->setLayout, NULL);
+}
+
+// Queue a texture for decoding and return immediately. It is drawn once its
+// smallest mip is resident and sharpens over the following frames.
+Texture* engineLoadTexture(Engine* engine, const char* path) {
+  Textures* textures = &engine->textures;
+  if (textures->count == MAX_TEXTURES) {
+    printf("Too many textures!\n");
+    exit(1);
+  }
+  Texture* texture = calloc(1, sizeof(Texture));
+  texture->path = strdup(path);
+  texture->index = textures->count;
+  atomic_init(&texture->state, TEXTURE_QUEUED);
+
+  pthread_mutex_lock(&textures->mutex);
+  textures->textures[textures->count++] = texture;
+  pthread_cond_signal(&textures->cond);
+  pthread_mutex_unlock(&textures->mutex);
+  return texture;
+}
+
+// Samplers are a scarce device resource, so identical create infos share one.
+// samplerInfo must be fully zeroed apart from the fields that are set.
+VkSampler engineGetSampler(Engine* engine, VkSamplerCreateInfo* samplerInfo) {
+  Textures* textures = &engine->textures;
+  for (uint32_t n = 0; n < textures->samplerCount; n++) {
+    if (memcmp(&textures->samplerInfos[n], samplerInfo, sizeof(VkSamplerCreateInfo)) == 0) return textures->samplers[n];
+  }
+  if (textures->samplerCount == MAX_SAMPLERS) {
+    printf("Too many samplers!\n");
+    exit(1);
+  }
+  VkSampler sampler;
+  if (vkCreateSampler(engine->device, samplerInfo, NULL, &sampler) != VK_SUCCESS) {
+    printf("Failed to create sampler!\n");
+    exit(1);
+  }
+  textures->samplerInfos[textures->samplerCount] = *samplerInfo;
+  textures->samplers[textures->samplerCount++] = sampler;
+  return sampler;
+}
+
+// Called each frame after its wait: record uploads for decoded textures,
+// smallest mip first and within TEXTURE_UPLOAD_BUDGET bytes, then point this
+// frame's descriptor sets at the levels resident so far.
+void engineUpdateTextures(Engine* engine) {
+  Textures* textures = &engine->textures;
+  int64_t budget = TEXTURE_UPLOAD_BUDGET;
+  for (uint32_t n = 0; n < textures->count; n++) {
+    Texture* texture = textures->textures[n];
+    int state = atomic_load(&texture->state);
+    if (state == TEXTURE_DECODED && budget > 0) {
+      textureCreateResources(engine, texture);
+      state = TEXTURE_UPLOADING;
+      atomic_store(&texture->state, state);
+    }
+
+    if (state == TEXTURE_UPLOADING) {
+      while (texture->residentMip > 0 && budget > 0) {
+        uint32_t level = texture->residentMip - 1;
+        uint32_t width = textureLevelWidth(texture, level);
+        uint32_t height = textureLevelHeight(texture, level);
+        engineUploadImage(engine, texture->image, level, width, height, texture->pixels + texture->levelOffsets[level]);
+        engineUploadReleaseImage(engine, texture->image, level, 1);
+        texture->residentMip = level;
+        budget -= (int64_t)width * height * 4;
+      }
+      if (texture->residentMip == 0) {
+        textureReleasePixels(texture);
+        state = TEXTURE_RESIDENT;
+        atomic_store(&texture->state, state);
+        printf("Texture %s: %ux%u, %u mips, %s in %.1f ms\n", texture->path, texture->width, texture->height, texture->mipLevels, texture->cacheHit ? "cache hit" : "decoded", texture->decodeTime * 1000.0);
+      }
+    }
+
+    if ((state == TEXTURE_UPLOADING || state == TEXTURE_RESIDENT) && texture->boundMip[engine->currentFrame] != texture->residentMip && engine->descriptors.bindless) {
+      engineBindlessWriteImage(engine, texture->bindlessSlot + engine->currentFrame, texture->views[texture->residentMip], texture->sampler);
+      texture->boundMip[engine->currentFrame] = texture->residentMip;
+    } else if ((state == TEXTURE_UPLOADING || state == TEXTURE_RESIDENT) && texture->boundMip[engine->currentFrame] != texture->residentMip) {
+      VkDescriptorImageInfo imageInfo;
+      imageInfo.sampler = texture->sampler;
+      imageInfo.imageView = texture->views[texture->residentMip];
+      imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      VkWriteDescriptorSet write;
+      memset(&write, 0, sizeof(VkWriteDescriptorSet));
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = texture->descriptorSets[engine->currentFrame];
+      write.dstBinding = 0;
+      write.descriptorCount = 1;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      write.pImageInfo = &imageInfo;
+      vkUpdateDescriptorSets(engine->device, 1, &write, 0, NULL);
+      texture->boundMip[engine->currentFrame] = texture->residentMip;
+    }
+  }
+}
+
+// Bind the texture for the current frame. Returns 0 while none of its mips
+// are resident yet, in which case the draw should be skipped.
+int engineBindTexture(Engine* engine, VkCommandBuffer commandBuffer, Texture* texture) {
+  int state = atomic_load(&texture->state);
+  if (state != TEXTURE_UPLOADING && state != TEXTURE_RESIDENT) return 0;
+  if (texture->boundMip[engine->currentFrame] == texture->mipLevels) return 0;
+  if (engine->descriptors.bindless) {
+    engineBindBindless(engine, commandBuffer, texture->bindlessSlot + engine->currentFrame, 0);
+  } else {
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, engine->pipelineLayout, 0, 1, &texture->descriptorSets[engine->currentFrame], 0, NULL);
+  }
+  return 1;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+#define SUBMIT_BENCH_ITERATIONS 10000
+
+// One timeline per distinct queue family in use, each starting at 0.
+void engineCreateTimelines(Engine* engine) {
+  VkSemaphoreTypeCreateInfoKHR typeInfo;
+  memset(&typeInfo, 0, sizeof(VkSemaphoreTypeCreateInfoKHR));
+  typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+  typeInfo.initialValue = 0;
+  VkSemaphoreCreateInfo semaphoreInfo;
+  memset(&semaphoreInfo, 0, sizeof(VkSemaphoreCreateInfo));
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &typeInfo;
+
+  for (uint32_t n = 0; n < engine->queueFamilyCount; n++) {
+    Timeline* timeline = &engine->timelines[n];
+    vkGetDeviceQueue(engine->device, engine->queueFamilies[n], 0, &timeline->queue);
+    if (vkCreateSemaphore(engine->device, &semaphoreInfo, NULL, &timeline->semaphore) != VK_SUCCESS) {
+      printf("Failed to create timeline semaphore!\n");
+      exit(1);
+    }
+    if (engine->queueFamilies[n] == engine->queueFamilyIndex) engine->graphicsTimeline = timeline;
+    if (engine->queueFamilies[n] == engine->computeFamilyIndex) engine->computeTimeline = timeline;
+    if (engine->queueFamilies[n] == engine->transferFamilyIndex) engine->transferTimeline = timeline;
+  }
+}
+
+// Called once the device is idle.
+void engineDestroyTimelines(Engine* engine) {
+  for (uint32_t n = 0; n < engine->queueFamilyCount; n++) vkDestroySemaphore(engine->device, engine->timelines[n].semaphore, NULL);
+}
+
+void engineSubmitWait(SubmitWaits* waits, VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stage) {
+  if (waits->count == MAX_SUBMIT_WAITS) {
+    printf("Too many semaphores for one submission!\n");
+    exit(1);
+  }
+  waits->semaphores[waits->count] = semaphore;
+  waits->values[waits->count] = value;
+  waits->stages[waits->count++] = stage;
+}
+
+// Wait for value on timeline; 0 means there is nothing to wait for. Values
+// the CPU has seen reached are still waited on, the wait is what makes the
+// other queue's writes visible.
+void engineSubmitWaitTimeline(SubmitWaits* waits, Timeline* timeline, uint64_t value, VkPipelineStageFlags stage) {
+  if (value == 0) return;
+  engineSubmitWait(waits, timeline->semaphore, value, stage);
+}
+
+// Submit commandBuffer, which may be VK_NULL_HANDLE, to the timeline's queue
+// after waits, signalling the timeline's next value and optionally a binary
+// semaphore for the present. Returns the value.
+uint64_t engineTimelineSubmit(Engine* engine, Timeline* timeline, SubmitWaits* waits, VkCommandBuffer commandBuffer, VkSemaphore signal) {
+  uint64_t value = timeline->submitted + 1;
+  VkSemaphore signalSemaphores[2] = {timeline->semaphore, signal};
+  uint64_t signalValues[2] = {value, 0};
+
+  VkTimelineSemaphoreSubmitInfoKHR timelineInfo;
+  memset(&timelineInfo, 0, sizeof(VkTimelineSemaphoreSubmitInfoKHR));
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+  timelineInfo.waitSemaphoreValueCount = waits ? waits->count : 0;
+  timelineInfo.pWaitSemaphoreValues = waits ? waits->values : NULL;
+  timelineInfo.signalSemaphoreValueCount = signal ? 2 : 1;
+  timelineInfo.pSignalSemaphoreValues = signalValues;
+
+  VkSubmitInfo submitInfo;
+  memset(&submitInfo, 0, sizeof(VkSubmitInfo));
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.waitSemaphoreCount = waits ? waits->count : 0;
+  submitInfo.pWaitSemaphores = waits ? waits->semaphores : NULL;
+  submitInfo.pWaitDstStageMask = waits ? waits->stages : NULL;
+  submitInfo.commandBufferCount = commandBuffer ? 1 : 0;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  submitInfo.signalSemaphoreCount = signal ? 2 : 1;
+  submitInfo.pSignalSemaphores = signalSemaphores;
+  if (vkQueueSubmit(timeline->queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    printf("Failed to submit to queue!\n");
+    exit(1);
+  }
+  timeline->submitted = value;
+  return value;
+}
+
+// The latest value the GPU has reached, without waiting.
+uint64_t engineTimelineCompleted(Engine* engine, Timeline* timeline) {
+  uint64_t value;
+  if (engine->getSemaphoreCounterValue(engine->device, timeline->semaphore, &value) == VK_SUCCESS && value > timeline->completed) timeline->completed = value;
+  return timeline->completed;
+}
+
+int engineTimelineReached(Engine* engine, Timeline* timeline, uint64_t value) {
+  return value <= timeline->completed || value <= engineTimelineCompleted(engine, timeline);
+}
+
+void engineTimelineWait(Engine* engine, Timeline* timeline, uint64_t value) {
+  if (value <= timeline->completed) return;
+  VkSemaphoreWaitInfoKHR waitInfo;
+  memset(&waitInfo, 0, sizeof(VkSemaphoreWaitInfoKHR));
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &timeline->semaphore;
+  waitInfo.pValues = &value;
+  if (engine->waitSemaphores(engine->device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+    printf("Failed to wait for timeline semaphore!\n");
+    exit(1);
+  }
+  timeline->completed = value;
+}
+
+// Empty submissions to the graphics queue, so only the cost of submitting
+// and synchronising is measured: a fence waited for and reset after each, as
+// frames used to, against a timeline value waited for after each, and
+// against timeline submissions back to back with one wait at the end. Then
+// the host side alone: signalling from the CPU and polling the counter.
+void engineBenchmarkSubmit(Engine* engine) {
+  Timeline* timeline = engine->graphicsTimeline;
+  vkDeviceWaitIdle(engine->device);
+
+  VkFenceCreateInfo fenceInfo;
+  memset(&fenceInfo, 0, sizeof(VkFenceCreateInfo));
+  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  VkFence fence;
+  if (vkCreateFence(engine->device, &fenceInfo, NULL, &fence) != VK_SUCCESS) {
+    printf("Failed to create fence!\n");
+    exit(1);
+  }
+  VkSubmitInfo submitInfo;
+  memset(&submitInfo, 0, sizeof(VkSubmitInfo));
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  double startTime = getTime();
+  for (int n = 0; n < SUBMIT_BENCH_ITERATIONS; n++) {
+    if (vkQueueSubmit(timeline->queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+      printf("Failed to submit to queue!\n");
+      exit(1);
+    }
+    vkWaitForFences(engine->device, 1, &fence, VK_TRUE, UINT64_MAX);
+    vkResetFences(engine->device, 1, &fence);
+  }
+  double fenceTime = getTime() - startTime;
+  vkDestroyFence(engine->device, fence, NULL);
+
+  startTime = getTime();
+  for (int n = 0; n < SUBMIT_BENCH_ITERATIONS; n++) engineTimelineWait(engine, timeline, engineTimelineSubmit(engine, timeline, NULL, VK_NULL_HANDLE, VK_NULL_HANDLE));
+  double timelineTime = getTime() - startTime;
+
+  startTime = getTime();
+  uint64_t value = 0;
+  for (int n = 0; n < SUBMIT_BENCH_ITERATIONS; n++) value = engineTimelineSubmit(engine, timeline, NULL, VK_NULL_HANDLE, VK_NULL_HANDLE);
+  double submitTime = getTime() - startTime;
+  engineTimelineWait(engine, timeline, value);
+  double batchTime = getTime() - startTime;
+
+  // Signalled on the CPU, the values must still go up and stay ahead of the
+  // queue, which is idle.
+  startTime = getTime();
+  for (int n = 0; n < SUBMIT_BENCH_ITERATIONS; n++) {
+    VkSemaphoreSignalInfoKHR signalInfo;
+    memset(&signalInfo, 0, sizeof(VkSemaphoreSignalInfoKHR));
+    signalInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO_KHR;
+    signalInfo.semaphore = timeline->semaphore;
+    signalInfo.value = ++timeline->submitted;
+    engine->signalSemaphore(engine->device, &signalInfo);
+  }
+  double signalTime = getTime() - startTime;
+  startTime = getTime();
+  for (int n = 0; n < SUBMIT_BENCH_ITERATIONS; n++) engineTimelineCompleted(engine, timeline);
+  double pollTime = getTime() - startTime;
+
+  double scale = 1e6 / SUBMIT_BENCH_ITERATIONS;
+  printf("Submit: %d empty submissions each\n", SUBMIT_BENCH_ITERATIONS);
+  printf("  fence submit, wait, reset  %8.2f us\n", fenceTime * scale);
+  printf("  timeline submit, wait      %8.2f us\n", timelineTime * scale);
+  printf("  timeline submit only       %8.2f us (%.2f us with the final wait)\n", submitTime * scale, batchTime * scale);
+  printf("  host signal                %8.2f us\n", signalTime * scale);
+  printf("  host poll                  %8.2f us\n", pollTime * scale);
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+const char* tracePhaseNames[TRACE_PHASE_COUNT] = {"frame", "poll events", "wait frame", "acquire", "record", "submit", "present", "recreate swapchain", "frame limiter"};
+
+uint64_t traceBegin(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Cached per thread so recording an event doesn't cost a syscall.
+static __thread uint32_t traceThread;
+
+// Claims a slot with a single atomic increment, so any thread can record
+// without locking. Once the ring is full the oldest events are overwritten.
+void traceEnd(Engine* engine, TracePhase phase, uint64_t start) {
+  Trace* trace = &engine->trace;
+  uint64_t duration = traceBegin() - start;
+
+  uint64_t index = atomic_fetch_add(&trace->head, 1);
+  TraceEvent* event = &trace->events[index % TRACE_CAPACITY];
+  event->start = start;
+  event->duration = duration;
+  event->phase = phase;
+  if (!traceThread) traceThread = syscall(SYS_gettid);
+  event->thread = traceThread;
+
+  // log2 buckets of microseconds: bucket n holds durations below 2^n us.
+  uint32_t bucket = 0;
+  uint64_t micros = duration / 1000;
+  while (micros && bucket < TRACE_BUCKETS - 1) {
+    micros >>= 1;
+    bucket++;
+  }
+  TraceHistogram* histogram = &trace->histograms[phase];
+  atomic_fetch_add(&histogram->buckets[bucket], 1);
+  atomic_fetch_add(&histogram->count, 1);
+  atomic_fetch_add(&histogram->total, duration);
+  uint64_t max = atomic_load(&histogram->max);
+  while (duration > max && !atomic_compare_exchange_weak(&histogram->max, &max, duration));
+}
+
+void engineCreateTrace(Engine* engine) {
+  engine->trace.events = calloc(TRACE_CAPACITY, sizeof(TraceEvent));
+  engine->trace.origin = traceBegin();
+}
+
+// Write the events still in the ring as Chrome trace-event JSON, which loads
+// directly into Perfetto or chrome://tracing.
+int engineTraceExport(Engine* engine, const char* path) {
+  Trace* trace = &engine->trace;
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    printf("Failed to open trace output %s\n", path);
+    return 0;
+  }
+
+  uint64_t head = atomic_load(&trace->head);
+  uint64_t first = head > TRACE_CAPACITY ? head - TRACE_CAPACITY : 0;
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (uint64_t n = first; n < head; n++) {
+    TraceEvent* event = &trace->events[n % TRACE_CAPACITY];
+    fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}\n", n == first ? "" : ",", tracePhaseNames[event->phase], getpid(), event->thread, (event->start - trace->origin) / 1e3, event->duration / 1e3);
+  }
+  fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+  fclose(file);
+  printf("Wrote %lu trace events to %s\n", head - first, path);
+  return 1;
+}
+
+void engineTraceSummary(Engine* engine) {
+  Trace* trace = &engine->trace;
+  printf("CPU frame phases (count, avg, max, log2 us histogram):\n");
+  for (int phase = 0; phase < TRACE_PHASE_COUNT; phase++) {
+    TraceHistogram* histogram = &trace->histograms[phase];
+    uint64_t count = atomic_load(&histogram->count);
+    if (!count) continue;
+    printf("  %-18s %8lu %9.3f ms %9.3f ms  ", tracePhaseNames[phase], count, atomic_load(&histogram->total) / 1e6 / count, atomic_load(&histogram->max) / 1e6);
+    for (int bucket = 0; bucket < TRACE_BUCKETS; bucket++) {
+      uint64_t value = atomic_load(&histogram->buckets[bucket]);
+      if (value) printf(" <%uus:%lu", 1u << bucket, value);
+    }
+    printf("\n");
+  }
+}
+
+void engineDestroyTrace(Engine* engine) {
+  if (engine->config.tracePath) engineTraceExport(engine, engine->config.tracePath);
+  engineTraceSummary(engine);
+  free(engine->trace.events);
+}
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+// Offsets within the ring are kept 16-byte aligned, enough for any vertex,
+// index or texel format a copy can target.
+#define UPLOAD_ALIGNMENT 16
+
+void uploaderRetireOldest(Engine* engine) {
+  Uploader* uploader = &engine->uploader;
+  UploadBatch* batch = &uploader->batches[uploader->oldest];
+  engineTimelineWait(engine, engine->transferTimeline, batch->value);
+  uploader->tail = batch->end;
+  batch->state = UPLOAD_BATCH_IDLE;
+  uploader->oldest = (uploader->oldest + 1) % UPLOAD_BATCHES;
+  uploader->submittedCount--;
+}
+
+// Release the ring space of every batch the GPU has already finished.
+void uploaderRetireCompleted(Engine* engine) {
+  Uploader* uploader = &engine->uploader;
+  while (uploader->submittedCount > 0 && engineTimelineReached(engine, engine->transferTimeline, uploader->batches[uploader->oldest].value)) {
+    uploaderRetireOldest(engine);
+  }
+}
+
+// Reserve size bytes of the ring, submitting the open batch and waiting for
+// old ones only when the ring is full. Returns the byte offset in the buffer.
+VkDeviceSize uploaderReserve(Engine* engine, VkDeviceSize size) {
+  Uploader* uploader = &engine->uploader;
+  uploaderRetireCompleted(engine);
+
+  uploader->head = (uploader->head + UPLOAD_ALIGNMENT - 1) & ~(uint64_t)(UPLOAD_ALIGNMENT - 1);
+  uint64_t offset = uploader->head % UPLOAD_RING_SIZE;
+  if (offset + size > UPLOAD_RING_SIZE) uploader->head += UPLOAD_RING_SIZE - offset;
+
+  while (uploader->head + size - uploader->tail > UPLOAD_RING_SIZE) {
+    if (uploader->batches[uploader->current].state == UPLOAD_BATCH_RECORDING) engineFlushUploads(engine);
+    if (uploader->submittedCount == 0) {
+      // Nothing in flight, so the whole ring is free.
+      uploader->tail = uploader->head;
+      break;
+    }
+    uploaderRetireOldest(engine);
+  }
+
+  VkDeviceSize reserved = uploader->head % UPLOAD_RING_SIZE;
+  uploader->head += size;
+  return reserved;
+}
+
+// The command buffer of the open batch, begun on first use. Callers may
+// record barriers into it around their copies.
+VkCommandBuffer engineUploadCommandBuffer(Engine* engine) {
+  Uploader* uploader = &engine->uploader;
+  UploadBatch* batch = &uploader->batches[uploader->current];
+  if (batch->state == UPLOAD_BATCH_RECORDING) return batch->commandBuffer;
+  // Every batch slot is in flight: the oldest is the one we're about to reuse.
+  if (batch->state == UPLOAD_BATCH_SUBMITTED) uploaderRetireOldest(engine);
+
+  vkResetCommandBuffer(batch->commandBuffer, 0);
+  VkCommandBufferBeginInfo beginInfo;
+  memset(&beginInfo, 0, sizeof(VkCommandBufferBeginInfo));
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  if (vkBeginCommandBuffer(batch->commandBuffer, &beginInfo) != VK_SUCCESS) {
+    printf("Begin upload command buffer failed!\n");
+    exit(1);
+  }
+  batch->state = UPLOAD_BATCH_RECORDING;
+  return batch->commandBuffer;
+}
+
+void engineCreateUploader(Engine* engine) {
+  Uploader* uploader = &engine->uploader;
+  engineCreateBuffer(engine, UPLOAD_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &uploader->buffer, &uploader->memory);
+  uploader->mapped = uploader->memory.mapped;
+
+  VkCommandPoolCreateInfo poolInfo;
+  memset(&poolInfo, 0, sizeof(VkCommandPoolCreateInfo));
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  poolInfo.queueFamilyIndex = engine->transferFamilyIndex;
+  if (vkCreateCommandPool(engine->device, &poolInfo, NULL, &uploader->commandPool) != VK_SUCCESS) {
+    printf("Upload command pool creation failed!\n");
+    exit(1);
+  }
+
+  VkCommandBuffer commandBuffers[UPLOAD_BATCHES];
+  VkCommandBufferAllocateInfo allocInfo;
+  memset(&allocInfo, 0, sizeof(VkCommandBufferAllocateInfo));
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = uploader->commandPool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = UPLOAD_BATCHES;
+  if (vkAllocateCommandBuffers(engine->device, &allocInfo, commandBuffers) != VK_SUCCESS) {
+    printf("Upload command buffer creation failed!\n");
+    exit(1);
+  }
+
+  for (int n = 0; n < UPLOAD_BATCHES; n++) uploader->batches[n].commandBuffer = commandBuffers[n];
+}
+
+void engineDestroyUploader(Engine* engine) {
+  Uploader* uploader = &engine->uploader;
+  engineWaitUploads(engine);
+  vkDestroyCommandPool(engine->device, uploader->commandPool, NULL);
+  vkDestroyBuffer(engine->device, uploader->buffer, NULL);
+  engineFree(engine, &uploader->memory);
+  free(uploader->acquires);
+}
+
+// Copy data into a device-local buffer. Large uploads are split so a single
+// one never needs more than a quarter of the ring.
+void engineUploadBuffer(Engine* engine, VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size) {
+  Uploader* uploader = &engine->uploader;
+  const uint8_t* bytes = data;
+  while (size > 0) {
+    VkDeviceSize chunk = size < UPLOAD_RING_SIZE / 4 ? size : UPLOAD_RING_SIZE / 4;
+    VkDeviceSize stagingOffset = uploaderReserve(engine, chunk);
+    memcpy(uploader->mapped + stagingOffset, bytes, chunk);
+
+    VkBufferCopy region;
+    region.srcOffset = stagingOffset;
+    region.dstOffset = offset;
+    region.size = chunk;
+    vkCmdCopyBuffer(engineUploadCommandBuffer(engine), uploader->buffer, buffer, 1, &region);
+
+    uploader->bytesUploaded += chunk;
+    uploader->copyCount++;
+    bytes += chunk;
+    offset += chunk;
+    size -= chunk;
+  }
+}
+
+// Copy tightly packed RGBA8 pixels into one mip level of an image in
+// TRANSFER_DST_OPTIMAL layout, in bands of rows that fit a quarter of the ring.
+void engineUploadImage(Engine* engine, VkImage image, uint32_t mipLevel, uint32_t width, uint32_t height, const uint8_t* pixels) {
+  Uploader* uploader = &engine->uploader;
+  VkDeviceSize rowSize = (VkDeviceSize)width * 4;
+  uint32_t bandRows = UPLOAD_RING_SIZE / 4 / rowSize;
+  if (bandRows == 0) bandRows = 1;
+  for (uint32_t row = 0; row < height; row += bandRows) {
+    uint32_t rows = height - row < bandRows ? height - row : bandRows;
+    VkDeviceSize size = rowSize * rows;
+    VkDeviceSize stagingOffset = uploaderReserve(engine, size);
+    memcpy(uploader->mapped + stagingOffset, pixels + rowSize * row, size);
+
+    VkBufferImageCopy region;
+    memset(&region, 0, sizeof(VkBufferImageCopy));
+    region.bufferOffset = stagingOffset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = mipLevel;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset.y = row;
+    region.imageExtent.width = width;
+    region.imageExtent.height = rows;
+    region.imageExtent.depth = 1;
+    vkCmdCopyBufferToImage(engineUploadCommandBuffer(engine), uploader->buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    uploader->bytesUploaded += size;
+    uploader->copyCount++;
+  }
+}
+
+// Submit the open batch. Each signals the next transfer timeline value, and
+// a value is only reached once every batch before it has completed too, so
+// the latest value covers every upload submitted so far.
+void engineFlushUploads(Engine* engine) {
+  Uploader* uploader = &engine->uploader;
+  UploadBatch* batch = &uploader->batches[uploader->current];
+  if (batch->state != UPLOAD_BATCH_RECORDING) return;
+
+  if (vkEndCommandBuffer(batch->commandBuffer) != VK_SUCCESS) {
+    printf("Failed to record upload command buffer!\n");
+    exit(1);
+  }
+  batch->value = engineTimelineSubmit(engine, engine->transferTimeline, NULL, batch->commandBuffer, VK_NULL_HANDLE);
+
+  uploader->pendingValue = batch->value;
+  batch->end = uploader->head;
+  batch->state = UPLOAD_BATCH_SUBMITTED;
+  uploader->submittedCount++;
+  uploader->batchCount++;
+  uploader->current = (uploader->current + 1) % UPLOAD_BATCHES;
+}
+
+// Block until every upload submitted so far has completed. Only meant for
+// loading screens and benchmarks; frames wait on the GPU for the timeline.
+void engineWaitUploads(Engine* engine) {
+  engineFlushUploads(engine);
+  while (engine->uploader.submittedCount > 0) uploaderRetireOldest(engine);
+}
+
+// Hand the transfer timeline value of the latest upload batch to a queue
+// submission that reads the uploaded data. Returns 0 when nothing is pending.
+uint64_t engineTakeUploadValue(Engine* engine) {
+  uint64_t value = engine->uploader.pendingValue;
+  engine->uploader.pendingValue = 0;
+  return value;
+}
+
+// Make mip levels of an image written by the open batch readable by fragment
+// shaders. On a separate transfer family this is a release, and the matching
+// acquire is recorded into a later frame by engineUploadAcquire; that frame
+// waits for the batch's timeline value, directly or through culling.
+void engineUploadReleaseImage(Engine* engine, VkImage image, uint32_t baseLevel, uint32_t levelCount) {
+  Uploader* uploader = &engine->uploader;
+  VkImageMemoryBarrier barrier;
+  memset(&barrier, 0, sizeof(VkImageMemoryBarrier));
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = baseLevel;
+  barrier.subresourceRange.levelCount = levelCount;
+  barrier.subresourceRange.layerCount = 1;
+
+  if (engine->transferFamilyIndex == engine->queueFamilyIndex) {
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(engineUploadCommandBuffer(engine), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+    return;
+  }
+
+  barrier.srcQueueFamilyIndex = engine->transferFamilyIndex;
+  barrier.dstQueueFamilyIndex = engine->queueFamilyIndex;
+  vkCmdPipelineBarrier(engineUploadCommandBuffer(engine), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+  if (uploader->acquireCount == uploader->acquireCapacity) {
+    uploader->acquireCapacity = uploader->acquireCapacity ? uploader->acquireCapacity * 2 : 64;
+    uploader->acquires = realloc(uploader->acquires, sizeof(VkImageMemoryBarrier) * uploader->acquireCapacity);
+  }
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  uploader->acquires[uploader->acquireCount++] = barrier;
+}
+
+// Record the acquires for every image released so far into a frame's
+// command buffer, ahead of anything that samples them. Releases recorded
+// later in the frame are flushed with it and acquired by the next one.
+void engineUploadAcquire(Engine* engine, VkCommandBuffer commandBuffer) {
+  Uploader* uploader = &engine->uploader;
+  if (uploader->acquireCount == 0) return;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, uploader->acquireCount, uploader->acquires);
+  uploader->acquireCount = 0;
+}
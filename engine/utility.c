@@ -1,6 +1,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "engine.h"
@@ -15,11 +16,38 @@ FileData readFile(char* path) {
   fileData.size = lseek(fd, 0, SEEK_END);
   lseek(fd, 0, SEEK_SET);
   fileData.data = malloc(fileData.size);
-  int n = read(fd, fileData.data, fileData.size);
-  if (n < fileData.size) {
-    printf("Failed to read file %s!\n", path);
-    exit(1);
+  // read may return less than asked for, which isn't an error.
+  size_t done = 0;
+  while (done < fileData.size) {
+    ssize_t n = read(fd, fileData.data + done, fileData.size - done);
+    if (n <= 0) {
+      printf("Failed to read file %s!\n", path);
+      exit(1);
+    }
+    done += n;
   }
   close(fd);
   return fileData;
 }
+
+// FNV-1a of a file path, used to name on-disk cache entries.
+uint64_t hashPath(const char* path) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (; *path; path++) hash = (hash ^ (uint8_t)*path) * 1099511628211ULL;
+  return hash;
+}
+
+// FNV-1a of a buffer, used to key shader modules by their code.
+uint64_t hashBytes(const void* data, size_t size) {
+  uint64_t hash = 14695981039346656037ULL;
+  const uint8_t* bytes = data;
+  for (size_t n = 0; n < size; n++) hash = (hash ^ bytes[n]) * 1099511628211ULL;
+  return hash;
+}
+
+// Monotonic wall clock in seconds, for timing startup and frames.
+double getTime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
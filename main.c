@@ -1,9 +1,267 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "engine/engine.h"
 
-int main() {
-  Engine *engine = engineCreate();
+typedef struct instanceDemo {
+  Mesh *mesh;
+  mat4 *transforms;
+  uint32_t count;
+} InstanceDemo;
+
+// Resubmitted every frame, they are merged into one instanced draw.
+void instanceDemoFrame(Engine *engine, void *data) {
+  InstanceDemo *demo = data;
+  for (uint32_t n = 0; n < demo->count; n++) engineDrawInstance(engine, VK_NULL_HANDLE, demo->mesh, demo->transforms[n]);
+}
+
+int main(int argc, char **argv) {
+  EngineConfig config = engineDefaultConfig();
+  int benchUploads = 0;
+  int benchRecord = 0;
+  int benchIndirect = 0;
+  int benchDescriptors = 0;
+  int benchPipelines = 0;
+  int benchPacing = 0;
+  int benchResize = 0;
+  int benchSubmit = 0;
+  int benchHiZ = 0;
+  uint32_t instanceCount = 0;
+  char **modelPaths = malloc(sizeof(char *) * argc);
+  uint32_t modelCount = 0;
+  char *texturePath = NULL;
+  char **pipelinePaths = malloc(sizeof(char *) * argc);
+  uint32_t pipelineCount = 0;
+  for (int n = 1; n < argc; n++) {
+    if (strcmp(argv[n], "--headless") == 0) {
+      config.headless = 1;
+      if (n + 1 < argc && argv[n + 1][0] != '-') config.headlessFrames = atoi(argv[++n]);
+    } else if (strcmp(argv[n], "--readback") == 0 && n + 2 < argc) {
+      char *format = argv[++n];
+      if (strcmp(format, "raw") == 0) config.readbackFormat = READBACK_RAW;
+      if (strcmp(format, "ppm") == 0) config.readbackFormat = READBACK_PPM;
+      if (strcmp(format, "png") == 0) config.readbackFormat = READBACK_PNG;
+      config.readbackPath = argv[++n];
+    } else if (strcmp(argv[n], "--profile") == 0) {
+      config.profiler = 1;
+      if (n + 1 < argc && argv[n + 1][0] != '-') config.profilerInterval = atof(argv[++n]);
+    } else if (strcmp(argv[n], "--trace") == 0 && n + 1 < argc) {
+      config.tracePath = argv[++n];
+    } else if (strcmp(argv[n], "--model") == 0 && n + 1 < argc) {
+      modelPaths[modelCount++] = argv[++n];
+    } else if (strcmp(argv[n], "--pipeline") == 0 && n + 1 < argc) {
+      pipelinePaths[pipelineCount++] = argv[++n];
+    } else if (strcmp(argv[n], "--texture") == 0 && n + 1 < argc) {
+      texturePath = argv[++n];
+    } else if (strcmp(argv[n], "--record-threads") == 0 && n + 1 < argc) {
+      config.recordThreads = atoi(argv[++n]);
+    } else if (strcmp(argv[n], "--instances") == 0 && n + 1 < argc) {
+      instanceCount = atoi(argv[++n]);
+    } else if (strcmp(argv[n], "--bench-record") == 0) {
+      benchRecord = 1;
+    } else if (strcmp(argv[n], "--bench-indirect") == 0) {
+      benchIndirect = 1;
+    } else if (strcmp(argv[n], "--bench-pipelines") == 0) {
+      benchPipelines = 1;
+    } else if (strcmp(argv[n], "--bench-descriptors") == 0) {
+      benchDescriptors = 1;
+    } else if (strcmp(argv[n], "--bindless") == 0) {
+      config.bindless = 1;
+    } else if (strcmp(argv[n], "--hot-reload") == 0) {
+      config.hotReload = 1;
+    } else if (strcmp(argv[n], "--shader-archive") == 0 && n + 1 < argc) {
+      config.shaderArchive = argv[++n];
+    } else if (strcmp(argv[n], "--pack-shaders") == 0 && n + 1 < argc) {
+      return engineWriteShaderArchive("shaders", argv[++n]) ? 0 : 1;
+    } else if (strcmp(argv[n], "--present") == 0 && n + 1 < argc) {
+      char *mode = argv[++n];
+      if (strcmp(mode, "immediate") == 0) config.presentMode = PRESENT_IMMEDIATE;
+      if (strcmp(mode, "mailbox") == 0) config.presentMode = PRESENT_MAILBOX;
+      if (strcmp(mode, "fifo") == 0) config.presentMode = PRESENT_FIFO;
+    } else if (strcmp(argv[n], "--frames-in-flight") == 0 && n + 1 < argc) {
+      config.framesInFlight = atoi(argv[++n]);
+    } else if (strcmp(argv[n], "--swapchain-images") == 0 && n + 1 < argc) {
+      config.swapChainImages = atoi(argv[++n]);
+    } else if (strcmp(argv[n], "--frame-limit") == 0 && n + 1 < argc) {
+      config.frameLimit = atof(argv[++n]);
+    } else if (strcmp(argv[n], "--refresh-rate") == 0 && n + 1 < argc) {
+      config.refreshRate = atof(argv[++n]);
+    } else if (strcmp(argv[n], "--late-latch") == 0) {
+      config.lateLatch = 1;
+    } else if (strcmp(argv[n], "--single-queue") == 0) {
+      config.singleQueue = 1;
+    } else if (strcmp(argv[n], "--bench-pacing") == 0) {
+      benchPacing = 1;
+    } else if (strcmp(argv[n], "--bench-resize") == 0) {
+      benchResize = 1;
+    } else if (strcmp(argv[n], "--bench-submit") == 0) {
+      benchSubmit = 1;
+    } else if (strcmp(argv[n], "--depth-prepass") == 0) {
+      config.depthPrepass = 1;
+    } else if (strcmp(argv[n], "--deferred") == 0) {
+      config.deferred = 1;
+    } else if (strcmp(argv[n], "--lights") == 0 && n + 1 < argc) {
+      config.lightCount = atoi(argv[++n]);
+    } else if (strcmp(argv[n], "--dynamic-resolution") == 0 && n + 1 < argc) {
+      config.targetFrameTime = atof(argv[++n]);
+    } else if (strcmp(argv[n], "--bench-hiz") == 0) {
+      benchHiZ = 1;
+    } else if (strcmp(argv[n], "--bench-uploads") == 0) {
+      benchUploads = 1;
+    } else if (strcmp(argv[n], "--size") == 0 && n + 1 < argc) {
+      sscanf(argv[++n], "%ux%u", &config.width, &config.height);
+    } else {
+      printf("Usage: %s [--headless [frames]] [--size WxH] [--readback raw|ppm|png PATH] [--profile [seconds]] [--trace PATH] [--model PATH]... [--pipeline PATH]... [--texture PATH] [--record-threads N] [--instances N] [--bindless] [--hot-reload] [--shader-archive PATH] [--pack-shaders PATH] [--present immediate|mailbox|fifo] [--frames-in-flight N] [--swapchain-images N] [--frame-limit FPS] [--refresh-rate HZ] [--late-latch] [--single-queue] [--depth-prepass] [--deferred] [--lights N] [--dynamic-resolution MS] [--bench-uploads] [--bench-record] [--bench-indirect] [--bench-descriptors] [--bench-pipelines] [--bench-pacing] [--bench-resize] [--bench-submit] [--bench-hiz]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  Engine *engine = engineCreate(&config);
+  if (benchUploads) {
+    engineBenchmarkUploads(engine);
+    engineDestroy(engine);
+    free(modelPaths);
+    free(pipelinePaths);
+    return 0;
+  }
+  if (benchIndirect) {
+    engineBenchmarkIndirect(engine);
+    engineDestroy(engine);
+    free(modelPaths);
+    free(pipelinePaths);
+    return 0;
+  }
+  if (benchHiZ) {
+    engineBenchmarkHiZ(engine);
+    engineDestroy(engine);
+    free(modelPaths);
+    free(pipelinePaths);
+    return 0;
+  }
+  if (benchDescriptors) {
+    engineBenchmarkDescriptors(engine);
+    engineDestroy(engine);
+    free(modelPaths);
+    free(pipelinePaths);
+    return 0;
+  }
+  if (benchPipelines) {
+    engineBenchmarkPipelines(engine);
+    engineDestroy(engine);
+    free(modelPaths);
+    free(pipelinePaths);
+    return 0;
+  }
+  if (benchPacing) {
+    engineBenchmarkPacing(engine);
+    engineDestroy(engine);
+    free(modelPaths);
+    free(pipelinePaths);
+    return 0;
+  }
+  if (benchResize) {
+    engineBenchmarkResize(engine);
+    engineDestroy(engine);
+    free(modelPaths);
+    free(pipelinePaths);
+    return 0;
+  }
+  if (benchSubmit) {
+    engineBenchmarkSubmit(engine);
+    engineDestroy(engine);
+    free(modelPaths);
+    free(pipelinePaths);
+    return 0;
+  }
+
+  Vertex quadVertices[] = {
+      {{-0.9f, -0.9f, 0.0f}, {1.0f, 1.0f, 0.0f}, {0.0f, 0.0f}},
+      {{-0.5f, -0.9f, 0.0f}, {0.0f, 1.0f, 1.0f}, {1.0f, 0.0f}},
+      {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 1.0f}, {1.0f, 1.0f}},
+      {{-0.9f, -0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}},
+  };
+  uint32_t quadIndices[] = {0, 1, 2, 2, 3, 0};
   engineAddPipeline(engine, pipelineCreate(engine));
+  engineAddMeshPipeline(engine, meshPipelineCreate(engine), engineCreateMesh(engine, quadVertices, 4, quadIndices, 6), NULL);
+
+  if (texturePath) {
+    Vertex texturedVertices[] = {
+        {{0.5f, -0.9f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 0.0f}},
+        {{0.9f, -0.9f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 0.0f}},
+        {{0.9f, -0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {1.0f, 1.0f}},
+        {{0.5f, -0.5f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}},
+    };
+    engineAddMeshPipeline(engine, texturedPipelineCreate(engine), engineCreateMesh(engine, texturedVertices, 4, quadIndices, 6), engineLoadTexture(engine, texturePath));
+  }
+
+  // Described pipelines are compiled together; mesh ones each draw a quad.
+  PipelineSource *pipelineSources = malloc(sizeof(PipelineSource) * argc);
+  VkPipeline *pipelines = malloc(sizeof(VkPipeline) * argc);
+  uint32_t describedCount = 0;
+  for (uint32_t n = 0; n < pipelineCount; n++) {
+    if (!engineLoadPipelineDescription(engine, pipelinePaths[n], &pipelineSources[describedCount])) continue;
+    if (pipelineSources[describedCount].kind == PIPELINE_INSTANCED) {
+      printf("Pipeline description %s: instanced pipelines are drawn with engineDrawInstance\n", pipelinePaths[n]);
+      continue;
+    }
+    describedCount++;
+  }
+  engineCompilePipelines(engine, pipelineSources, describedCount, 0, pipelines);
+  for (uint32_t n = 0; n < describedCount; n++) {
+    if (pipelineSources[n].kind == PIPELINE_VERTEXLESS) {
+      engineAddPipeline(engine, pipelines[n]);
+    } else {
+      engineAddMeshPipeline(engine, pipelines[n], engineCreateMesh(engine, quadVertices, 4, quadIndices, 6), NULL);
+    }
+  }
+  free(pipelineSources);
+  free(pipelines);
+  free(pipelinePaths);
+
+  Mesh **models = malloc(sizeof(Mesh *) * argc);
+  engineLoadModels(engine, modelPaths, modelCount, models);
+  for (uint32_t n = 0; n < modelCount; n++) {
+    if (models[n]) engineAddMeshPipeline(engine, meshPipelineCreate(engine), models[n], NULL);
+  }
+  free(models);
+  free(modelPaths);
+
+  if (benchRecord) {
+    engineBenchmarkRecording(engine);
+    engineDestroy(engine);
+    return 0;
+  }
+
+  // A grid of small quads below the fixed ones.
+  InstanceDemo demo;
+  memset(&demo, 0, sizeof(InstanceDemo));
+  if (instanceCount) {
+    Vertex instanceVertices[] = {
+        {{-1.0f, -1.0f, 0.0f}, {0.0f, 1.0f, 0.5f}, {0.0f, 0.0f}},
+        {{1.0f, -1.0f, 0.0f}, {0.0f, 0.5f, 1.0f}, {1.0f, 0.0f}},
+        {{1.0f, 1.0f, 0.0f}, {0.5f, 0.0f, 1.0f}, {1.0f, 1.0f}},
+        {{-1.0f, 1.0f, 0.0f}, {0.0f, 1.0f, 0.5f}, {0.0f, 1.0f}},
+    };
+    demo.mesh = engineCreateMesh(engine, instanceVertices, 4, quadIndices, 6);
+    demo.transforms = malloc(sizeof(mat4) * instanceCount);
+    demo.count = instanceCount;
+    uint32_t columns = (uint32_t)ceilf(sqrtf((float)instanceCount));
+    float cell = 2.0f / columns;
+    for (uint32_t n = 0; n < instanceCount; n++) {
+      vec3 position = {-1.0f + cell * (n % columns + 0.5f), -0.4f + cell * (n / columns + 0.5f) * 0.7f, 0.0f};
+      glm_translate_make(demo.transforms[n], position);
+      glm_scale_uniform(demo.transforms[n], cell * 0.3f);
+    }
+    engineSetFrameCallback(engine, instanceDemoFrame, &demo);
+  }
+
   engineRun(engine);
+  if (demo.mesh) {
+    engineDestroyMesh(engine, demo.mesh);
+    free(demo.transforms);
+  }
   engineDestroy(engine);
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,27 @@
+#version 450
+// For the unsized descriptor arrays. The index is a push constant, so no
+// access needs nonuniformEXT.
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+
+layout(set = 0, binding = 1) readonly buffer Buffers {
+    vec4 data[];
+} buffers[];
+
+layout(push_constant) uniform Indices {
+    uint image;
+    uint buffer;
+} indices;
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUV;
+
+layout(location = 0) out vec4 outColor;
+// Depth slope, as in triangle.frag.
+layout(location = 1) out vec2 outSlope;
+
+void main() {
+    outColor = texture(textures[indices.image], fragUV) * vec4(fragColor, 1.0);
+    outSlope = vec2(dFdx(gl_FragCoord.z), dFdy(gl_FragCoord.z));
+}
@@ -0,0 +1,21 @@
+#version 450
+
+layout(std430, set = 0, binding = 0) readonly buffer Instances { vec4 spheres[]; };
+
+layout(push_constant) uniform Camera { mat4 viewProjection; };
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inUV;
+
+layout(location = 0) out vec3 fragColor;
+
+// The depth pre-pass and the EQUAL-tested main pass must compute exactly the
+// same depth.
+invariant gl_Position;
+
+void main() {
+    vec4 sphere = spheres[gl_InstanceIndex];
+    gl_Position = viewProjection * vec4(inPosition * sphere.w + sphere.xyz, 1.0);
+    fragColor = inColor;
+}
@@ -0,0 +1,48 @@
+#version 450
+
+// Deferred lighting: sums every light over the G-buffer the scene subpass
+// left at this pixel, in normalised device coordinates.
+
+layout(input_attachment_index = 0, set = 0, binding = 0) uniform subpassInput albedo;
+layout(input_attachment_index = 1, set = 0, binding = 1) uniform subpassInput slope;
+layout(input_attachment_index = 2, set = 0, binding = 2) uniform subpassInput depth;
+
+struct Light {
+    vec3 position;
+    float radius;
+    vec4 color;
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer Lights {
+    Light lights[];
+};
+
+layout(push_constant) uniform Constants {
+    vec2 size;
+    uint lightCount;
+};
+
+layout(location = 0) out vec4 outColor;
+
+const float ambient = 0.05;
+
+void main() {
+    float z = subpassLoad(depth).r;
+    // Nothing was drawn here; keep the clear colour.
+    if (z >= 1.0) discard;
+    vec3 position = vec3(gl_FragCoord.xy / size * 2.0 - 1.0, z);
+    // A pixel is 2 / size wide in NDC. The faceted normal faces the viewer,
+    // towards -z.
+    vec3 normal = normalize(vec3(subpassLoad(slope).rg * size * 0.5, -1.0));
+    vec3 surface = subpassLoad(albedo).rgb;
+
+    vec3 color = surface * ambient;
+    for (uint n = 0; n < lightCount; n++) {
+        vec3 toLight = lights[n].position - position;
+        float distance = length(toLight);
+        float falloff = max(1.0 - distance / lights[n].radius, 0.0);
+        float diffuse = max(dot(normal, toLight / max(distance, 1e-4)), 0.0);
+        color += surface * lights[n].color.rgb * diffuse * falloff * falloff;
+    }
+    outColor = vec4(color, 1.0);
+}
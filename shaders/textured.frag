@@ -0,0 +1,15 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform sampler2D texSampler;
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUV;
+
+layout(location = 0) out vec4 outColor;
+// Depth slope, as in triangle.frag.
+layout(location = 1) out vec2 outSlope;
+
+void main() {
+    outColor = texture(texSampler, fragUV) * vec4(fragColor, 1.0);
+    outSlope = vec2(dFdx(gl_FragCoord.z), dFdy(gl_FragCoord.z));
+}
\ No newline at end of file
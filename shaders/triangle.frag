@@ -3,7 +3,11 @@
 layout(location = 0) in vec3 fragColor;
 
 layout(location = 0) out vec4 outColor;
+// The G-buffer's depth slope in deferred mode; forward rendering has no
+// attachment at location 1 and drops it.
+layout(location = 1) out vec2 outSlope;
 
 void main() {
     outColor = vec4(fragColor, 1.0);
+    outSlope = vec2(dFdx(gl_FragCoord.z), dFdy(gl_FragCoord.z));
 }
\ No newline at end of file